@@ -0,0 +1,831 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "hathor_client.h"
+
+// sign tx p1 values
+#define SIGN_TX_P1_DATA     0
+#define SIGN_TX_P1_SIGN     1
+#define SIGN_TX_P1_DONE     2
+#define SIGN_TX_P1_BATCH    4
+#define SIGN_TX_P1_PAYOUT   5
+
+// sign tx p2 flags only used by the client
+#define SIGN_TX_P2_PATHS    0x04
+#define SIGN_TX_P2_BATCH    0x08
+
+// first byte of the change output info
+#define CHANGE_INFO_NONE    0x00
+#define CHANGE_INFO_INDEX   0x01
+#define CHANGE_INFO_PATH    0x02
+#define CHANGE_INFO_FILTER  0x03
+
+// own filter p1
+#define OWN_FILTER_P1_START     0
+#define OWN_FILTER_P1_CONTINUE  1
+#define OWN_FILTER_P1_STATUS    2
+
+// address book p1
+#define ADDRESS_BOOK_P1_ADD     0
+#define ADDRESS_BOOK_P1_REMOVE  1
+
+// payout template p1 and the destinations sent in each packet
+#define PAYOUT_TEMPLATE_P1_START        0
+#define PAYOUT_TEMPLATE_P1_DESTINATIONS 1
+#define PAYOUT_TEMPLATE_P1_SAVE         2
+#define PAYOUT_TEMPLATE_P1_REMOVE       3
+#define PAYOUT_TEMPLATE_PACKET_DESTINATIONS 12
+
+// tx versions and the size of their headers, after the version
+#define TX_VERSION_REGULAR          1
+#define TX_VERSION_TOKEN_CREATION   2
+#define REGULAR_HEADER_LEN          3
+#define TOKEN_CREATION_HEADER_LEN   2
+
+#define FEATURE_BATCH_SIGN  (1 << 9)
+
+#define DER_SIGNATURE_MAX_LEN   72
+#define COMPACT_SIGNATURE_LEN   64
+#define PUBKEY_LEN              33
+
+// room for signatures on the device's response, before the status word
+#define DEVICE_RESPONSE_LEN     (5 + 255 - 2)
+
+static const uint32_t htr_address_prefix[4] = {44 | HATHOR_HARDENED, 280 | HATHOR_HARDENED, HATHOR_HARDENED, 0};
+
+static void write_u32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static uint32_t read_u32(const uint8_t *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+void hathor_client_init(hathor_client_t *client, hathor_transport_t transport) {
+    memset(client, 0, sizeof(hathor_client_t));
+    client->transport = transport;
+    client->retries = 2;
+}
+
+int hathor_command(hathor_client_t *client, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, size_t len,
+                   uint8_t *response, size_t *response_len) {
+    uint8_t apdu[5 + HATHOR_MAX_APDU_DATA];
+    uint8_t buffer[HATHOR_MAX_RESPONSE];
+    size_t buffer_len = 0;
+
+    if (len > HATHOR_MAX_APDU_DATA) {
+        return HATHOR_ERR_PARAM;
+    }
+    apdu[0] = HATHOR_CLA;
+    apdu[1] = ins;
+    apdu[2] = p1;
+    apdu[3] = p2;
+    apdu[4] = len;
+    if (len > 0) {
+        memcpy(apdu + 5, data, len);
+    }
+
+    client->apdus++;
+    if (client->transport.exchange(client->transport.context, apdu, 5 + len, buffer, &buffer_len) < 0) {
+        return HATHOR_ERR_TRANSPORT;
+    }
+    if (buffer_len < 2 || buffer_len > HATHOR_MAX_RESPONSE) {
+        return HATHOR_ERR_TRANSPORT;
+    }
+    client->sw = (buffer[buffer_len - 2] << 8) | buffer[buffer_len - 1];
+    if (response != NULL) {
+        memcpy(response, buffer, buffer_len - 2);
+    }
+    if (response_len != NULL) {
+        *response_len = buffer_len - 2;
+    }
+    return (client->sw == HATHOR_SW_OK ? HATHOR_OK : HATHOR_ERR_SW);
+}
+
+// sends a command that has no effect on the device's state, retrying it if the
+// transport fails
+static int stateless_command(hathor_client_t *client, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, size_t len,
+                             uint8_t *response, size_t *response_len) {
+    unsigned int attempt;
+    int result = HATHOR_ERR_TRANSPORT;
+
+    for (attempt = 0; attempt <= client->retries && result == HATHOR_ERR_TRANSPORT; attempt++) {
+        result = hathor_command(client, ins, p1, p2, data, len, response, response_len);
+    }
+    return result;
+}
+
+int hathor_get_version(hathor_client_t *client, uint8_t version[3]) {
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t len;
+    int result = stateless_command(client, HATHOR_INS_GET_VERSION, 0, 0, NULL, 0, response, &len);
+
+    if (result != HATHOR_OK) {
+        return result;
+    }
+    // "HTR", major, minor, patch
+    if (len < 6 || memcmp(response, "HTR", 3) != 0) {
+        return HATHOR_ERR_RESPONSE;
+    }
+    memcpy(version, response + 3, 3);
+    return HATHOR_OK;
+}
+
+int hathor_get_capabilities(hathor_client_t *client, hathor_capabilities_t *capabilities) {
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t len, offset;
+    uint8_t nodes, i;
+    int result = stateless_command(client, HATHOR_INS_GET_CAPABILITIES, 0, 0, NULL, 0, response, &len);
+
+    if (result != HATHOR_OK) {
+        return result;
+    }
+    memset(capabilities, 0, sizeof(hathor_capabilities_t));
+    // format_version, features, max_signatures, max_xpubs, decode_buffer_len, cached_nodes
+    if (len < 13) {
+        return HATHOR_ERR_RESPONSE;
+    }
+    capabilities->format_version = response[0];
+    capabilities->features = read_u32(response + 1);
+    memcpy(capabilities->max_signatures, response + 5, 4);
+    capabilities->max_xpubs = response[9];
+    capabilities->decode_buffer_len = (response[10] << 8) | response[11];
+    nodes = response[12];
+    offset = 13;
+    for (i = 0; i < nodes; i++) {
+        if (offset >= len) {
+            return HATHOR_ERR_RESPONSE;
+        }
+        offset += 1 + 4 * response[offset];
+    }
+    // fields appended by later versions
+    if (offset < len) {
+        capabilities->max_batch_txs = response[offset++];
+    }
+    if (offset < len) {
+        capabilities->max_lookup_hashes = response[offset++];
+    }
+    return HATHOR_OK;
+}
+
+// writes a path as [path_len, index * path_len]
+static size_t write_path(const hathor_path_t *path, uint8_t *out) {
+    uint8_t i;
+    out[0] = path->len;
+    for (i = 0; i < path->len; i++) {
+        write_u32(out + 1 + 4 * i, path->index[i]);
+    }
+    return 1 + 4 * path->len;
+}
+
+// checks whether a path is 44'/280'/0'/0/index, so only the index needs to be sent
+static bool is_key_index_path(const hathor_path_t *path) {
+    return path->len == 5 && memcmp(path->index, htr_address_prefix, sizeof(htr_address_prefix)) == 0;
+}
+
+void hathor_key_index_path(hathor_path_t *path, uint32_t index) {
+    memcpy(path->index, htr_address_prefix, sizeof(htr_address_prefix));
+    path->index[4] = index;
+    path->len = 5;
+}
+
+int hathor_show_address(hathor_client_t *client, const hathor_path_t *path) {
+    uint8_t data[1 + 4 * HATHOR_MAX_PATH];
+    size_t len;
+
+    if (path->len > HATHOR_MAX_PATH) {
+        return HATHOR_ERR_PARAM;
+    }
+    if (is_key_index_path(path)) {
+        write_u32(data, path->index[4]);
+        len = 4;
+    } else {
+        len = write_path(path, data);
+    }
+    return stateless_command(client, HATHOR_INS_GET_ADDRESS, 0, 0, data, len, NULL, NULL);
+}
+
+int hathor_get_xpubs(hathor_client_t *client, uint32_t account, uint8_t count, hathor_xpub_t *xpubs) {
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    uint8_t data[5];
+    size_t len, offset;
+    uint8_t received = 0;
+    int result;
+
+    if (count == 0) {
+        return HATHOR_ERR_PARAM;
+    }
+    write_u32(data, account);
+    data[4] = count;
+    // the range is sent on several responses, which only make sense together
+    result = hathor_command(client, HATHOR_INS_GET_XPUB, 0, 0, data, sizeof(data), response, &len);
+    for (;;) {
+        if (result != HATHOR_OK) {
+            return result;
+        }
+        if (len == 0 || len % sizeof(hathor_xpub_t) != 0 || received + len / sizeof(hathor_xpub_t) > count) {
+            return HATHOR_ERR_RESPONSE;
+        }
+        for (offset = 0; offset < len; offset += sizeof(hathor_xpub_t)) {
+            hathor_xpub_t *xpub = &xpubs[received++];
+            memcpy(xpub->public_key, response + offset, 65);
+            memcpy(xpub->chain_code, response + offset + 65, 32);
+            memcpy(xpub->parent_fingerprint, response + offset + 97, 4);
+        }
+        if (received == count) {
+            return HATHOR_OK;
+        }
+        result = hathor_command(client, HATHOR_INS_GET_XPUB, 1, 0, NULL, 0, response, &len);
+    }
+}
+
+// reads the status returned by every own filter command
+static int read_own_filter(const uint8_t *response, size_t len, hathor_own_filter_t *filter) {
+    if (len != 12) {
+        return HATHOR_ERR_RESPONSE;
+    }
+    filter->first_index = read_u32(response);
+    filter->count = read_u32(response + 4);
+    filter->built = read_u32(response + 8);
+    return (filter->built <= filter->count ? HATHOR_OK : HATHOR_ERR_RESPONSE);
+}
+
+// sends an own filter command, then asks for the next blocks until the filter is complete.
+// There's no filter to complete if the device has none, so it's asked for a block anyway
+// and replies with an error
+static int run_own_filter(hathor_client_t *client, uint8_t p1, const uint8_t *data, size_t len,
+                          hathor_own_filter_t *filter) {
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    hathor_own_filter_t status;
+    size_t response_len;
+    uint32_t built = 0;
+    int result;
+
+    result = hathor_command(client, HATHOR_INS_OWN_FILTER, p1, 0, data, len, response, &response_len);
+    for (;;) {
+        if (result != HATHOR_OK) {
+            return result;
+        }
+        result = read_own_filter(response, response_len, &status);
+        if (result != HATHOR_OK) {
+            return result;
+        }
+        if (status.built == status.count && status.count != 0) {
+            break;
+        }
+        if (p1 == OWN_FILTER_P1_CONTINUE && status.built <= built) {
+            // the device isn't adding keys
+            return HATHOR_ERR_RESPONSE;
+        }
+        built = status.built;
+        p1 = OWN_FILTER_P1_CONTINUE;
+        result = hathor_command(client, HATHOR_INS_OWN_FILTER, p1, 0, NULL, 0, response, &response_len);
+    }
+    if (filter != NULL) {
+        *filter = status;
+    }
+    return HATHOR_OK;
+}
+
+int hathor_build_own_filter(hathor_client_t *client, uint32_t first_index, uint32_t count, hathor_own_filter_t *filter) {
+    uint8_t data[8];
+
+    if (count == 0) {
+        return HATHOR_ERR_PARAM;
+    }
+    write_u32(data, first_index);
+    write_u32(data + 4, count);
+    return run_own_filter(client, OWN_FILTER_P1_START, data, sizeof(data), filter);
+}
+
+int hathor_resume_own_filter(hathor_client_t *client, hathor_own_filter_t *filter) {
+    // the status comes first, so a complete filter isn't asked for more blocks
+    return run_own_filter(client, OWN_FILTER_P1_STATUS, NULL, 0, filter);
+}
+
+int hathor_get_own_filter(hathor_client_t *client, hathor_own_filter_t *filter) {
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t len;
+    int result;
+
+    result = hathor_command(client, HATHOR_INS_OWN_FILTER, OWN_FILTER_P1_STATUS, 0, NULL, 0, response, &len);
+    if (result != HATHOR_OK) {
+        return result;
+    }
+    return read_own_filter(response, len, filter);
+}
+
+// sends an address book command, with the destination and label, if any
+static int run_address_book(hathor_client_t *client, uint8_t p1, uint8_t script_type, const uint8_t *hash,
+                            const char *label, uint16_t *book_len) {
+    uint8_t data[21 + HATHOR_LABEL_MAX_LEN];
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t label_len = (label != NULL ? strlen(label) : 0);
+    size_t len;
+    int result;
+
+    if ((script_type != HATHOR_SCRIPT_P2PKH && script_type != HATHOR_SCRIPT_P2SH) || hash == NULL
+        || label_len > HATHOR_LABEL_MAX_LEN) {
+        return HATHOR_ERR_PARAM;
+    }
+    data[0] = script_type;
+    memcpy(data + 1, hash, 20);
+    memcpy(data + 21, label, label_len);
+    result = hathor_command(client, HATHOR_INS_ADDRESS_BOOK, p1, 0, data, 21 + label_len, response, &len);
+    if (result != HATHOR_OK) {
+        return result;
+    }
+    if (len != 2) {
+        return HATHOR_ERR_RESPONSE;
+    }
+    if (book_len != NULL) {
+        *book_len = (response[0] << 8) | response[1];
+    }
+    return HATHOR_OK;
+}
+
+int hathor_add_trusted_address(hathor_client_t *client, uint8_t script_type, const uint8_t *hash, const char *label,
+                               uint16_t *book_len) {
+    if (label == NULL || label[0] == '\0') {
+        return HATHOR_ERR_PARAM;
+    }
+    return run_address_book(client, ADDRESS_BOOK_P1_ADD, script_type, hash, label, book_len);
+}
+
+int hathor_remove_trusted_address(hathor_client_t *client, uint8_t script_type, const uint8_t *hash, uint16_t *book_len) {
+    return run_address_book(client, ADDRESS_BOOK_P1_REMOVE, script_type, hash, NULL, book_len);
+}
+
+// reads the number of templates returned when one is saved or removed
+static int read_templates_len(int result, const uint8_t *response, size_t len, uint8_t *templates_len) {
+    if (result != HATHOR_OK) {
+        return result;
+    }
+    if (len != 1) {
+        return HATHOR_ERR_RESPONSE;
+    }
+    if (templates_len != NULL) {
+        *templates_len = response[0];
+    }
+    return HATHOR_OK;
+}
+
+int hathor_add_payout_template(hathor_client_t *client, const char *name, const uint8_t (*token_uids)[32],
+                               size_t tokens_len, const hathor_destination_t *destinations, size_t destinations_len,
+                               uint8_t *templates_len) {
+    uint8_t packet[HATHOR_MAX_APDU_DATA];
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t name_len = (name != NULL ? strlen(name) : 0);
+    size_t packet_len, len = 0, i;
+    int result;
+
+    if (name_len == 0 || name_len > HATHOR_LABEL_MAX_LEN || tokens_len > HATHOR_MAX_PAYOUT_TOKENS
+        || destinations_len == 0 || destinations_len > 255) {
+        return HATHOR_ERR_PARAM;
+    }
+    packet[0] = name_len;
+    memcpy(packet + 1, name, name_len);
+    packet[1 + name_len] = tokens_len;
+    for (i = 0; i < tokens_len; i++) {
+        memcpy(packet + 2 + name_len + 32 * i, token_uids[i], 32);
+    }
+    result = hathor_command(client, HATHOR_INS_PAYOUT_TEMPLATE, PAYOUT_TEMPLATE_P1_START, 0, packet,
+                            2 + name_len + 32 * tokens_len, NULL, NULL);
+
+    for (i = 0; i < destinations_len && result == HATHOR_OK; ) {
+        packet_len = 0;
+        for (; i < destinations_len && packet_len < PAYOUT_TEMPLATE_PACKET_DESTINATIONS * 21; i++) {
+            if (destinations[i].script_type != HATHOR_SCRIPT_P2PKH && destinations[i].script_type != HATHOR_SCRIPT_P2SH) {
+                return HATHOR_ERR_PARAM;
+            }
+            packet[packet_len] = destinations[i].script_type;
+            memcpy(packet + packet_len + 1, destinations[i].hash, 20);
+            packet_len += 21;
+        }
+        result = hathor_command(client, HATHOR_INS_PAYOUT_TEMPLATE, PAYOUT_TEMPLATE_P1_DESTINATIONS, 0, packet,
+                                packet_len, NULL, NULL);
+    }
+    if (result == HATHOR_OK) {
+        result = hathor_command(client, HATHOR_INS_PAYOUT_TEMPLATE, PAYOUT_TEMPLATE_P1_SAVE, 0, NULL, 0, response, &len);
+    }
+    return read_templates_len(result, response, len, templates_len);
+}
+
+int hathor_remove_payout_template(hathor_client_t *client, const char *name, uint8_t *templates_len) {
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t name_len = (name != NULL ? strlen(name) : 0);
+    size_t len;
+    int result;
+
+    if (name_len == 0 || name_len > HATHOR_LABEL_MAX_LEN) {
+        return HATHOR_ERR_PARAM;
+    }
+    result = hathor_command(client, HATHOR_INS_PAYOUT_TEMPLATE, PAYOUT_TEMPLATE_P1_REMOVE, 0, (const uint8_t *)name,
+                            name_len, response, &len);
+    return read_templates_len(result, response, len, templates_len);
+}
+
+// reads the device's limits, once per client
+static int load_capabilities(hathor_client_t *client) {
+    uint8_t p2;
+    int result;
+
+    if (client->has_capabilities) {
+        return HATHOR_OK;
+    }
+    result = hathor_get_capabilities(client, &client->capabilities);
+    if (result == HATHOR_ERR_SW && client->sw == HATHOR_SW_INS_NOT_SUPPORTED) {
+        // older versions: as many signatures as fit in the response and no batches
+        memset(&client->capabilities, 0, sizeof(hathor_capabilities_t));
+        for (p2 = 0; p2 < 4; p2++) {
+            uint8_t len = (p2 & HATHOR_SIGN_COMPACT ? COMPACT_SIGNATURE_LEN : DER_SIGNATURE_MAX_LEN);
+            len += (p2 & HATHOR_SIGN_PUBKEY ? PUBKEY_LEN : 0);
+            client->capabilities.max_signatures[p2] = DEVICE_RESPONSE_LEN / len;
+        }
+        result = HATHOR_OK;
+    }
+    if (result == HATHOR_OK) {
+        client->has_capabilities = true;
+    }
+    return result;
+}
+
+/*
+ * Tx layout, to find where each element of the sighash_all data ends. Only the
+ * sizes are read: the device validates the contents.
+ */
+typedef struct {
+    uint16_t version;
+    uint8_t tokens;
+    uint8_t inputs;
+    uint8_t outputs;
+    // token creation txs end with the token name and symbol
+    uint8_t token_info;
+} tx_layout_t;
+
+// reads the version and header, returning their size or 0 if they're not supported
+static size_t read_tx_header(const uint8_t *data, size_t len, tx_layout_t *layout) {
+    memset(layout, 0, sizeof(tx_layout_t));
+    if (len < 2) {
+        return 0;
+    }
+    layout->version = (data[0] << 8) | data[1];
+    switch (layout->version) {
+        case TX_VERSION_REGULAR:
+            if (len < 2 + REGULAR_HEADER_LEN) {
+                return 0;
+            }
+            layout->tokens = data[2];
+            layout->inputs = data[3];
+            layout->outputs = data[4];
+            return 2 + REGULAR_HEADER_LEN;
+        case TX_VERSION_TOKEN_CREATION:
+            if (len < 2 + TOKEN_CREATION_HEADER_LEN) {
+                return 0;
+            }
+            layout->inputs = data[2];
+            layout->outputs = data[3];
+            layout->token_info = 2;
+            return 2 + TOKEN_CREATION_HEADER_LEN;
+        default:
+            return 0;
+    }
+}
+
+// returns the size of the next element, or 0 if there's none or it's incomplete
+static size_t next_element_len(tx_layout_t *layout, const uint8_t *data, size_t len) {
+    size_t element_len;
+
+    if (layout->tokens > 0) {
+        layout->tokens--;
+        element_len = 32;
+    } else if (layout->inputs > 0) {
+        // tx_id, index and data_len. The data must be empty, but that's for the
+        // device to check
+        if (len < 35) {
+            return 0;
+        }
+        layout->inputs--;
+        element_len = 35 + ((data[33] << 8) | data[34]);
+    } else if (layout->outputs > 0) {
+        // value (4 or 8 bytes), token_data and script_len, followed by the script
+        size_t value_len = (len > 0 && (data[0] & 0x80) ? 8 : 4);
+        if (len < value_len + 3) {
+            return 0;
+        }
+        layout->outputs--;
+        element_len = value_len + 3 + ((data[value_len + 1] << 8) | data[value_len + 2]);
+    } else if (layout->token_info == 2) {
+        // info_version, name_len and name
+        if (len < 2) {
+            return 0;
+        }
+        layout->token_info--;
+        element_len = 2 + data[1];
+    } else if (layout->token_info == 1) {
+        // symbol_len and symbol
+        if (len < 1) {
+            return 0;
+        }
+        layout->token_info--;
+        element_len = 1 + data[0];
+    } else {
+        return 0;
+    }
+    return (element_len <= len ? element_len : 0);
+}
+
+// writes the change output info
+static size_t write_change_info(const hathor_tx_t *tx, uint8_t *out) {
+    if (!tx->has_change) {
+        out[0] = CHANGE_INFO_NONE;
+        return 1;
+    }
+    out[1] = tx->change_output_index;
+    if (tx->change_path.len == 0) {
+        out[0] = CHANGE_INFO_FILTER;
+        return 2;
+    }
+    if (is_key_index_path(&tx->change_path)) {
+        out[0] = CHANGE_INFO_INDEX;
+        write_u32(out + 2, tx->change_path.index[4]);
+        return 6;
+    }
+    out[0] = CHANGE_INFO_PATH;
+    return 2 + write_path(&tx->change_path, out + 2);
+}
+
+/*
+ * Sends a tx with p1 = 0 or 4. The first packet has the change output info, the
+ * tx header and, like every other packet, as many whole elements as fit. If the data
+ * can't be split in elements (eg. an unsupported version or an element that doesn't
+ * fit a packet), the rest is sent in full packets and the device rejects it.
+ */
+static int send_tx_data(hathor_client_t *client, const hathor_tx_t *tx, uint8_t p1, int batch_count) {
+    uint8_t packet[HATHOR_MAX_APDU_DATA];
+    const uint8_t *data = tx->sighash_all;
+    size_t len = tx->sighash_all_len;
+    size_t packet_len = 0;
+    size_t offset, element_len;
+    tx_layout_t layout;
+    bool aligned;
+    int result;
+
+    if (tx->change_path.len > HATHOR_MAX_PATH) {
+        return HATHOR_ERR_PARAM;
+    }
+    if (batch_count >= 0) {
+        packet[packet_len++] = batch_count;
+    }
+    packet_len += write_change_info(tx, packet + packet_len);
+
+    offset = read_tx_header(data, len, &layout);
+    aligned = (offset > 0);
+    memcpy(packet + packet_len, data, offset);
+    packet_len += offset;
+
+    while (offset < len) {
+        if (aligned) {
+            element_len = next_element_len(&layout, data + offset, len - offset);
+            // an element larger than a packet can't be sent whole (nor signed)
+            aligned = (element_len > 0 && element_len <= sizeof(packet));
+        }
+        if (!aligned) {
+            // no more elements we can find: fill the packets
+            element_len = (len - offset > sizeof(packet) ? sizeof(packet) : len - offset);
+        }
+        if (packet_len + element_len > sizeof(packet)) {
+            if (aligned) {
+                result = hathor_command(client, HATHOR_INS_SIGN_TX, p1, 0, packet, packet_len, NULL, NULL);
+                if (result != HATHOR_OK) {
+                    return result;
+                }
+                packet_len = 0;
+            } else {
+                element_len = sizeof(packet) - packet_len;
+            }
+        }
+        memcpy(packet + packet_len, data + offset, element_len);
+        packet_len += element_len;
+        offset += element_len;
+        if (!aligned && packet_len == sizeof(packet) && offset < len) {
+            result = hathor_command(client, HATHOR_INS_SIGN_TX, p1, 0, packet, packet_len, NULL, NULL);
+            if (result != HATHOR_OK) {
+                return result;
+            }
+            packet_len = 0;
+        }
+    }
+    // the last packet is only answered after the user reviews the tx
+    return hathor_command(client, HATHOR_INS_SIGN_TX, p1, 0, packet, packet_len, NULL, NULL);
+}
+
+// size of a signature on the response
+static size_t signature_len(const uint8_t *response, size_t len, uint8_t flags) {
+    size_t sig_len;
+
+    if (flags & HATHOR_SIGN_COMPACT) {
+        sig_len = COMPACT_SIGNATURE_LEN;
+    } else {
+        // DER: [0x30, len, ...]
+        if (len < 2 || response[0] != 0x30) {
+            return 0;
+        }
+        sig_len = 2 + response[1];
+    }
+    if (flags & HATHOR_SIGN_PUBKEY) {
+        sig_len += PUBKEY_LEN;
+    }
+    return (sig_len <= len && sig_len <= HATHOR_SIGNATURE_MAX_LEN ? sig_len : 0);
+}
+
+typedef struct {
+    size_t tx;
+    size_t key;
+} key_ref_t;
+
+/*
+ * Gets the signatures of every key of every tx. Each request has as many keys as
+ * the device signs in a single response and fit in the request. Keys are sent as
+ * indexes, unless one of the keys on the request needs its full path.
+ */
+static int get_signatures(hathor_client_t *client, hathor_tx_t *txs, size_t count, uint8_t flags, bool batch) {
+    uint8_t request[HATHOR_MAX_APDU_DATA];
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    key_ref_t refs[HATHOR_MAX_APDU_DATA / 4];
+    key_ref_t next = {0, 0};
+    uint8_t max_keys;
+    int result;
+
+    for (;;) {
+        key_ref_t ref;
+        size_t index_len = 0, path_len = 0, len, offset;
+        uint8_t keys = 0, p2, i;
+        bool paths = false;
+
+        // the next key to be signed
+        while (next.tx < count && next.key >= txs[next.tx].keys_len) {
+            next.tx++;
+            next.key = 0;
+        }
+        if (next.tx == count) {
+            return HATHOR_OK;
+        }
+
+        // how many keys fit in the request and its response
+        max_keys = client->capabilities.max_signatures[flags & (HATHOR_SIGN_COMPACT | HATHOR_SIGN_PUBKEY)];
+        if (max_keys > sizeof(refs) / sizeof(refs[0])) {
+            max_keys = sizeof(refs) / sizeof(refs[0]);
+        }
+        for (ref = next; ref.tx < count && keys < max_keys; ) {
+            const hathor_path_t *key;
+            if (ref.key >= txs[ref.tx].keys_len) {
+                ref.tx++;
+                ref.key = 0;
+                continue;
+            }
+            key = &txs[ref.tx].keys[ref.key];
+            if (key->len > HATHOR_MAX_PATH) {
+                return HATHOR_ERR_PARAM;
+            }
+            if ((paths || !is_key_index_path(key) ? path_len + (batch ? 1 : 0) + 1 + 4 * key->len : index_len + (batch ? 1 : 0) + 4) > sizeof(request)) {
+                break;
+            }
+            paths = paths || !is_key_index_path(key);
+            index_len += (batch ? 1 : 0) + 4;
+            path_len += (batch ? 1 : 0) + 1 + 4 * key->len;
+            refs[keys++] = ref;
+            ref.key++;
+        }
+        if (keys == 0) {
+            return HATHOR_ERR_PARAM;
+        }
+
+        len = 0;
+        for (i = 0; i < keys; i++) {
+            const hathor_path_t *key = &txs[refs[i].tx].keys[refs[i].key];
+            if (batch) {
+                request[len++] = refs[i].tx;
+            }
+            if (paths) {
+                len += write_path(key, request + len);
+            } else {
+                write_u32(request + len, key->index[4]);
+                len += 4;
+            }
+        }
+        p2 = flags | (paths ? SIGN_TX_P2_PATHS : 0) | (batch ? SIGN_TX_P2_BATCH : 0);
+        result = hathor_command(client, HATHOR_INS_SIGN_TX, SIGN_TX_P1_SIGN, p2, request, len, response, &len);
+        if (result != HATHOR_OK) {
+            return result;
+        }
+
+        // the signatures come in the same order as the keys
+        offset = 0;
+        for (i = 0; i < keys; i++) {
+            hathor_signature_t *signature = &txs[refs[i].tx].signatures[refs[i].key];
+            size_t sig_len = signature_len(response + offset, len - offset, flags);
+            if (sig_len == 0) {
+                return HATHOR_ERR_RESPONSE;
+            }
+            memcpy(signature->data, response + offset, sig_len);
+            signature->len = sig_len;
+            offset += sig_len;
+        }
+        if (offset != len) {
+            return HATHOR_ERR_RESPONSE;
+        }
+        next = refs[keys - 1];
+        next.key++;
+    }
+}
+
+// a whole sign tx session: the txs, the user's review and the signatures. The txs
+// are sent with p1 = SIGN_TX_P1_DATA, SIGN_TX_P1_BATCH or SIGN_TX_P1_PAYOUT
+static int sign_session(hathor_client_t *client, hathor_tx_t *txs, size_t count, uint8_t flags, uint8_t p1) {
+    size_t i;
+    int result = HATHOR_OK;
+
+    for (i = 0; i < count && result == HATHOR_OK; i++) {
+        if (p1 == SIGN_TX_P1_BATCH) {
+            result = send_tx_data(client, &txs[i], p1, i == 0 ? (int)count : -1);
+        } else {
+            result = send_tx_data(client, &txs[i], p1, -1);
+        }
+    }
+    if (result == HATHOR_OK) {
+        result = get_signatures(client, txs, count, flags, p1 == SIGN_TX_P1_BATCH);
+    }
+    if (result == HATHOR_OK) {
+        result = hathor_command(client, HATHOR_INS_SIGN_TX, SIGN_TX_P1_DONE, 0, NULL, 0, NULL, NULL);
+    }
+    return result;
+}
+
+// runs a session, starting over if the transport fails. The device is first told
+// the previous session is done, so it discards its state
+static int sign_with_retries(hathor_client_t *client, hathor_tx_t *txs, size_t count, uint8_t flags, uint8_t p1) {
+    unsigned int attempt;
+    uint16_t sw;
+    int result;
+
+    if (flags & ~(HATHOR_SIGN_COMPACT | HATHOR_SIGN_PUBKEY)) {
+        return HATHOR_ERR_PARAM;
+    }
+    result = load_capabilities(client);
+    for (attempt = 0; result == HATHOR_OK; attempt++) {
+        result = sign_session(client, txs, count, flags, p1);
+        if (result != HATHOR_ERR_TRANSPORT || attempt == client->retries) {
+            break;
+        }
+        sw = client->sw;
+        hathor_command(client, HATHOR_INS_SIGN_TX, SIGN_TX_P1_DONE, 0, NULL, 0, NULL, NULL);
+        client->sw = sw;
+        result = HATHOR_OK;
+    }
+    return result;
+}
+
+int hathor_sign_tx(hathor_client_t *client, hathor_tx_t *tx, uint8_t flags) {
+    return sign_with_retries(client, tx, 1, flags, SIGN_TX_P1_DATA);
+}
+
+int hathor_sign_payout(hathor_client_t *client, hathor_tx_t *tx, uint8_t flags) {
+    return sign_with_retries(client, tx, 1, flags, SIGN_TX_P1_PAYOUT);
+}
+
+int hathor_sign_txs(hathor_client_t *client, hathor_tx_t *txs, size_t count, uint8_t flags) {
+    size_t i;
+    int result;
+
+    if (count == 0) {
+        return HATHOR_ERR_PARAM;
+    }
+    result = load_capabilities(client);
+    if (result != HATHOR_OK) {
+        return result;
+    }
+    if (count > 1 && (client->capabilities.features & FEATURE_BATCH_SIGN)) {
+        if (count > client->capabilities.max_batch_txs) {
+            return HATHOR_ERR_PARAM;
+        }
+        return sign_with_retries(client, txs, count, flags, SIGN_TX_P1_BATCH);
+    }
+    for (i = 0; i < count; i++) {
+        result = sign_with_retries(client, &txs[i], 1, flags, SIGN_TX_P1_DATA);
+        if (result != HATHOR_OK) {
+            return result;
+        }
+    }
+    return HATHOR_OK;
+}
@@ -0,0 +1,481 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Reference client for the Hathor app's APDU protocol. It doesn't depend on the app's
+ * sources or on any USB library: APDUs go through a transport given by the wallet.
+ *
+ * The sign tx protocol (see src/sign_tx.c) is implemented with:
+ *   . change output info framing, with the key index or the full bip32 path;
+ *   . packets that always end on a tx element boundary, so the device decodes every
+ *     element in place and never has to carry a split one to the next packet;
+ *   . signature requests with as many keys as fit in each response, using key
+ *     indexes instead of paths whenever the keys allow it;
+ *   . batches of txs approved with a single review (p1 = 4);
+ *   . retries of the whole session when the transport fails.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HATHOR_CLA                  0xE0
+#define HATHOR_INS_GET_VERSION      0x01
+#define HATHOR_INS_GET_ADDRESS      0x02
+#define HATHOR_INS_GET_CAPABILITIES 0x03
+#define HATHOR_INS_SIGN_TX          0x04
+#define HATHOR_INS_OWN_FILTER       0x07
+#define HATHOR_INS_ADDRESS_BOOK     0x08
+#define HATHOR_INS_PAYOUT_TEMPLATE  0x09
+#define HATHOR_INS_GET_XPUB         0x10
+
+#define HATHOR_SW_OK                0x9000
+#define HATHOR_SW_USER_REJECTED     0x6985
+#define HATHOR_SW_INS_NOT_SUPPORTED 0x6D00
+
+// script types of an address book destination
+#define HATHOR_SCRIPT_P2PKH         1
+#define HATHOR_SCRIPT_P2SH          2
+
+// maximum label length of an address book destination, also the maximum name
+// length of a payout template
+#define HATHOR_LABEL_MAX_LEN        12
+
+// maximum custom tokens of a payout template
+#define HATHOR_MAX_PAYOUT_TOKENS    3
+
+// maximum data on a command APDU
+#define HATHOR_MAX_APDU_DATA        255
+// maximum response, including the status word
+#define HATHOR_MAX_RESPONSE         (255 + 2)
+
+// results of the client functions
+#define HATHOR_OK               0
+#define HATHOR_ERR_TRANSPORT    (-1)    // the transport failed, even after the retries
+#define HATHOR_ERR_SW           (-2)    // the device replied with an error; see the client's sw
+#define HATHOR_ERR_PARAM        (-3)    // invalid arguments, eg. a tx that can't be framed
+#define HATHOR_ERR_RESPONSE     (-4)    // the response doesn't have the expected format
+
+// bip32 paths
+#define HATHOR_MAX_PATH     10
+#define HATHOR_HARDENED     0x80000000
+
+// p2 flags of the signature requests
+#define HATHOR_SIGN_COMPACT 0x01    // 64-byte r || s signatures, instead of DER
+#define HATHOR_SIGN_PUBKEY  0x02    // each signature is followed by its compressed public key
+
+// DER signature and compressed public key
+#define HATHOR_SIGNATURE_MAX_LEN (72 + 33)
+
+/**
+ * Sends a command APDU to the device and receives its response.
+ *
+ * @param  [in] context
+ *   The transport's context.
+ *
+ * @param  [in] apdu
+ *   The command: [cla, ins, p1, p2, lc, data].
+ *
+ * @param  [in] apdu_len
+ *   Size of the command.
+ *
+ * @param [out] response
+ *   The response, ending with the 2-byte status word. Has HATHOR_MAX_RESPONSE bytes.
+ *
+ * @param [out] response_len
+ *   Size of the response.
+ *
+ * @return 0 or a negative value if the transport failed
+ */
+typedef int (*hathor_exchange_fn)(void *context, const uint8_t *apdu, size_t apdu_len, uint8_t *response, size_t *response_len);
+
+// A way to reach the device, eg. USB HID or the host build of the app (see host/)
+typedef struct {
+    void *context;
+    hathor_exchange_fn exchange;
+} hathor_transport_t;
+
+typedef struct {
+    uint8_t format_version;
+    uint32_t features;
+    // for p2 = 0x00, 0x01, 0x02 and 0x03
+    uint8_t max_signatures[4];
+    uint8_t max_xpubs;
+    uint16_t decode_buffer_len;
+    uint8_t max_batch_txs;
+    uint8_t max_lookup_hashes;
+} hathor_capabilities_t;
+
+typedef struct {
+    hathor_transport_t transport;
+    // how many times a command or sign tx session is restarted after a transport failure
+    unsigned int retries;
+    // status word of the last response
+    uint16_t sw;
+    // the device's limits, read on the first sign tx session. Older versions of the
+    // app don't have get capabilities, so the protocol's defaults are used
+    bool has_capabilities;
+    hathor_capabilities_t capabilities;
+    // APDUs exchanged, including retries
+    unsigned long apdus;
+} hathor_client_t;
+
+typedef struct {
+    uint8_t len;
+    uint32_t index[HATHOR_MAX_PATH];
+} hathor_path_t;
+
+typedef struct {
+    // DER or compact signature, followed by the public key with HATHOR_SIGN_PUBKEY
+    uint8_t data[HATHOR_SIGNATURE_MAX_LEN];
+    uint8_t len;
+} hathor_signature_t;
+
+typedef struct {
+    // the change output isn't shown to the user, as the device checks it's sent to
+    // the given key or, if change_path is empty, to one of the keys on its own keys
+    // filter (see hathor_build_own_filter)
+    bool has_change;
+    uint8_t change_output_index;
+    hathor_path_t change_path;
+    // the tx data to be signed (sighash_all)
+    const uint8_t *sighash_all;
+    size_t sighash_all_len;
+    // keys that sign the tx, one signature each
+    const hathor_path_t *keys;
+    size_t keys_len;
+    // the signatures, with keys_len entries
+    hathor_signature_t *signatures;
+} hathor_tx_t;
+
+typedef struct {
+    // uncompressed
+    uint8_t public_key[65];
+    uint8_t chain_code[32];
+    uint8_t parent_fingerprint[4];
+} hathor_xpub_t;
+
+// an output's destination: the pubkey hash (P2PKH) or script hash (P2SH)
+typedef struct {
+    uint8_t script_type;
+    uint8_t hash[20];
+} hathor_destination_t;
+
+typedef struct {
+    // range of key indexes on the filter and how many of them have been added
+    uint32_t first_index;
+    uint32_t count;
+    uint32_t built;
+} hathor_own_filter_t;
+
+/**
+ * Initializes a client, without talking to the device.
+ *
+ * @param [out] client
+ *   The client.
+ *
+ * @param  [in] transport
+ *   How to reach the device.
+ *
+ */
+void hathor_client_init(hathor_client_t *client, hathor_transport_t transport);
+
+/**
+ * Sends a single command, without retries.
+ *
+ * @param [in/out] client
+ *   The client. Its sw is set to the response's status word.
+ *
+ * @param  [in] ins, p1, p2
+ *   The command.
+ *
+ * @param  [in] data
+ *   The command's data. May be NULL if len is 0.
+ *
+ * @param  [in] len
+ *   Size of data, up to HATHOR_MAX_APDU_DATA.
+ *
+ * @param [out] response
+ *   The response's data, without the status word. Should have HATHOR_MAX_RESPONSE bytes.
+ *   May be NULL.
+ *
+ * @param [out] response_len
+ *   Size of the response's data. May be NULL.
+ *
+ * @return HATHOR_OK if the status word is HATHOR_SW_OK, or an error
+ */
+int hathor_command(hathor_client_t *client, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, size_t len,
+                   uint8_t *response, size_t *response_len);
+
+/**
+ * Gets the app's version.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [out] version
+ *   Major, minor and patch.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_get_version(hathor_client_t *client, uint8_t version[3]);
+
+/**
+ * Gets the app's features and limits.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [out] capabilities
+ *   The capabilities.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_get_capabilities(hathor_client_t *client, hathor_capabilities_t *capabilities);
+
+/**
+ * Shows the address of a key on the device, for the user to compare it.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] path
+ *   The key's bip32 path.
+ *
+ * @return HATHOR_OK once the user has gone through the address, or an error
+ */
+int hathor_show_address(hathor_client_t *client, const hathor_path_t *path);
+
+/**
+ * Gets the xpubs of a range of accounts (44'/280'/account'/0), with a single approval.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] account
+ *   The first account.
+ *
+ * @param  [in] count
+ *   Number of accounts.
+ *
+ * @param [out] xpubs
+ *   One xpub for each account.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_get_xpubs(hathor_client_t *client, uint32_t account, uint8_t count, hathor_xpub_t *xpubs);
+
+/**
+ * Builds the device's own keys filter for the key indexes [first_index, first_index + count),
+ * replacing the old one, with a single approval. The device adds a block of keys on each
+ * request, so it takes about one request per 16 keys. The filter is kept on the device and
+ * lets txs have their change key found there.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] first_index
+ *   The first key index.
+ *
+ * @param  [in] count
+ *   Number of key indexes, up to the device's limit (2048).
+ *
+ * @param [out] filter
+ *   The filter's status at the end. May be NULL.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_build_own_filter(hathor_client_t *client, uint32_t first_index, uint32_t count, hathor_own_filter_t *filter);
+
+/**
+ * Gets the status of the device's own keys filter. A filter with built < count may be
+ * finished with hathor_resume_own_filter.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [out] filter
+ *   The filter's status. count is 0 if there's no filter.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_get_own_filter(hathor_client_t *client, hathor_own_filter_t *filter);
+
+/**
+ * Adds the keys still missing from the device's own keys filter, without an approval.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [out] filter
+ *   The filter's status at the end. May be NULL.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_resume_own_filter(hathor_client_t *client, hathor_own_filter_t *filter);
+
+/**
+ * Adds a destination to the device's address book, or changes its label. The user
+ * approves it on the device. Outputs sent to it are then shown with the label.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] script_type
+ *   HATHOR_SCRIPT_P2PKH or HATHOR_SCRIPT_P2SH.
+ *
+ * @param  [in] hash
+ *   The destination's 20-byte pubkey hash or script hash.
+ *
+ * @param  [in] label
+ *   NULL-terminated label, with 1 to HATHOR_LABEL_MAX_LEN printable ASCII characters.
+ *
+ * @param [out] book_len
+ *   Number of destinations on the book at the end. May be NULL.
+ *
+ * @return HATHOR_OK or an error. A rejection is HATHOR_ERR_SW with HATHOR_SW_USER_REJECTED
+ */
+int hathor_add_trusted_address(hathor_client_t *client, uint8_t script_type, const uint8_t *hash, const char *label,
+                               uint16_t *book_len);
+
+/**
+ * Removes a destination from the device's address book, without an approval. It's
+ * not an error if it isn't there.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] script_type
+ *   HATHOR_SCRIPT_P2PKH or HATHOR_SCRIPT_P2SH.
+ *
+ * @param  [in] hash
+ *   The destination's 20-byte pubkey hash or script hash.
+ *
+ * @param [out] book_len
+ *   Number of destinations on the book at the end. May be NULL.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_remove_trusted_address(hathor_client_t *client, uint8_t script_type, const uint8_t *hash, uint16_t *book_len);
+
+/**
+ * Registers a payout template on the device, or replaces the one with the same
+ * name. The user reviews its name, tokens and destinations and approves it. Txs
+ * with these tokens and destinations, in order, can then be signed with
+ * hathor_sign_payout.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] name
+ *   NULL-terminated name, with 1 to HATHOR_LABEL_MAX_LEN printable ASCII characters.
+ *
+ * @param  [in] token_uids
+ *   The token uids of the txs, in order, without HTR.
+ *
+ * @param  [in] tokens_len
+ *   Number of token uids, up to HATHOR_MAX_PAYOUT_TOKENS.
+ *
+ * @param  [in] destinations
+ *   Destinations of the txs' outputs, in order, without the change output.
+ *
+ * @param  [in] destinations_len
+ *   Number of destinations, 1 to 255.
+ *
+ * @param [out] templates_len
+ *   Number of templates on the device at the end. May be NULL.
+ *
+ * @return HATHOR_OK or an error. A rejection is HATHOR_ERR_SW with HATHOR_SW_USER_REJECTED
+ */
+int hathor_add_payout_template(hathor_client_t *client, const char *name, const uint8_t (*token_uids)[32],
+                               size_t tokens_len, const hathor_destination_t *destinations, size_t destinations_len,
+                               uint8_t *templates_len);
+
+/**
+ * Removes a payout template from the device, without an approval. It's not an
+ * error if there's no template with this name.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param  [in] name
+ *   NULL-terminated name of the template.
+ *
+ * @param [out] templates_len
+ *   Number of templates on the device at the end. May be NULL.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_remove_payout_template(hathor_client_t *client, const char *name, uint8_t *templates_len);
+
+/**
+ * Signs a tx. The user reviews its outputs on the device.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [in/out] tx
+ *   The tx. Its signatures are set.
+ *
+ * @param  [in] flags
+ *   HATHOR_SIGN_* flags.
+ *
+ * @return HATHOR_OK or an error. A rejection is HATHOR_ERR_SW with HATHOR_SW_USER_REJECTED
+ */
+int hathor_sign_tx(hathor_client_t *client, hathor_tx_t *tx, uint8_t flags);
+
+/**
+ * Signs a regular tx matching one of the device's payout templates (see
+ * hathor_add_payout_template). The user only reviews the template's name and the
+ * total of each token. The device rejects it if no template matches.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [in/out] tx
+ *   The tx. Its signatures are set.
+ *
+ * @param  [in] flags
+ *   HATHOR_SIGN_* flags.
+ *
+ * @return HATHOR_OK or an error. A rejection is HATHOR_ERR_SW with HATHOR_SW_USER_REJECTED
+ */
+int hathor_sign_payout(hathor_client_t *client, hathor_tx_t *tx, uint8_t flags);
+
+/**
+ * Signs several regular txs with a single review on the device, if it supports
+ * batches. Otherwise, each one is signed on its own.
+ *
+ * @param [in/out] client
+ *   The client.
+ *
+ * @param [in/out] txs
+ *   The txs. Their signatures are set.
+ *
+ * @param  [in] count
+ *   Number of txs, up to the device's max_batch_txs.
+ *
+ * @param  [in] flags
+ *   HATHOR_SIGN_* flags.
+ *
+ * @return HATHOR_OK or an error
+ */
+int hathor_sign_txs(hathor_client_t *client, hathor_tx_t *txs, size_t count, uint8_t flags);
+
+/**
+ * Sets a path to 44'/280'/0'/0/index, the key of the wallet's index-th address.
+ *
+ * @param [out] path
+ *   The path.
+ *
+ * @param  [in] index
+ *   The key index.
+ *
+ */
+void hathor_key_index_path(hathor_path_t *path, uint32_t index);
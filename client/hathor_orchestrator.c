@@ -0,0 +1,276 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "hathor_orchestrator.h"
+
+// bytes exchanged for each key and xpub, to balance the queues
+#define KEY_COST    (4 * HATHOR_MAX_PATH + HATHOR_SIGNATURE_MAX_LEN)
+#define XPUB_COST   (65 + 32 + 4)
+
+typedef struct {
+    pthread_mutex_t lock;
+    // indexes of the jobs, taken from the head by the device and from the tail by thieves
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+    // cost of the queued jobs, to pick which queue to steal from
+    size_t cost;
+} job_queue_t;
+
+typedef struct run run_t;
+
+typedef struct {
+    run_t *run;
+    int index;
+    hathor_client_t client;
+    hathor_device_stats_t stats;
+    pthread_t thread;
+    bool started;
+} worker_t;
+
+struct run {
+    hathor_job_t *jobs;
+    size_t devices;
+    job_queue_t queues[HATHOR_MAX_DEVICES];
+    worker_t workers[HATHOR_MAX_DEVICES];
+
+    // idle devices wait for a requeued job or for the last job to finish
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t unfinished;
+};
+
+// never 0, so only empty queues have no cost
+static size_t job_cost(const hathor_job_t *job) {
+    if (job->type == HATHOR_JOB_SIGN_TX) {
+        return 1 + job->tx->sighash_all_len + job->tx->keys_len * KEY_COST;
+    }
+    return 1 + job->count * XPUB_COST;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool pop_head(run_t *run, job_queue_t *queue, size_t *job) {
+    bool found = false;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *job = queue->jobs[queue->head++];
+        __atomic_fetch_sub(&queue->cost, job_cost(&run->jobs[*job]), __ATOMIC_RELAXED);
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool pop_tail(run_t *run, job_queue_t *queue, size_t *job) {
+    bool found = false;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *job = queue->jobs[--queue->tail];
+        __atomic_fetch_sub(&queue->cost, job_cost(&run->jobs[*job]), __ATOMIC_RELAXED);
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+/*
+ * Puts back a job the device couldn't run, at the head of its queue. A queue never
+ * has all the jobs while one is being run, so there's room for it.
+ */
+static void push_head(run_t *run, job_queue_t *queue, size_t job) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head == 0) {
+        memmove(queue->jobs + 1, queue->jobs, queue->tail * sizeof(size_t));
+        queue->tail++;
+    } else {
+        queue->head--;
+    }
+    queue->jobs[queue->head] = job;
+    __atomic_fetch_add(&queue->cost, job_cost(&run->jobs[job]), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// takes a job from the device's queue or, if it's empty, from the end of the longest one
+static bool take_job(worker_t *worker, size_t *job) {
+    run_t *run = worker->run;
+    size_t i, victim, cost, max_cost;
+
+    if (pop_head(run, &run->queues[worker->index], job)) {
+        return true;
+    }
+    for (;;) {
+        // the costs are read without the locks, only to choose the victim
+        victim = 0;
+        max_cost = 0;
+        for (i = 0; i < run->devices; i++) {
+            cost = __atomic_load_n(&run->queues[i].cost, __ATOMIC_RELAXED);
+            if (cost > max_cost) {
+                victim = i;
+                max_cost = cost;
+            }
+        }
+        if (max_cost == 0) {
+            return false;
+        }
+        if (pop_tail(run, &run->queues[victim], job)) {
+            worker->stats.stolen++;
+            return true;
+        }
+    }
+}
+
+static int run_job(hathor_client_t *client, hathor_job_t *job) {
+    if (job->type == HATHOR_JOB_SIGN_TX) {
+        return hathor_sign_tx(client, job->tx, job->flags);
+    }
+    return hathor_get_xpubs(client, job->account, job->count, job->xpubs);
+}
+
+static void* worker_thread(void *arg) {
+    worker_t *worker = arg;
+    run_t *run = worker->run;
+    hathor_job_t *job;
+    size_t index;
+    double start;
+    bool found;
+
+    for (;;) {
+        found = take_job(worker, &index);
+        if (!found) {
+            pthread_mutex_lock(&run->lock);
+            while (run->unfinished > 0 && !(found = take_job(worker, &index))) {
+                pthread_cond_wait(&run->changed, &run->lock);
+            }
+            pthread_mutex_unlock(&run->lock);
+            if (!found) {
+                break;
+            }
+        }
+
+        job = &run->jobs[index];
+        worker->client.sw = 0;
+        start = now();
+        job->result = run_job(&worker->client, job);
+        worker->stats.busy_seconds += now() - start;
+        job->sw = worker->client.sw;
+        job->device = worker->index;
+
+        if (job->result == HATHOR_ERR_TRANSPORT) {
+            // another device takes the job, and the ones still queued here
+            job->device = -1;
+            worker->stats.failed = true;
+            push_head(run, &run->queues[worker->index], index);
+            pthread_mutex_lock(&run->lock);
+            pthread_cond_broadcast(&run->changed);
+            pthread_mutex_unlock(&run->lock);
+            break;
+        }
+        worker->stats.jobs++;
+        pthread_mutex_lock(&run->lock);
+        if (--run->unfinished == 0) {
+            pthread_cond_broadcast(&run->changed);
+        }
+        pthread_mutex_unlock(&run->lock);
+    }
+    worker->stats.apdus = worker->client.apdus;
+    return NULL;
+}
+
+int hathor_run_jobs(const hathor_transport_t *transports, size_t devices, hathor_job_t *jobs, size_t count,
+                    hathor_device_stats_t *stats) {
+    run_t *run;
+    size_t i, j, lightest;
+    size_t queued = count;
+    int failed = 0;
+
+    if (devices == 0 || devices > HATHOR_MAX_DEVICES) {
+        return HATHOR_ERR_PARAM;
+    }
+    for (i = 0; i < count; i++) {
+        if ((jobs[i].type == HATHOR_JOB_SIGN_TX && jobs[i].tx == NULL) ||
+            (jobs[i].type == HATHOR_JOB_GET_XPUBS && (jobs[i].xpubs == NULL || jobs[i].count == 0))) {
+            return HATHOR_ERR_PARAM;
+        }
+        jobs[i].result = HATHOR_ERR_TRANSPORT;
+        jobs[i].sw = 0;
+        jobs[i].device = -1;
+    }
+
+    run = calloc(1, sizeof(run_t));
+    if (run == NULL) {
+        return count;
+    }
+    run->jobs = jobs;
+    run->devices = devices;
+    pthread_mutex_init(&run->lock, NULL);
+    pthread_cond_init(&run->changed, NULL);
+    for (i = 0; i < devices; i++) {
+        pthread_mutex_init(&run->queues[i].lock, NULL);
+        run->queues[i].jobs = malloc((count > 0 ? count : 1) * sizeof(size_t));
+        if (run->queues[i].jobs == NULL) {
+            // no job is run
+            queued = 0;
+        }
+        run->workers[i].run = run;
+        run->workers[i].index = i;
+        hathor_client_init(&run->workers[i].client, transports[i]);
+    }
+
+    // each job goes to the queue with the least work, keeping their order
+    run->unfinished = queued;
+    for (i = 0; i < queued; i++) {
+        lightest = 0;
+        for (j = 1; j < devices; j++) {
+            if (run->queues[j].cost < run->queues[lightest].cost) {
+                lightest = j;
+            }
+        }
+        run->queues[lightest].jobs[run->queues[lightest].tail++] = i;
+        run->queues[lightest].cost += job_cost(&jobs[i]);
+    }
+
+    // a device whose thread can't be started has its queue taken over by the others
+    for (i = 0; i < devices && queued > 0; i++) {
+        run->workers[i].started = (pthread_create(&run->workers[i].thread, NULL, worker_thread, &run->workers[i]) == 0);
+        run->workers[i].stats.failed = !run->workers[i].started;
+    }
+    for (i = 0; i < devices; i++) {
+        if (run->workers[i].started) {
+            pthread_join(run->workers[i].thread, NULL);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (jobs[i].result != HATHOR_OK) {
+            failed++;
+        }
+    }
+    for (i = 0; i < devices; i++) {
+        if (stats != NULL) {
+            stats[i] = run->workers[i].stats;
+        }
+        pthread_mutex_destroy(&run->queues[i].lock);
+        free(run->queues[i].jobs);
+    }
+    pthread_cond_destroy(&run->changed);
+    pthread_mutex_destroy(&run->lock);
+    free(run);
+    return failed;
+}
@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Runs a queue of jobs on several devices at once, with a thread and a hathor_client_t
+ * per device. The jobs are split among per-device queues, balanced by their size, and a
+ * device that empties its queue steals jobs from the end of the longest one. A device
+ * whose transport fails stops taking jobs and its queue is taken over by the others.
+ *
+ * Each job still needs its own approval on the device that runs it.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hathor_client.h"
+
+// most devices driven at once
+#define HATHOR_MAX_DEVICES 64
+
+typedef enum {
+    HATHOR_JOB_SIGN_TX,     // hathor_sign_tx
+    HATHOR_JOB_GET_XPUBS,   // hathor_get_xpubs
+} hathor_job_type_e;
+
+typedef struct {
+    hathor_job_type_e type;
+
+    // HATHOR_JOB_SIGN_TX: the tx, whose signatures are set, and the HATHOR_SIGN_* flags
+    hathor_tx_t *tx;
+    uint8_t flags;
+
+    // HATHOR_JOB_GET_XPUBS: the accounts and their xpubs, with count entries
+    uint32_t account;
+    uint8_t count;
+    hathor_xpub_t *xpubs;
+
+    // set when the job is run: the client function's result and status word, and the
+    // device that ran it. Jobs not run because every device failed have
+    // HATHOR_ERR_TRANSPORT and device -1
+    int result;
+    uint16_t sw;
+    int device;
+} hathor_job_t;
+
+typedef struct {
+    unsigned long jobs;
+    // jobs taken from another device's queue
+    unsigned long stolen;
+    unsigned long apdus;
+    // time spent running jobs
+    double busy_seconds;
+    // the transport failed and the device stopped taking jobs
+    bool failed;
+} hathor_device_stats_t;
+
+/**
+ * Runs the jobs on the devices and waits for all of them.
+ *
+ * @param  [in] transports
+ *   The devices. Each one is used by a single thread.
+ *
+ * @param  [in] devices
+ *   Number of devices, up to HATHOR_MAX_DEVICES.
+ *
+ * @param [in/out] jobs
+ *   The jobs. Their results are set.
+ *
+ * @param  [in] count
+ *   Number of jobs.
+ *
+ * @param [out] stats
+ *   Stats of each device, with devices entries. May be NULL.
+ *
+ * @return the number of failed jobs, or HATHOR_ERR_PARAM
+ */
+int hathor_run_jobs(const hathor_transport_t *transports, size_t devices, hathor_job_t *jobs, size_t count,
+                    hathor_device_stats_t *stats);
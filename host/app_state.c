@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// The app state, defined on main.c on the device. Each thread has its own (see
+// APP_STATE on ux.h).
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+APP_STATE commandContext global;
+APP_STATE sessionContext session;
+
+unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host implementation of the SDK's io and UX layers, for the app built with
+ * HATHOR_HOST. io_exchange hands the responses to the client's thread and waits
+ * for its next command. While the app owes a response (IO_ASYNCH_REPLY), the
+ * virtual user presses the buttons of the screen being shown, as the SDK does
+ * with button events while waiting for a command.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include "hathor_device.h"
+
+// a review that takes more presses than this is stuck and closes the device
+#define MAX_BUTTON_PRESSES 10000
+
+void hathor_host_main(void);
+
+unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+unsigned int G_io_apdu_media = IO_APDU_MEDIA_USB_HID;
+
+const bagl_icon_details_t C_icon_back;
+const bagl_icon_details_t C_icon_dashboard;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+    bool running;
+    // the client stopped the device or the app exited
+    bool closed;
+    hathor_device_options_t options;
+
+    // command waiting for the app and the app's response
+    uint8_t command[IO_APDU_BUFFER_SIZE];
+    size_t command_len;
+    bool has_command;
+    uint8_t response[IO_APDU_BUFFER_SIZE];
+    size_t response_len;
+    bool has_response;
+    // the app received a command and didn't respond yet
+    bool response_owed;
+
+    // screen being shown, if it has buttons
+    const bagl_element_t *elements;
+    unsigned int elements_len;
+    button_push_callback_t button;
+    bagl_element_prepro_t prepro;
+} device = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+};
+
+// returns the element as shown on the screen, or NULL if the preprocessor hides it
+static const bagl_element_t* shown_element(const bagl_element_t *element) {
+    if (device.prepro == NULL) {
+        return element;
+    }
+    return device.prepro(element);
+}
+
+static bool screen_has_icon(unsigned char icon_id) {
+    unsigned int i;
+    for (i = 0; i < device.elements_len; i++) {
+        const bagl_element_t *element = shown_element(&device.elements[i]);
+        if (element != NULL && element->component.type == BAGL_ICON && element->component.icon_id == icon_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void report_screen(void) {
+    const char *lines[2] = {"", ""};
+    unsigned int i, line = 0;
+
+    if (device.options.on_screen == NULL) {
+        return;
+    }
+    for (i = 0; i < device.elements_len && line < 2; i++) {
+        const bagl_element_t *element = shown_element(&device.elements[i]);
+        if (element != NULL && element->component.type == BAGL_LABELINE && element->text != NULL) {
+            lines[line++] = element->text;
+        }
+    }
+    device.options.on_screen(device.options.screen_context, lines[0], lines[1]);
+}
+
+void ux_stub_display(const bagl_element_t *elements, unsigned int count, button_push_callback_t button, bagl_element_prepro_t prepro) {
+    device.elements = elements;
+    device.elements_len = count;
+    device.button = button;
+    device.prepro = prepro;
+    report_screen();
+}
+
+void ux_stub_redisplay(void) {
+    report_screen();
+}
+
+// the main menu doesn't take part in any command
+void ux_stub_menu_display(unsigned int index, const ux_menu_entry_t *menu, void *prepro) {
+    device.elements = NULL;
+    device.elements_len = 0;
+    device.button = NULL;
+    device.prepro = NULL;
+}
+
+// a press and release of the buttons, each one sent to whichever screen is shown
+static void press(unsigned int buttons) {
+    if (device.button != NULL) {
+        device.button(buttons, 0);
+    }
+    if (device.button != NULL) {
+        device.button(BUTTON_EVT_RELEASED | buttons, 0);
+    }
+}
+
+/*
+ * The virtual user: goes to the next page while there's one, then approves (or
+ * rejects) the request or, on screens without a choice, clicks both buttons to
+ * move on. Returns false if the review is stuck.
+ */
+static bool review_screens(void) {
+    unsigned int presses;
+
+    for (presses = 0; device.response_owed; presses++) {
+        if (device.button == NULL || presses == MAX_BUTTON_PRESSES) {
+            return false;
+        }
+        if (screen_has_icon(BAGL_GLYPH_ICON_RIGHT)) {
+            press(BUTTON_RIGHT);
+        } else if (device.options.user == HATHOR_USER_APPROVE && screen_has_icon(BAGL_GLYPH_ICON_CHECK)) {
+            press(BUTTON_RIGHT);
+        } else if (device.options.user == HATHOR_USER_REJECT && screen_has_icon(BAGL_GLYPH_ICON_CROSS)) {
+            press(BUTTON_LEFT);
+        } else {
+            press(BUTTON_LEFT | BUTTON_RIGHT);
+        }
+    }
+    return true;
+}
+
+static void send_response(unsigned short tx_len) {
+    pthread_mutex_lock(&device.lock);
+    memcpy(device.response, G_io_apdu_buffer, tx_len);
+    device.response_len = tx_len;
+    device.has_response = true;
+    device.response_owed = false;
+    pthread_cond_broadcast(&device.changed);
+    pthread_mutex_unlock(&device.lock);
+}
+
+// waits for the client's next command. Returns 0 when the device is closed
+static unsigned short receive_command(void) {
+    unsigned short rx = 0;
+
+    pthread_mutex_lock(&device.lock);
+    while (!device.has_command && !device.closed) {
+        pthread_cond_wait(&device.changed, &device.lock);
+    }
+    if (!device.closed) {
+        memcpy(G_io_apdu_buffer, device.command, device.command_len);
+        rx = device.command_len;
+        device.has_command = false;
+        device.response_owed = true;
+    }
+    pthread_mutex_unlock(&device.lock);
+    return rx;
+}
+
+unsigned short io_exchange(unsigned char channel_and_flags, unsigned short tx_len) {
+    if (tx_len > 0 && !(channel_and_flags & IO_ASYNCH_REPLY)) {
+        send_response(tx_len);
+    }
+    if (channel_and_flags & IO_RETURN_AFTER_TX) {
+        return 0;
+    }
+    if (!review_screens()) {
+        // the client would wait forever
+        return 0;
+    }
+    return receive_command();
+}
+
+static void* device_thread(void *arg) {
+    hathor_host_main();
+
+    pthread_mutex_lock(&device.lock);
+    device.closed = true;
+    pthread_cond_broadcast(&device.changed);
+    pthread_mutex_unlock(&device.lock);
+    return NULL;
+}
+
+static int device_exchange(void *context, const uint8_t *apdu, size_t apdu_len, uint8_t *response, size_t *response_len) {
+    int result = -1;
+
+    if (apdu_len > IO_APDU_BUFFER_SIZE) {
+        return -1;
+    }
+    pthread_mutex_lock(&device.lock);
+    if (!device.closed) {
+        memcpy(device.command, apdu, apdu_len);
+        device.command_len = apdu_len;
+        device.has_command = true;
+        pthread_cond_broadcast(&device.changed);
+        while (!device.has_response && !device.closed) {
+            pthread_cond_wait(&device.changed, &device.lock);
+        }
+        if (device.has_response) {
+            memcpy(response, device.response, device.response_len);
+            *response_len = device.response_len;
+            device.has_response = false;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&device.lock);
+    return result;
+}
+
+int hathor_device_start(const hathor_device_options_t *options) {
+    if (device.running) {
+        return -1;
+    }
+    memset(&device.options, 0, sizeof(device.options));
+    if (options != NULL) {
+        device.options = *options;
+    }
+    device.closed = false;
+    device.has_command = false;
+    device.has_response = false;
+    device.response_owed = false;
+    if (pthread_create(&device.thread, NULL, device_thread, NULL) != 0) {
+        return -1;
+    }
+    device.running = true;
+    return 0;
+}
+
+void hathor_device_stop(void) {
+    if (!device.running) {
+        return;
+    }
+    pthread_mutex_lock(&device.lock);
+    device.closed = true;
+    pthread_cond_broadcast(&device.changed);
+    pthread_mutex_unlock(&device.lock);
+    pthread_join(device.thread, NULL);
+    device.running = false;
+}
+
+hathor_transport_t hathor_device_transport(void) {
+    hathor_transport_t transport = {NULL, device_exchange};
+    return transport;
+}
+
+// the SDK's seproxyhal channel isn't used on the host
+void io_seproxyhal_display_default(bagl_element_t *element) {
+}
+
+int io_seproxyhal_spi_is_status_sent(void) {
+    return 1;
+}
+
+void io_seproxyhal_general_status(void) {
+}
+
+void io_seproxyhal_spi_send(const unsigned char *buffer, unsigned short len) {
+}
+
+unsigned short io_seproxyhal_spi_recv(unsigned char *buffer, unsigned short len, unsigned int flags) {
+    return 0;
+}
+
+void io_seproxyhal_init(void) {
+}
+
+void USB_power(unsigned char enabled) {
+}
@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Devices on child processes. The child runs the app with hathor_device_start and
+ * relays each command it reads from a SOCK_SEQPACKET socket, which keeps the APDUs'
+ * boundaries, to the app's transport. Closing the socket stops the device.
+ *
+ * Spawning and killing the devices isn't thread-safe, as done by the thread that
+ * owns them.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "hathor_device.h"
+
+// commands are at most 5 + 255 bytes, and a larger read shows a broken peer
+#define MAX_MESSAGE 512
+
+struct hathor_device_process {
+    pid_t pid;
+    int socket;
+    hathor_device_process_t *next;
+};
+
+// the devices still running, whose sockets a new child has to close so they see
+// their parent closing them
+static hathor_device_process_t *spawned;
+
+static void serve(int socket, const hathor_device_options_t *options) {
+    uint8_t command[MAX_MESSAGE];
+    uint8_t response[HATHOR_MAX_RESPONSE];
+    size_t response_len;
+    hathor_transport_t transport;
+    ssize_t len;
+
+    if (hathor_device_start(options) != 0) {
+        return;
+    }
+    transport = hathor_device_transport();
+    for (;;) {
+        len = recv(socket, command, sizeof(command), 0);
+        if (len <= 0) {
+            break;
+        }
+        if (transport.exchange(transport.context, command, len, response, &response_len) != 0) {
+            // the app exited, and the parent sees the socket closed
+            break;
+        }
+        if (send(socket, response, response_len, MSG_NOSIGNAL) != (ssize_t)response_len) {
+            break;
+        }
+    }
+    hathor_device_stop();
+}
+
+hathor_device_process_t* hathor_device_spawn(const hathor_device_options_t *options) {
+    hathor_device_process_t *process;
+    int sockets[2];
+
+    process = malloc(sizeof(hathor_device_process_t));
+    if (process == NULL) {
+        return NULL;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0) {
+        free(process);
+        return NULL;
+    }
+    process->pid = fork();
+    if (process->pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        free(process);
+        return NULL;
+    }
+    if (process->pid == 0) {
+        close(sockets[0]);
+        for (; spawned != NULL; spawned = spawned->next) {
+            close(spawned->socket);
+        }
+        serve(sockets[1], options);
+        _exit(0);
+    }
+    close(sockets[1]);
+    process->socket = sockets[0];
+    process->next = spawned;
+    spawned = process;
+    return process;
+}
+
+static int process_exchange(void *context, const uint8_t *apdu, size_t apdu_len, uint8_t *response, size_t *response_len) {
+    hathor_device_process_t *process = context;
+    ssize_t len;
+
+    if (send(process->socket, apdu, apdu_len, MSG_NOSIGNAL) != (ssize_t)apdu_len) {
+        return -1;
+    }
+    len = recv(process->socket, response, HATHOR_MAX_RESPONSE, 0);
+    if (len <= 0) {
+        return -1;
+    }
+    *response_len = len;
+    return 0;
+}
+
+hathor_transport_t hathor_device_process_transport(hathor_device_process_t *process) {
+    hathor_transport_t transport = {process, process_exchange};
+    return transport;
+}
+
+void hathor_device_kill(hathor_device_process_t *process) {
+    hathor_device_process_t **link;
+
+    for (link = &spawned; *link != NULL; link = &(*link)->next) {
+        if (*link == process) {
+            *link = process->next;
+            break;
+        }
+    }
+    close(process->socket);
+    waitpid(process->pid, NULL, 0);
+    free(process);
+}
@@ -0,0 +1,481 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Benchmarks the sign tx decoder on synthetic txs. For every combination of the
+ * parameters below, a tx is generated and decoded like receive_data and
+ * decode_next_element do on the device: the change output info and the header are
+ * parsed from the first packet, then each packet is given to the decoder, which
+ * stops on every element shown to the user, and an element split between packets
+ * is carried to the next one.
+ *
+ * Each case is printed as a JSON object on its own line, eg:
+ *   {"kind":"regular","tokens":1,...,"result":"finished","ns_per_byte":2.1,...}
+ *
+ * with carried[n] being how many packets left n bytes of a split element on the
+ * decoder's buffer. Options (lists are comma-separated):
+ *   -k  tx kinds: regular, creation                   (regular)
+ *   -t  token uids of regular txs                     (0,4)
+ *   -i  inputs                                        (1,32)
+ *   -o  outputs                                       (1,255)
+ *   -s  output scripts: p2pkh, p2sh                   (p2pkh,p2sh)
+ *   -v  size of the output values: 4, 8               (4,8)
+ *   -c  packet sizes, up to 255                       (64,255)
+ *   -x  invalid txs, with the error on their middle element: none, version,
+ *       input_data, script_len, script, authority, trailing, truncated     (all)
+ *   -m  minimum time of each case, in ms              (10)
+ *   -H  also hash the packets, as receive_data does
+ *   -g  print the generated txs in hex instead, as hathor-validate reads them
+ *
+ * Exits with 1 if a tx isn't decoded as expected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <os.h>
+#include <cx.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+
+#define MAX_LIST        16
+#define MAX_PACKET_LEN  255
+// largest generated tx: 255 token uids, inputs and outputs, and the token info
+#define MAX_TX_LEN      (1 + 2 + 3 + 255 * (32 + 35 + 8 + 3 + 26) + 2 + 2 * TOKEN_NAME_MAX_LEN)
+
+typedef enum {
+    INVALID_NONE,
+    INVALID_VERSION,        // unsupported tx version
+    INVALID_INPUT_DATA,     // an input with data
+    INVALID_SCRIPT_LEN,     // an output script that's neither P2PKH nor P2SH
+    INVALID_SCRIPT,         // a P2PKH or P2SH script with a wrong opcode
+    INVALID_AUTHORITY,      // an authority output without authorities
+    INVALID_TRAILING,       // a byte after the last element
+    INVALID_TRUNCATED,      // the data ends in the middle of the tx
+} invalid_e;
+
+static const char *invalid_names[] = {"none", "version", "input_data", "script_len", "script", "authority",
+                                      "trailing", "truncated"};
+static const char *kind_names[] = {"regular", "creation"};
+static const char *script_names[] = {"", "p2pkh", "p2sh"};
+
+typedef struct {
+    unsigned long values[MAX_LIST];
+    size_t len;
+} list_t;
+
+typedef struct {
+    uint16_t version;
+    unsigned long tokens;
+    unsigned long inputs;
+    unsigned long outputs;
+    uint8_t script_type;
+    unsigned long value_len;
+    unsigned long packet_len;
+    invalid_e invalid;
+} bench_case_t;
+
+// how the decoder ended, like the device's reply
+typedef enum {
+    RESULT_FINISHED,
+    RESULT_REJECTED,
+    RESULT_TRUNCATED,
+} result_e;
+
+static const char *result_names[] = {"finished", "rejected", "truncated"};
+
+typedef struct {
+    tx_parse_context_t tx;
+    cx_sha256_t sha256;
+    bool hash;
+    // stats of a decoding
+    unsigned long elements;
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long carried[MAX_TX_ELEMENT_LEN + 1];
+} decoding_t;
+
+static void write_u16(uint8_t *out, uint16_t value) {
+    out[0] = value >> 8;
+    out[1] = value;
+}
+
+static size_t write_output(const bench_case_t *c, unsigned long index, uint8_t *out) {
+    bool invalid = (index == c->outputs / 2);
+    uint64_t value = 100 + index;
+    size_t len = 0;
+    int i;
+
+    if (invalid && c->invalid == INVALID_AUTHORITY) {
+        // the value would be the authorities
+        os_memset(out, 0, 4);
+        len = 4;
+    } else if (c->value_len == 8) {
+        // 8-byte values are negative
+        value = -value;
+        for (i = 7; i >= 0; i--) {
+            out[len++] = value >> (8 * i);
+        }
+    } else {
+        for (i = 3; i >= 0; i--) {
+            out[len++] = value >> (8 * i);
+        }
+    }
+    out[len++] = index % (c->tokens + 1) | (invalid && c->invalid == INVALID_AUTHORITY ? TOKEN_AUTHORITY_MASK : 0);
+
+    if (invalid && c->invalid == INVALID_SCRIPT_LEN) {
+        write_u16(out + len, P2PKH_SCRIPT_LEN + 1);
+        len += 2;
+        os_memset(out + len, 0, P2PKH_SCRIPT_LEN + 1);
+        return len + P2PKH_SCRIPT_LEN + 1;
+    }
+    if (c->script_type == SCRIPT_P2PKH) {
+        uint8_t *script = out + len + 2;
+        write_u16(out + len, P2PKH_SCRIPT_LEN);
+        script[0] = OP_DUP;
+        script[1] = OP_HASH160;
+        script[2] = 20;
+        os_memset(script + 3, index, 20);
+        script[23] = OP_EQUALVERIFY;
+        script[24] = OP_CHECKSIG;
+        len += 2 + P2PKH_SCRIPT_LEN;
+    } else {
+        uint8_t *script = out + len + 2;
+        write_u16(out + len, P2SH_SCRIPT_LEN);
+        script[0] = OP_HASH160;
+        script[1] = 20;
+        os_memset(script + 2, index, 20);
+        script[22] = OP_EQUAL;
+        len += 2 + P2SH_SCRIPT_LEN;
+    }
+    if (invalid && c->invalid == INVALID_SCRIPT) {
+        out[len - 1] = 0;
+    }
+    return len;
+}
+
+/*
+ * Writes the change output info (no change) and the sighash_all data of the case.
+ * Returns 0 if the case can't have its error, eg. invalid inputs on a tx without
+ * inputs.
+ */
+static size_t generate_tx(const bench_case_t *c, uint8_t *out) {
+    size_t len = 0;
+    unsigned long i;
+
+    if ((c->invalid == INVALID_INPUT_DATA && c->inputs == 0) ||
+        ((c->invalid == INVALID_SCRIPT_LEN || c->invalid == INVALID_SCRIPT || c->invalid == INVALID_AUTHORITY)
+         && c->outputs == 0)) {
+        return 0;
+    }
+
+    out[len++] = 0;
+    write_u16(out + len, c->invalid == INVALID_VERSION ? 0xFF : c->version);
+    len += 2;
+    if (c->version == TX_VERSION_REGULAR) {
+        out[len++] = c->tokens;
+    }
+    out[len++] = c->inputs;
+    out[len++] = c->outputs;
+
+    for (i = 0; c->version == TX_VERSION_REGULAR && i < c->tokens; i++) {
+        os_memset(out + len, 0x10 + i, 32);
+        len += 32;
+    }
+    for (i = 0; i < c->inputs; i++) {
+        os_memset(out + len, 0x20 + i, 32);
+        out[len + 32] = i;
+        write_u16(out + len + 33, (c->invalid == INVALID_INPUT_DATA && i == c->inputs / 2) ? 1 : 0);
+        len += 35;
+    }
+    for (i = 0; i < c->outputs; i++) {
+        len += write_output(c, i, out + len);
+    }
+    if (c->version == TX_VERSION_TOKEN_CREATION) {
+        out[len++] = TOKEN_INFO_VERSION;
+        out[len++] = TOKEN_NAME_MAX_LEN;
+        os_memset(out + len, 'N', TOKEN_NAME_MAX_LEN);
+        len += TOKEN_NAME_MAX_LEN;
+        out[len++] = TOKEN_SYMBOL_MAX_LEN;
+        os_memset(out + len, 'S', TOKEN_SYMBOL_MAX_LEN);
+        len += TOKEN_SYMBOL_MAX_LEN;
+    }
+
+    if (c->invalid == INVALID_TRAILING) {
+        out[len++] = 0;
+    } else if (c->invalid == INVALID_TRUNCATED) {
+        len /= 2;
+    }
+    return len;
+}
+
+// decodes an element, stopping on the ones the device shows, like _decode_next_element
+static void decode_element(decoding_t *d) {
+    tx_decode_element(&d->tx);
+    d->elements++;
+    switch (d->tx.elem_type) {
+        case ELEM_OUTPUT:
+            if (!(d->tx.has_change_output && d->tx.change_output_index == d->tx.decoded_output.index)) {
+                THROW(TX_STATE_READY);
+            }
+            break;
+        case ELEM_TOKEN_INFO:
+            THROW(TX_STATE_READY);
+        default:
+            break;
+    }
+}
+
+// decode_next_element: decodes until an element is shown or the decoder stops
+static unsigned short decode_next_element(decoding_t *d) {
+    volatile unsigned short result = 0;
+    BEGIN_TRY {
+        TRY {
+            for (;;) {
+                decode_element(d);
+            }
+        }
+        CATCH_OTHER(e) {
+            result = e;
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+    return result;
+}
+
+static unsigned short parse_first_packet(decoding_t *d, uint8_t *packet, uint16_t len, uint8_t *offset) {
+    volatile unsigned short result = 0;
+    BEGIN_TRY {
+        TRY {
+            *offset = tx_parse_change_info(&d->tx, packet, len);
+            *offset += tx_parse_header(&d->tx, packet + *offset, len - *offset);
+        }
+        CATCH_OTHER(e) {
+            result = e;
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+    return result;
+}
+
+// runs the data through the decoder, packet_len bytes at a time, as receive_data does
+static result_e decode_tx(decoding_t *d, uint8_t *data, size_t len, size_t packet_len) {
+    size_t offset = 0;
+    uint16_t packet;
+    uint8_t skip;
+    unsigned short state;
+
+    tx_parse_init(&d->tx);
+    if (d->hash) {
+        cx_sha256_init(&d->sha256);
+    }
+    while (offset < len) {
+        packet = (len - offset > packet_len ? packet_len : len - offset);
+        d->packets++;
+        d->bytes += packet;
+        skip = 0;
+        if (offset == 0) {
+            if (parse_first_packet(d, data, packet, &skip) != 0) {
+                // a truncated header is also rejected, as the device needs it on the first packet
+                return RESULT_REJECTED;
+            }
+        }
+        if (d->hash) {
+            cx_hash(&d->sha256.header, 0, data + offset + (offset == 0 ? 1 : 0), packet - (offset == 0 ? 1 : 0), NULL, 0);
+        }
+        tx_set_data(&d->tx, data + offset + skip, packet - skip);
+
+        // the device resumes decoding after the user goes through each shown element
+        do {
+            state = decode_next_element(d);
+        } while (state == TX_STATE_READY);
+
+        switch (state) {
+            case TX_STATE_FINISHED:
+                return (offset + packet == len ? RESULT_FINISHED : RESULT_REJECTED);
+            case TX_STATE_PARTIAL:
+                if (!tx_carry_partial_element(&d->tx)) {
+                    return RESULT_REJECTED;
+                }
+                d->carried[d->tx.buffer_len]++;
+                break;
+            default:
+                return RESULT_REJECTED;
+        }
+        offset += packet;
+    }
+    return RESULT_TRUNCATED;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool run_case(const bench_case_t *c, bool hash, double min_seconds, bool generate) {
+    static uint8_t data[MAX_TX_LEN];
+    static decoding_t d, timed;
+    result_e expected, result;
+    unsigned long iterations = 0;
+    double start, seconds;
+    size_t len, i;
+
+    len = generate_tx(c, data);
+    if (len == 0) {
+        return true;
+    }
+    if (generate) {
+        for (i = 0; i < len; i++) {
+            printf("%02x", data[i]);
+        }
+        printf("\n");
+        return true;
+    }
+
+    os_memset(&d, 0, sizeof(d));
+    d.hash = hash;
+    result = decode_tx(&d, data, len, c->packet_len);
+
+    // the stats are from the first run; the others are only timed
+    start = now();
+    timed.hash = hash;
+    do {
+        decode_tx(&timed, data, len, c->packet_len);
+        iterations++;
+        seconds = now() - start;
+    } while (seconds < min_seconds);
+
+    expected = (c->invalid == INVALID_NONE ? RESULT_FINISHED :
+                c->invalid == INVALID_TRUNCATED ? RESULT_TRUNCATED : RESULT_REJECTED);
+
+    printf("{\"kind\":\"%s\",\"tokens\":%lu,\"inputs\":%lu,\"outputs\":%lu,\"script\":\"%s\",\"value_len\":%lu,"
+           "\"packet_len\":%lu,\"invalid\":\"%s\",\"hash\":%s,\"len\":%zu,\"result\":\"%s\",\"bytes\":%lu,"
+           "\"elements\":%lu,\"packets\":%lu,\"iterations\":%lu,\"ns_per_tx\":%.1f,\"ns_per_byte\":%.3f,"
+           "\"ns_per_element\":%.2f,\"carried\":[",
+           kind_names[c->version - TX_VERSION_REGULAR], c->version == TX_VERSION_REGULAR ? c->tokens : 0,
+           c->inputs, c->outputs, script_names[c->script_type], c->value_len, c->packet_len,
+           invalid_names[c->invalid], hash ? "true" : "false", len, result_names[result], d.bytes, d.elements,
+           d.packets, iterations, seconds * 1e9 / iterations, seconds * 1e9 / iterations / d.bytes,
+           d.elements > 0 ? seconds * 1e9 / iterations / d.elements : 0);
+    for (i = 0; i <= MAX_TX_ELEMENT_LEN; i++) {
+        printf("%s%lu", i > 0 ? "," : "", d.carried[i]);
+    }
+    printf("]}\n");
+
+    if (result != expected) {
+        fprintf(stderr, "%s tx %s, expected %s\n", invalid_names[c->invalid], result_names[result],
+                result_names[expected]);
+        return false;
+    }
+    return true;
+}
+
+// parses a list of numbers or of names, whose values are their indexes
+static bool parse_list(char *arg, list_t *list, const char **names, size_t names_len, unsigned long max) {
+    char *item, *end;
+    size_t i;
+
+    list->len = 0;
+    for (item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+        if (list->len == MAX_LIST) {
+            return false;
+        }
+        if (names != NULL) {
+            for (i = 0; i < names_len && strcmp(item, names[i]) != 0; i++);
+            if (i == names_len) {
+                return false;
+            }
+            list->values[list->len++] = i;
+        } else {
+            list->values[list->len] = strtoul(item, &end, 10);
+            if (*end != '\0' || list->values[list->len] > max) {
+                return false;
+            }
+            list->len++;
+        }
+    }
+    return list->len > 0;
+}
+
+int main(int argc, char **argv) {
+    list_t kinds = {{0}, 1}, tokens = {{0, 4}, 2}, inputs = {{1, 32}, 2}, outputs = {{1, 255}, 2};
+    list_t scripts = {{SCRIPT_P2PKH, SCRIPT_P2SH}, 2}, values = {{4, 8}, 2}, packets = {{64, 255}, 2};
+    list_t invalids = {{0, 1, 2, 3, 4, 5, 6, 7}, 8};
+    size_t k, t, i, o, s, v, p, x;
+    double min_ms = 10;
+    bool hash = false, generate = false, ok = true;
+    bench_case_t c;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:t:i:o:s:v:c:x:m:Hg")) != -1) {
+        bool valid = true;
+        switch (opt) {
+            case 'k': valid = parse_list(optarg, &kinds, kind_names, 2, 0); break;
+            case 't': valid = parse_list(optarg, &tokens, NULL, 0, 255); break;
+            case 'i': valid = parse_list(optarg, &inputs, NULL, 0, 255); break;
+            case 'o': valid = parse_list(optarg, &outputs, NULL, 0, 255); break;
+            case 's': valid = parse_list(optarg, &scripts, script_names, 3, 0); break;
+            case 'v': valid = parse_list(optarg, &values, NULL, 0, 8); break;
+            case 'c': valid = parse_list(optarg, &packets, NULL, 0, MAX_PACKET_LEN); break;
+            case 'x': valid = parse_list(optarg, &invalids, invalid_names, 8, 0); break;
+            case 'm': min_ms = atof(optarg); break;
+            case 'H': hash = true; break;
+            case 'g': generate = true; break;
+            default: valid = false; break;
+        }
+        for (k = 0; valid && opt == 'v' && k < values.len; k++) {
+            valid = (values.values[k] == 4 || values.values[k] == 8);
+        }
+        for (k = 0; valid && opt == 'c' && k < packets.len; k++) {
+            // the first packet has the change output info and the whole header
+            valid = (packets.values[k] >= 6);
+        }
+        for (k = 0; valid && opt == 's' && k < scripts.len; k++) {
+            valid = (scripts.values[k] != 0);
+        }
+        if (!valid) {
+            fprintf(stderr, "usage: %s [-k kinds] [-t tokens] [-i inputs] [-o outputs] [-s scripts] [-v value_lens]"
+                    " [-c packet_lens] [-x invalids] [-m ms] [-H] [-g]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (k = 0; k < kinds.len; k++)
+    for (t = 0; t < tokens.len; t++)
+    for (i = 0; i < inputs.len; i++)
+    for (o = 0; o < outputs.len; o++)
+    for (s = 0; s < scripts.len; s++)
+    for (v = 0; v < values.len; v++)
+    for (p = 0; p < packets.len; p++)
+    for (x = 0; x < invalids.len; x++) {
+        c.version = TX_VERSION_REGULAR + kinds.values[k];
+        // token creation txs only have the created token
+        if (c.version == TX_VERSION_TOKEN_CREATION && t > 0) {
+            continue;
+        }
+        c.tokens = (c.version == TX_VERSION_REGULAR ? tokens.values[t] : 1);
+        c.inputs = inputs.values[i];
+        c.outputs = outputs.values[o];
+        c.script_type = scripts.values[s];
+        c.value_len = values.values[v];
+        c.packet_len = packets.values[p];
+        c.invalid = invalids.values[x];
+        if (!run_case(&c, hash, min_ms / 1000, generate)) {
+            ok = false;
+        }
+        fflush(stdout);
+    }
+    return (ok ? 0 : 1);
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The whole app (src/, with main.c's hathor_main) running on a thread of the host
+ * process, reached through a hathor_transport_t. A virtual user goes through each
+ * screen and approves or rejects the requests, like a person holding the device.
+ *
+ * The app keeps its state in globals, like on the device, so there's a single
+ * device per process. More devices are run on child processes (hathor_device_spawn).
+ *
+ * Its keys come from the host's software BIP32 (sdk/cx_ecc.c), with the seed set by
+ * os_perso_set_seed, so it signs like a device with that seed.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "hathor_client.h"
+
+typedef enum {
+    HATHOR_USER_APPROVE,    // goes through every page and approves every request
+    HATHOR_USER_REJECT,     // goes through every page and rejects every request
+} hathor_user_e;
+
+/**
+ * Called for every screen shown by the app, while handling a command.
+ *
+ * @param  [in] context
+ *   The screen_context given on the options.
+ *
+ * @param  [in] line1
+ *   The first line of text.
+ *
+ * @param  [in] line2
+ *   The second line of text. May be empty.
+ *
+ */
+typedef void (*hathor_screen_fn)(void *context, const char *line1, const char *line2);
+
+typedef struct {
+    hathor_user_e user;
+    // may be NULL
+    hathor_screen_fn on_screen;
+    void *screen_context;
+} hathor_device_options_t;
+
+/**
+ * Starts the app on a new thread.
+ *
+ * @param  [in] options
+ *   The virtual user and the screen callback. May be NULL to approve everything.
+ *
+ * @return 0, or -1 if the device is already running or the thread can't be started
+ */
+int hathor_device_start(const hathor_device_options_t *options);
+
+/**
+ * Closes the transport and waits for the app to exit.
+ *
+ */
+void hathor_device_stop(void);
+
+/**
+ * Returns the transport to the running device. Exchanges fail after the device
+ * is stopped.
+ *
+ */
+hathor_transport_t hathor_device_transport(void);
+
+/*
+ * A device running on its own child process, for several devices at once: as the
+ * app's state is per process, each one is a fork of the calling process running
+ * hathor_device_start. Its commands go through a socket, and the screen callback
+ * is called on the child.
+ */
+typedef struct hathor_device_process hathor_device_process_t;
+
+/**
+ * Starts a device on a new child process. The child is forked from the calling
+ * thread, so it's better to spawn the devices before starting other threads.
+ *
+ * @param  [in] options
+ *   The virtual user and the screen callback. May be NULL to approve everything.
+ *
+ * @return the device, or NULL if it can't be started
+ */
+hathor_device_process_t* hathor_device_spawn(const hathor_device_options_t *options);
+
+/**
+ * Returns the transport to a device process. It may only be used by one thread at a
+ * time.
+ *
+ * @param  [in] process
+ *   The device.
+ *
+ */
+hathor_transport_t hathor_device_process_transport(hathor_device_process_t *process);
+
+/**
+ * Closes the device's transport and waits for its process to exit.
+ *
+ * @param  [in] process
+ *   The device. It's freed.
+ *
+ */
+void hathor_device_kill(hathor_device_process_t *process);
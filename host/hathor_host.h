@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host library built from the app's own sources (see Makefile). It runs the sign tx
+ * decoder on unsigned txs before they're sent to the device, so a wallet can reject
+ * invalid txs early and know which screens the user will review.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// as on the device: MAX_DISPLAY_PAGES pages of at most MAX_SCREEN_LENGTH characters
+#define HATHOR_MAX_PAGES        9
+#define HATHOR_SCREEN_LENGTH    12
+
+// outcome of a validation
+typedef enum {
+    HATHOR_TX_VALID,        // the device accepts the tx and shows the screens on the report
+    HATHOR_TX_INVALID,      // the device rejects the tx, with sw
+    HATHOR_TX_TRUNCATED,    // the data ends in the middle of the tx
+} hathor_tx_status_e;
+
+// a screen the device shows while reviewing the tx, eg:
+//   Output 1/3
+//   HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo HTR 12.00
+// text is split in pages exactly like on the device
+typedef struct {
+    char title[18];
+    char text[80];
+    uint8_t pages_len;
+    char pages[HATHOR_MAX_PAGES][HATHOR_SCREEN_LENGTH + 1];
+} hathor_screen_t;
+
+typedef struct {
+    hathor_tx_status_e status;
+    // status word the device replies with when it rejects the tx
+    uint16_t sw;
+    // offset of the element being decoded when the tx was rejected or truncated
+    size_t error_offset;
+    uint16_t version;
+    bool has_change_output;
+    uint8_t change_output_index;
+    // data signed by the device: sha256d of the sighash_all data. Only for valid txs
+    uint8_t sighash[32];
+    // screens shown, in order. The last one is the confirmation
+    hathor_screen_t *screens;
+    size_t screens_len;
+} hathor_tx_report_t;
+
+// a tx to be validated: the change output info followed by the sighash_all data,
+// as sent on the p1 = 0 packets of the sign tx command
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} hathor_tx_input_t;
+
+/**
+ * Validates a tx with the same decoder as the sign tx command.
+ *
+ * The change output is not shown, as on the device, but whether it's sent to the
+ * wallet's key can only be checked with the wallet's keys, so it's not verified here.
+ *
+ * @param  [in] data
+ *   Change output info and sighash_all data.
+ *
+ * @param  [in] len
+ *   Size of data.
+ *
+ * @param [out] report
+ *   The result. Must be freed with hathor_report_free.
+ *
+ * @return the report's status
+ */
+hathor_tx_status_e hathor_validate_tx(const uint8_t *data, size_t len, hathor_tx_report_t *report);
+
+/**
+ * Validates several txs on a pool of threads, each one with its own decoder.
+ *
+ * @param  [in] inputs
+ *   The txs.
+ *
+ * @param [out] reports
+ *   One report for each tx, in the same order. Each one must be freed with
+ *   hathor_report_free.
+ *
+ * @param  [in] count
+ *   Number of txs.
+ *
+ * @param  [in] threads
+ *   Number of threads. 0 uses one for each online CPU.
+ *
+ * @return the number of valid txs
+ */
+size_t hathor_validate_txs(const hathor_tx_input_t *inputs, hathor_tx_report_t *reports, size_t count, unsigned int threads);
+
+/**
+ * Frees the screens of a report.
+ *
+ * @param [in/out] report
+ *   The report.
+ *
+ */
+void hathor_report_free(hathor_tx_report_t *report);
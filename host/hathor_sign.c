@@ -0,0 +1,251 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Signs txs with the reference client (client/) on the app running in this process
+ * (see hathor_device.h). Each line of stdin is a tx:
+ *   <sighash_all in hex> <key_index>[,<key_index>...] [<change_output>:<change_key_index>]
+ *
+ * and the signatures are printed in hex, one line per tx. Options:
+ *   -b  sign all txs as a single batch
+ *   -d  sign the txs on this many devices at once, each one on its own process, and
+ *       print each device's stats
+ *   -c  compact signatures
+ *   -k  append the public key to each signature
+ *   -R  the user rejects the txs
+ *   -v  print the screens shown on the device
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include "hathor_client.h"
+#include "hathor_orchestrator.h"
+#include "hathor_device.h"
+
+#define MAX_TXS     256
+#define MAX_KEYS    64
+
+typedef struct {
+    hathor_tx_t tx;
+    uint8_t *data;
+    hathor_path_t keys[MAX_KEYS];
+    hathor_signature_t signatures[MAX_KEYS];
+} sign_job_t;
+
+static void print_screen(void *context, const char *line1, const char *line2) {
+    fprintf(stderr, "[%s | %s]\n", line1, line2);
+}
+
+// parses a tx into a job, whose data may be allocated even if it fails
+static int parse_job(char *line, sign_job_t *job) {
+    char *hex = strtok(line, " \t\n");
+    char *keys = strtok(NULL, " \t\n");
+    char *change = strtok(NULL, " \t\n");
+    size_t len, i;
+    char *key;
+
+    memset(job, 0, sizeof(sign_job_t));
+    if (hex == NULL || keys == NULL || strlen(hex) % 2 != 0) {
+        return -1;
+    }
+    len = strlen(hex) / 2;
+    job->data = malloc(len > 0 ? len : 1);
+    for (i = 0; i < len; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char)hex[2 * i]) || sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            return -1;
+        }
+        job->data[i] = byte;
+    }
+    job->tx.sighash_all = job->data;
+    job->tx.sighash_all_len = len;
+
+    for (key = strtok(keys, ","); key != NULL; key = strtok(NULL, ",")) {
+        if (job->tx.keys_len == MAX_KEYS) {
+            return -1;
+        }
+        hathor_key_index_path(&job->keys[job->tx.keys_len++], strtoul(key, NULL, 10));
+    }
+    job->tx.keys = job->keys;
+    job->tx.signatures = job->signatures;
+
+    if (change != NULL) {
+        unsigned int output;
+        unsigned long index;
+        if (sscanf(change, "%u:%lu", &output, &index) != 2) {
+            return -1;
+        }
+        job->tx.has_change = true;
+        job->tx.change_output_index = output;
+        hathor_key_index_path(&job->tx.change_path, index);
+    }
+    return 0;
+}
+
+// parses a tx into a job. Nothing is left allocated if it fails
+static int parse_line(char *line, sign_job_t *job) {
+    if (parse_job(line, job) != 0) {
+        free(job->data);
+        job->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void free_jobs(sign_job_t *jobs, size_t count) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        free(jobs[i].data);
+    }
+}
+
+static void print_signatures(const sign_job_t *job) {
+    size_t i, j;
+    for (i = 0; i < job->tx.keys_len; i++) {
+        printf("%s", i > 0 ? " " : "");
+        for (j = 0; j < job->signatures[i].len; j++) {
+            printf("%02x", job->signatures[i].data[j]);
+        }
+    }
+    printf("\n");
+}
+
+// signs the txs with the orchestrator, on devices children of this process
+static int sign_on_devices(sign_job_t *jobs, size_t count, uint8_t flags, size_t devices,
+                           const hathor_device_options_t *options) {
+    static hathor_job_t runs[MAX_TXS];
+    hathor_device_process_t *processes[HATHOR_MAX_DEVICES];
+    hathor_transport_t transports[HATHOR_MAX_DEVICES];
+    hathor_device_stats_t stats[HATHOR_MAX_DEVICES];
+    struct timespec start, end;
+    double seconds;
+    size_t i;
+    int failed;
+
+    for (i = 0; i < devices; i++) {
+        processes[i] = hathor_device_spawn(options);
+        if (processes[i] == NULL) {
+            fprintf(stderr, "can't start device %zu\n", i);
+            while (i-- > 0) {
+                hathor_device_kill(processes[i]);
+            }
+            return 2;
+        }
+        transports[i] = hathor_device_process_transport(processes[i]);
+    }
+    for (i = 0; i < count; i++) {
+        memset(&runs[i], 0, sizeof(hathor_job_t));
+        runs[i].type = HATHOR_JOB_SIGN_TX;
+        runs[i].tx = &jobs[i].tx;
+        runs[i].flags = flags;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    failed = hathor_run_jobs(transports, devices, runs, count, stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for (i = 0; i < count; i++) {
+        if (runs[i].result == HATHOR_OK) {
+            print_signatures(&jobs[i]);
+        } else {
+            printf("\n");
+            fprintf(stderr, "tx %zu: error %d, sw %04X\n", i + 1, runs[i].result, runs[i].sw);
+        }
+    }
+    for (i = 0; i < devices; i++) {
+        fprintf(stderr, "device %zu: %lu jobs, %lu stolen, %lu apdus, %.3fs busy%s\n", i, stats[i].jobs,
+                stats[i].stolen, stats[i].apdus, stats[i].busy_seconds, stats[i].failed ? ", failed" : "");
+        hathor_device_kill(processes[i]);
+    }
+    fprintf(stderr, "%zu txs in %.3fs, %.1f txs/s\n", count, seconds, seconds > 0 ? count / seconds : 0);
+    return (failed == 0 ? 0 : 1);
+}
+
+int main(int argc, char **argv) {
+    static sign_job_t jobs[MAX_TXS];
+    static hathor_tx_t txs[MAX_TXS];
+    hathor_device_options_t options = {HATHOR_USER_APPROVE, NULL, NULL};
+    hathor_client_t client;
+    char *line = NULL;
+    size_t line_size = 0, count = 0, i;
+    uint8_t flags = 0;
+    size_t devices = 0;
+    bool batch = false;
+    int opt, result = HATHOR_OK;
+
+    while ((opt = getopt(argc, argv, "bd:ckRv")) != -1) {
+        switch (opt) {
+            case 'b': batch = true; break;
+            case 'd': devices = strtoul(optarg, NULL, 10); break;
+            case 'c': flags |= HATHOR_SIGN_COMPACT; break;
+            case 'k': flags |= HATHOR_SIGN_PUBKEY; break;
+            case 'R': options.user = HATHOR_USER_REJECT; break;
+            case 'v': options.on_screen = print_screen; break;
+            default:
+                fprintf(stderr, "usage: %s [-b | -d devices] [-c] [-k] [-R] [-v] < txs\n", argv[0]);
+                return 2;
+        }
+    }
+    if (devices > HATHOR_MAX_DEVICES || (batch && devices > 0)) {
+        fprintf(stderr, "usage: %s [-b | -d devices] [-c] [-k] [-R] [-v] < txs\n", argv[0]);
+        return 2;
+    }
+
+    while (count < MAX_TXS && getline(&line, &line_size, stdin) != -1) {
+        if (parse_line(line, &jobs[count]) != 0) {
+            fprintf(stderr, "line %zu: expected <sighash_all> <key_index>[,...] [<output>:<key_index>]\n", count + 1);
+            free_jobs(jobs, count);
+            free(line);
+            return 2;
+        }
+        count++;
+    }
+    free(line);
+
+    if (devices > 0) {
+        result = sign_on_devices(jobs, count, flags, devices, &options);
+        free_jobs(jobs, count);
+        return result;
+    }
+
+    if (hathor_device_start(&options) != 0) {
+        fprintf(stderr, "can't start the device\n");
+        free_jobs(jobs, count);
+        return 2;
+    }
+    hathor_client_init(&client, hathor_device_transport());
+
+    if (batch && count > 0) {
+        for (i = 0; i < count; i++) {
+            txs[i] = jobs[i].tx;
+        }
+        result = hathor_sign_txs(&client, txs, count, flags);
+        for (i = 0; i < count && result == HATHOR_OK; i++) {
+            print_signatures(&jobs[i]);
+        }
+    } else {
+        for (i = 0; i < count && result == HATHOR_OK; i++) {
+            result = hathor_sign_tx(&client, &jobs[i].tx, flags);
+            if (result == HATHOR_OK) {
+                print_signatures(&jobs[i]);
+            }
+        }
+    }
+    if (result != HATHOR_OK) {
+        fprintf(stderr, "error %d, sw %04X\n", result, client.sw);
+    }
+    fprintf(stderr, "%lu apdus\n", client.apdus);
+
+    hathor_device_stop();
+    free_jobs(jobs, count);
+    return (result == HATHOR_OK ? 0 : 1);
+}
@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Validates txs with the device's decoder and prints the screens the user would
+ * review. Each line of stdin is a tx, in hex: the change output info followed by
+ * the sighash_all data, as sent to the sign tx command. Eg:
+ *   echo 00000101000000... | hathor-validate -j 4
+ *
+ * Exits with 1 if any tx is not valid.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "hathor_host.h"
+
+// decodes a hex string in place, returning its length in bytes or -1 if it's not hex
+static long decode_hex(char *line) {
+    size_t len = strlen(line);
+    size_t i;
+
+    while (len > 0 && isspace((unsigned char)line[len - 1])) {
+        len--;
+    }
+    if (len % 2 != 0) {
+        return -1;
+    }
+    for (i = 0; i < len; i += 2) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char)line[i]) || !isxdigit((unsigned char)line[i + 1])
+                || sscanf(line + i, "%2x", &byte) != 1) {
+            return -1;
+        }
+        line[i / 2] = byte;
+    }
+    return len / 2;
+}
+
+static void print_report(size_t n, const hathor_tx_report_t *report) {
+    size_t i;
+    uint8_t page;
+
+    switch (report->status) {
+        case HATHOR_TX_VALID:
+            printf("%zu: valid ", n);
+            for (i = 0; i < sizeof(report->sighash); i++) {
+                printf("%02x", report->sighash[i]);
+            }
+            printf("\n");
+            break;
+        case HATHOR_TX_INVALID:
+            printf("%zu: invalid sw=%04X offset=%zu\n", n, report->sw, report->error_offset);
+            return;
+        case HATHOR_TX_TRUNCATED:
+            printf("%zu: truncated offset=%zu\n", n, report->error_offset);
+            return;
+    }
+    for (i = 0; i < report->screens_len; i++) {
+        printf("    %s:", report->screens[i].title);
+        for (page = 0; page < report->screens[i].pages_len; page++) {
+            printf("%s %s", page > 0 ? " |" : "", report->screens[i].pages[page]);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    hathor_tx_input_t *inputs = NULL;
+    hathor_tx_report_t *reports;
+    size_t count = 0, capacity = 0, valid, i;
+    unsigned int threads = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt != 'j') {
+            fprintf(stderr, "usage: %s [-j threads] < txs\n", argv[0]);
+            return 2;
+        }
+        threads = atoi(optarg);
+    }
+
+    while (getline(&line, &line_size, stdin) != -1) {
+        long len = decode_hex(line);
+        if (len < 0) {
+            fprintf(stderr, "line %zu is not hex\n", count + 1);
+            return 2;
+        }
+        if (count == capacity) {
+            capacity = (capacity == 0 ? 64 : 2 * capacity);
+            inputs = realloc(inputs, capacity * sizeof(hathor_tx_input_t));
+        }
+        inputs[count].data = (const uint8_t*)line;
+        inputs[count].len = len;
+        count++;
+        // the input keeps the line's buffer
+        line = NULL;
+        line_size = 0;
+    }
+    free(line);
+
+    reports = calloc(count, sizeof(hathor_tx_report_t));
+    if ((count > 0 && (inputs == NULL || reports == NULL))) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    valid = hathor_validate_txs(inputs, reports, count, threads);
+
+    for (i = 0; i < count; i++) {
+        print_report(i + 1, &reports[i]);
+        hathor_report_free(&reports[i]);
+        free((void*)inputs[i].data);
+    }
+    free(inputs);
+    free(reports);
+    return (valid == count ? 0 : 1);
+}
@@ -0,0 +1,72 @@
+#*******************************************************************************
+#   Counts the instructions of each profiled kernel on the emulator's trace, run
+#   with one instruction per block and every block logged:
+#     Trace 0: 0x7f0c1c000100 [00000000/000080f4/00000020/ff200000] utoa
+#   Instructions between profile_begin and profile_end are attributed to the
+#   kernel_* function called and to the function they're on. The cost of a call,
+#   from kernel_empty, is taken from the other kernels. Prints a JSON line for
+#   each kernel, with the instructions per call.
+#*******************************************************************************
+
+/^Trace / {
+    symbol = $NF
+    if (symbol == "profile_begin") {
+        inside = 1
+        kernel = ""
+        count = 0
+        split("", call)
+        next
+    }
+    if (symbol == "profile_end") {
+        if (inside && kernel != "") {
+            if (!(kernel in calls)) {
+                order[kernels++] = kernel
+                min[kernel] = count
+                max[kernel] = count
+            }
+            calls[kernel]++
+            total[kernel] += count
+            if (count < min[kernel]) min[kernel] = count
+            if (count > max[kernel]) max[kernel] = count
+            for (f in call) {
+                functions[kernel, f] += call[f]
+                if (!((kernel, f) in seen)) {
+                    seen[kernel, f] = 1
+                    names[kernel] = names[kernel] " " f
+                }
+            }
+        }
+        inside = 0
+        next
+    }
+    if (!inside) {
+        next
+    }
+    if (kernel == "" && symbol ~ /^kernel_/) {
+        kernel = symbol
+    }
+    count++
+    call[symbol]++
+}
+
+END {
+    overhead = ("kernel_empty" in calls ? total["kernel_empty"] / calls["kernel_empty"] : 0)
+    if (kernels == 0) {
+        print "no profiled calls on the trace" > "/dev/stderr"
+        exit 1
+    }
+    for (i = 0; i < kernels; i++) {
+        k = order[i]
+        if (k == "kernel_empty") {
+            continue
+        }
+        name = substr(k, length("kernel_") + 1)
+        printf "{\"kernel\":\"%s\",\"calls\":%d,\"instructions\":%.1f,\"min\":%d,\"max\":%d,\"functions\":{", \
+               name, calls[k], total[k] / calls[k] - overhead, min[k] - overhead, max[k] - overhead
+        n = split(substr(names[k], 2), list, " ")
+        for (j = 1; j <= n; j++) {
+            printf "%s\"%s\":%.1f", (j > 1 ? "," : ""), list[j], functions[k, list[j]] / calls[k]
+        }
+        printf "}}\n"
+    }
+}
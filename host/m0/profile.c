@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Hot kernels of the sign tx command, each one called on a few inputs between the
+ * profile_begin and profile_end markers. The emulator's trace has the function of
+ * every instruction run, so count.awk attributes the instructions between the
+ * markers to the kernel_* function called, and to each function below it.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <os.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+
+#define ADDRESS_LEN 25
+
+static const uint64_t values[] = {0, 7, 1234, 100000000, 0xFFFFFFFF, 123456789012345ULL, 0x7FFFFFFFFFFFFFFFULL};
+
+// outputs with a 4-byte value and P2PKH, an 8-byte value and P2PKH, and P2SH
+static const uint8_t outputs[][8 + 3 + P2PKH_SCRIPT_LEN] = {
+    {0x00, 0x00, 0x04, 0xD2, 0x00, 0x00, 0x19, OP_DUP, OP_HASH160, 20, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A,
+     0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, OP_EQUALVERIFY, OP_CHECKSIG},
+    {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFB, 0x2E, 0x01, 0x00, 0x19, OP_DUP, OP_HASH160, 20, 0x5A, 0x5A, 0x5A, 0x5A,
+     0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, OP_EQUALVERIFY,
+     OP_CHECKSIG},
+    {0x00, 0x00, 0x04, 0xD2, 0x00, 0x00, 0x17, OP_HASH160, 20, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A,
+     0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, OP_EQUAL},
+};
+
+// a regular tx with 1 token, 2 inputs and 4 outputs, after the change output info
+static uint8_t tx_data[2 + 3 + 32 + 2 * 35 + 4 * (4 + 3 + P2PKH_SCRIPT_LEN)];
+
+static uint8_t address[ADDRESS_LEN];
+static unsigned char text[80];
+static tx_output_t output;
+static tx_parse_context_t tx;
+
+// the results are kept, so the kernels aren't optimized away
+volatile unsigned int sink;
+
+__attribute__((noinline)) void profile_begin(void) {
+    __asm__ volatile("");
+}
+
+__attribute__((noinline)) void profile_end(void) {
+    __asm__ volatile("");
+}
+
+// the cost of calling a kernel, which is taken from the others
+__attribute__((noinline)) static void kernel_empty(unsigned int i) {
+    __asm__ volatile("");
+}
+
+__attribute__((noinline)) static void kernel_encode_base58(unsigned int i) {
+    // the first address starts with a zero byte
+    address[0] = (i == 0 ? 0 : P2PKH_VERSION_BYTE);
+    os_memset(address + 1, 0x11 * (i + 1), ADDRESS_LEN - 1);
+    sink = encode_base58(address, ADDRESS_LEN, text, sizeof(text));
+}
+
+__attribute__((noinline)) static void kernel_utoa(unsigned int i) {
+    sink = utoa(values[i], (char*)text);
+}
+
+__attribute__((noinline)) static void kernel_format_value(unsigned int i) {
+    sink = format_value(values[i], text);
+}
+
+__attribute__((noinline)) static void kernel_parse_output(unsigned int i) {
+    sink = parse_output((uint8_t*)outputs[i], sizeof(outputs[i]), &output) - outputs[i];
+}
+
+// decodes the whole tx from a single packet, like receive_data
+__attribute__((noinline)) static void kernel_decode_tx(unsigned int i) {
+    volatile unsigned short result = 0;
+    BEGIN_TRY {
+        TRY {
+            tx_parse_init(&tx);
+            tx_parse_header(&tx, tx_data, sizeof(tx_data));
+            tx_set_data(&tx, tx_data + 5, sizeof(tx_data) - 5);
+            for (;;) {
+                tx_decode_element(&tx);
+            }
+        }
+        CATCH_OTHER(e) {
+            result = e;
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+    sink = result;
+}
+
+static void build_tx(void) {
+    uint8_t *p = tx_data;
+    unsigned int i;
+
+    *p++ = 0x00;
+    *p++ = TX_VERSION_REGULAR;
+    *p++ = 1;
+    *p++ = 2;
+    *p++ = 4;
+    os_memset(p, 0x01, 32);
+    p += 32;
+    for (i = 0; i < 2; i++) {
+        os_memset(p, 0x02, 35);
+        p[33] = 0;
+        p[34] = 0;
+        p += 35;
+    }
+    for (i = 0; i < 4; i++) {
+        // 4-byte value and P2PKH
+        os_memcpy(p, outputs[0], 4 + 3 + P2PKH_SCRIPT_LEN);
+        p[4] = i % 2;
+        p += 4 + 3 + P2PKH_SCRIPT_LEN;
+    }
+}
+
+#define PROFILE(kernel, calls) \
+    for (i = 0; i < (calls); i++) { \
+        profile_begin(); \
+        kernel(i); \
+        profile_end(); \
+    }
+
+int main(void) {
+    unsigned int i;
+
+    build_tx();
+    PROFILE(kernel_empty, 4);
+    PROFILE(kernel_encode_base58, 4);
+    PROFILE(kernel_utoa, sizeof(values) / sizeof(values[0]));
+    PROFILE(kernel_format_value, sizeof(values) / sizeof(values[0]));
+    PROFILE(kernel_parse_output, sizeof(outputs) / sizeof(outputs[0]));
+    PROFILE(kernel_decode_tx, 2);
+    return 0;
+}
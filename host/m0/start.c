@@ -0,0 +1,22 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Entry point of the profile. The emulator runs it as a Linux process, which
+ * already has its stack, data and zeroed bss, so main is called right away and
+ * the process exits with the exit syscall.
+ */
+
+int main(void);
+
+__attribute__((noreturn)) void _start(void) {
+    register int code __asm__("r0") = main();
+    register int syscall __asm__("r7") = 1;
+
+    __asm__ volatile("svc 0" : : "r"(code), "r"(syscall));
+    for (;;);
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * SDK stand-ins for the Cortex-M0 profile. The profiled kernels don't use any crypto,
+ * so hashes write zeros and key functions throw, like they'd fail on a device
+ * without a seed. There's a single thread, so the try context is a plain global.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <os.h>
+
+static try_context_t *current_context;
+
+try_context_t *try_context_get(void) {
+    return current_context;
+}
+
+try_context_t *try_context_set(try_context_t *context) {
+    try_context_t *previous = current_context;
+    current_context = context;
+    return previous;
+}
+
+void os_longjmp(unsigned int exception) {
+    // there's no uncaught exception on the profiled kernels
+    longjmp(current_context->jmp_buf, exception);
+}
+
+// may be on the C library
+__attribute__((weak)) void explicit_bzero(void *s, size_t n) {
+    memset(s, 0, n);
+}
+
+void os_perso_derive_node_bip32(unsigned int curve, const unsigned int *path, unsigned int pathLength,
+                                unsigned char *privateKey, unsigned char *chain) {
+    THROW(EXCEPTION);
+}
+
+int cx_sha256_init(cx_sha256_t *hash) {
+    return 0;
+}
+
+int cx_ripemd160_init(cx_ripemd160_t *hash) {
+    return 0;
+}
+
+int cx_hash(cx_hash_t *hash, int mode, const unsigned char *in, unsigned int len, unsigned char *out, unsigned int out_len) {
+    if (out != NULL) {
+        memset(out, 0, out_len);
+    }
+    return out_len;
+}
+
+int cx_hash_sha256(const unsigned char *in, unsigned int len, unsigned char *out, unsigned int out_len) {
+    memset(out, 0, out_len);
+    return out_len;
+}
+
+int cx_ecdsa_init_private_key(cx_curve_t curve, const unsigned char *rawkey, unsigned int key_len, cx_ecfp_private_key_t *pvkey) {
+    THROW(EXCEPTION);
+}
+
+int cx_ecfp_generate_pair(cx_curve_t curve, cx_ecfp_public_key_t *pubkey, cx_ecfp_private_key_t *privkey, int keepprivate) {
+    THROW(EXCEPTION);
+}
+
+int cx_ecdsa_sign(const cx_ecfp_private_key_t *pvkey, int mode, cx_md_t hashID, const unsigned char *hash, unsigned int hash_len,
+                  unsigned char *sig, unsigned int sig_len, unsigned int *info) {
+    THROW(EXCEPTION);
+}
+
+int cx_hmac_sha512(const unsigned char *key, unsigned int key_len, const unsigned char *in, unsigned int len, unsigned char *mac, unsigned int mac_len) {
+    THROW(EXCEPTION);
+}
+
+void cx_math_addm(unsigned char *r, const unsigned char *a, const unsigned char *b, const unsigned char *m, unsigned int len) {
+    THROW(EXCEPTION);
+}
+
+int cx_math_cmp(const unsigned char *a, const unsigned char *b, unsigned int len) {
+    return memcmp(a, b, len);
+}
+
+int cx_math_sub(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len) {
+    THROW(EXCEPTION);
+}
+
+int cx_math_is_zero(const unsigned char *a, unsigned int len) {
+    THROW(EXCEPTION);
+}
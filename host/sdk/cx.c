@@ -0,0 +1,391 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host implementation of the cx functions used by the app. SHA-256, SHA-512
+ * (FIPS 180-4), RIPEMD-160 and HMAC are computed in software and the big number
+ * helpers work on big endian byte strings, like on the device. The curve and key
+ * functions are on cx_ecc.c.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "os.h"
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_block(uint32_t *acc, const unsigned char *block) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = U4BE(block, 4 * i);
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = acc[0]; b = acc[1]; c = acc[2]; d = acc[3];
+    e = acc[4]; f = acc[5]; g = acc[6]; h = acc[7];
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    acc[0] += a; acc[1] += b; acc[2] += c; acc[3] += d;
+    acc[4] += e; acc[5] += f; acc[6] += g; acc[7] += h;
+}
+
+int cx_sha256_init(cx_sha256_t *hash) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memset(hash, 0, sizeof(cx_sha256_t));
+    hash->header.algo = CX_SHA256;
+    memcpy(hash->acc, iv, sizeof(iv));
+    return CX_SHA256;
+}
+
+// RIPEMD-160 message word selection, rotations and constants, for the left and
+// right lines
+static const uint8_t rmd_r[80] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8,
+    3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12,
+    1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2,
+    4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13,
+};
+static const uint8_t rmd_rp[80] = {
+    5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12,
+    6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2,
+    15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13,
+    8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14,
+    12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11,
+};
+static const uint8_t rmd_s[80] = {
+    11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8,
+    7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12,
+    11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5,
+    11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12,
+    9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6,
+};
+static const uint8_t rmd_sp[80] = {
+    8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6,
+    9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11,
+    9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5,
+    15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8,
+    8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11,
+};
+static const uint32_t rmd_k[5] = {0x00000000, 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xa953fd4e};
+static const uint32_t rmd_kp[5] = {0x50a28be6, 0x5c4dd124, 0x6d703ef3, 0x7a6d76e9, 0x00000000};
+
+static uint32_t rmd_f(int j, uint32_t x, uint32_t y, uint32_t z) {
+    switch (j / 16) {
+    case 0: return x ^ y ^ z;
+    case 1: return (x & y) | (~x & z);
+    case 2: return (x | ~y) ^ z;
+    case 3: return (x & z) | (y & ~z);
+    default: return x ^ (y | ~z);
+    }
+}
+
+static void ripemd160_block(uint32_t *acc, const unsigned char *block) {
+    uint32_t x[16], a, b, c, d, e, ap, bp, cp, dp, ep, t;
+    int j;
+
+    for (j = 0; j < 16; j++) {
+        x[j] = U4LE(block, 4 * j);
+    }
+    a = ap = acc[0]; b = bp = acc[1]; c = cp = acc[2]; d = dp = acc[3]; e = ep = acc[4];
+    for (j = 0; j < 80; j++) {
+        t = ROTL(a + rmd_f(j, b, c, d) + x[rmd_r[j]] + rmd_k[j / 16], rmd_s[j]) + e;
+        a = e; e = d; d = ROTL(c, 10); c = b; b = t;
+        t = ROTL(ap + rmd_f(79 - j, bp, cp, dp) + x[rmd_rp[j]] + rmd_kp[j / 16], rmd_sp[j]) + ep;
+        ap = ep; ep = dp; dp = ROTL(cp, 10); cp = bp; bp = t;
+    }
+    t = acc[1] + c + dp;
+    acc[1] = acc[2] + d + ep;
+    acc[2] = acc[3] + e + ap;
+    acc[3] = acc[4] + a + bp;
+    acc[4] = acc[0] + b + cp;
+    acc[0] = t;
+}
+
+int cx_ripemd160_init(cx_ripemd160_t *hash) {
+    static const uint32_t iv[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    memset(hash, 0, sizeof(cx_ripemd160_t));
+    hash->header.algo = CX_RIPEMD160;
+    memcpy(hash->acc, iv, sizeof(iv));
+    return CX_RIPEMD160;
+}
+
+// SHA-256 and RIPEMD-160 share the block size and padding, only the length and
+// the digest have opposite endianness
+int cx_hash(cx_hash_t *hash, int mode, const unsigned char *in, unsigned int len, unsigned char *out, unsigned int out_len) {
+    bool sha256 = (hash->algo == CX_SHA256);
+    unsigned char *block = (sha256 ? ((cx_sha256_t*)hash)->block : ((cx_ripemd160_t*)hash)->block);
+    unsigned int *blen = (sha256 ? &((cx_sha256_t*)hash)->blen : &((cx_ripemd160_t*)hash)->blen);
+    uint32_t *acc = (sha256 ? ((cx_sha256_t*)hash)->acc : ((cx_ripemd160_t*)hash)->acc);
+    void (*process)(uint32_t *, const unsigned char *) = (sha256 ? sha256_block : ripemd160_block);
+    unsigned int acc_len = (sha256 ? 8 : 5);
+    uint64_t bits;
+    unsigned int i;
+
+    if (hash->algo != CX_SHA256 && hash->algo != CX_RIPEMD160) {
+        THROW(INVALID_PARAMETER);
+    }
+    while (len > 0) {
+        unsigned int n = 64 - *blen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(block + *blen, in, n);
+        *blen += n;
+        in += n;
+        len -= n;
+        if (*blen == 64) {
+            process(acc, block);
+            hash->counter++;
+            *blen = 0;
+        }
+    }
+    if (!(mode & CX_LAST)) {
+        return 0;
+    }
+
+    bits = ((uint64_t)hash->counter * 64 + *blen) * 8;
+    block[(*blen)++] = 0x80;
+    if (*blen > 56) {
+        memset(block + *blen, 0, 64 - *blen);
+        process(acc, block);
+        *blen = 0;
+    }
+    memset(block + *blen, 0, 56 - *blen);
+    for (i = 0; i < 8; i++) {
+        block[sha256 ? 63 - i : 56 + i] = bits >> (8 * i);
+    }
+    process(acc, block);
+    if (out != NULL) {
+        if (out_len < 4 * acc_len) {
+            THROW(INVALID_PARAMETER);
+        }
+        for (i = 0; i < 4 * acc_len; i++) {
+            uint32_t word = acc[i / 4];
+            out[i] = (sha256 ? word >> (24 - 8 * (i % 4)) : word >> (8 * (i % 4)));
+        }
+    }
+    return 4 * acc_len;
+}
+
+int cx_hash_sha256(const unsigned char *in, unsigned int len, unsigned char *out, unsigned int out_len) {
+    cx_sha256_t hash;
+    cx_sha256_init(&hash);
+    return cx_hash(&hash.header, CX_LAST, in, len, out, out_len);
+}
+
+// SHA-512 is only used by HMAC-SHA512, so it's only computed in one go
+static const uint64_t sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static void sha512_block(uint64_t *acc, const unsigned char *block) {
+    uint64_t w[80], a, b, c, d, e, f, g, h, t1, t2;
+    int i, j;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = 0;
+        for (j = 0; j < 8; j++) {
+            w[i] = (w[i] << 8) | block[8 * i + j];
+        }
+    }
+    for (i = 16; i < 80; i++) {
+        uint64_t s0 = ROTR64(w[i - 15], 1) ^ ROTR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = ROTR64(w[i - 2], 19) ^ ROTR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = acc[0]; b = acc[1]; c = acc[2]; d = acc[3];
+    e = acc[4]; f = acc[5]; g = acc[6]; h = acc[7];
+    for (i = 0; i < 80; i++) {
+        t1 = h + (ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41)) + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+        t2 = (ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    acc[0] += a; acc[1] += b; acc[2] += c; acc[3] += d;
+    acc[4] += e; acc[5] += f; acc[6] += g; acc[7] += h;
+}
+
+// hashes the concatenation of two strings
+static void sha512(const unsigned char *in1, unsigned int len1, const unsigned char *in2, unsigned int len2,
+                   unsigned char *out) {
+    uint64_t acc[8] = {
+        0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+        0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+    };
+    unsigned char block[128];
+    uint64_t bits = ((uint64_t)len1 + len2) * 8;
+    unsigned int blen = 0, i;
+
+    for (i = 0; i < len1 + len2; i++) {
+        block[blen++] = (i < len1 ? in1[i] : in2[i - len1]);
+        if (blen == 128) {
+            sha512_block(acc, block);
+            blen = 0;
+        }
+    }
+    block[blen++] = 0x80;
+    if (blen > 112) {
+        memset(block + blen, 0, 128 - blen);
+        sha512_block(acc, block);
+        blen = 0;
+    }
+    // the length has 128 bits, but it's never over 64
+    memset(block + blen, 0, 128 - blen);
+    for (i = 0; i < 8; i++) {
+        block[127 - i] = bits >> (8 * i);
+    }
+    sha512_block(acc, block);
+    for (i = 0; i < 64; i++) {
+        out[i] = acc[i / 8] >> (56 - 8 * (i % 8));
+    }
+}
+
+// RFC 2104, for SHA-256 (block of 64 bytes) and SHA-512 (block of 128 bytes)
+static void hmac(bool is_sha512, const unsigned char *key, unsigned int key_len, const unsigned char *in,
+                 unsigned int len, unsigned char *mac) {
+    unsigned int block_len = (is_sha512 ? 128 : 64);
+    unsigned int digest_len = (is_sha512 ? 64 : 32);
+    unsigned char pad[128], inner[64];
+    cx_sha256_t sha256;
+    unsigned int i;
+
+    memset(pad, 0, sizeof(pad));
+    if (key_len > block_len) {
+        if (is_sha512) {
+            sha512(key, key_len, NULL, 0, pad);
+        } else {
+            cx_hash_sha256(key, key_len, pad, 32);
+        }
+    } else {
+        memcpy(pad, key, key_len);
+    }
+
+    for (i = 0; i < block_len; i++) {
+        pad[i] ^= 0x36;
+    }
+    if (is_sha512) {
+        sha512(pad, block_len, in, len, inner);
+    } else {
+        cx_sha256_init(&sha256);
+        cx_hash(&sha256.header, 0, pad, block_len, NULL, 0);
+        cx_hash(&sha256.header, CX_LAST, in, len, inner, 32);
+    }
+
+    for (i = 0; i < block_len; i++) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+    if (is_sha512) {
+        sha512(pad, block_len, inner, digest_len, mac);
+    } else {
+        cx_sha256_init(&sha256);
+        cx_hash(&sha256.header, 0, pad, block_len, NULL, 0);
+        cx_hash(&sha256.header, CX_LAST, inner, digest_len, mac, 32);
+    }
+    memset(pad, 0, sizeof(pad));
+    memset(inner, 0, sizeof(inner));
+}
+
+int cx_hmac_sha256(const unsigned char *key, unsigned int key_len, const unsigned char *in, unsigned int len, unsigned char *mac, unsigned int mac_len) {
+    if (mac_len < 32) {
+        THROW(INVALID_PARAMETER);
+    }
+    hmac(false, key, key_len, in, len, mac);
+    return 32;
+}
+
+int cx_hmac_sha512(const unsigned char *key, unsigned int key_len, const unsigned char *in, unsigned int len, unsigned char *mac, unsigned int mac_len) {
+    if (mac_len < 64) {
+        THROW(INVALID_PARAMETER);
+    }
+    hmac(true, key, key_len, in, len, mac);
+    return 64;
+}
+
+int cx_math_cmp(const unsigned char *a, const unsigned char *b, unsigned int len) {
+    return memcmp(a, b, len);
+}
+
+int cx_math_sub(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len) {
+    int borrow = 0;
+    while (len-- > 0) {
+        int diff = a[len] - b[len] - borrow;
+        borrow = (diff < 0);
+        r[len] = diff & 0xFF;
+    }
+    return borrow;
+}
+
+static int math_add(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len) {
+    int carry = 0;
+    while (len-- > 0) {
+        int sum = a[len] + b[len] + carry;
+        carry = sum >> 8;
+        r[len] = sum & 0xFF;
+    }
+    return carry;
+}
+
+// r = (a + b) mod m, for a and b already reduced
+void cx_math_addm(unsigned char *r, const unsigned char *a, const unsigned char *b, const unsigned char *m, unsigned int len) {
+    if (math_add(r, a, b, len) || memcmp(r, m, len) >= 0) {
+        cx_math_sub(r, r, m, len);
+    }
+}
+
+int cx_math_is_zero(const unsigned char *a, unsigned int len) {
+    while (len-- > 0) {
+        if (a[len] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
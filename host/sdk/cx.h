@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host stand-in for the subset of the BOLOS SDK's cx.h used by the app. The hash
+ * functions are implemented in cx.c and the secp256k1 ones in cx_ecc.c, with the
+ * keys derived from the seed set by os_perso_set_seed.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    CX_CURVE_256K1 = 0x21,
+} cx_curve_t;
+
+typedef enum {
+    CX_RIPEMD160 = 1,
+    CX_SHA256 = 3,
+    CX_SHA512 = 5,
+} cx_md_t;
+
+#define CX_LAST                 (1 << 0)
+#define CX_RND_RFC6979          (3 << 9)
+#define CX_ECCINFO_PARITY_ODD   1
+
+typedef struct {
+    cx_md_t algo;
+    unsigned int counter;
+} cx_hash_t;
+
+typedef struct {
+    cx_hash_t header;
+    unsigned int blen;
+    unsigned char block[64];
+    uint32_t acc[8];
+} cx_sha256_t;
+
+typedef struct {
+    cx_hash_t header;
+    unsigned int blen;
+    unsigned char block[64];
+    uint32_t acc[5];
+} cx_ripemd160_t;
+
+typedef struct {
+    cx_curve_t curve;
+    unsigned int W_len;
+    unsigned char W[65];
+} cx_ecfp_public_key_t;
+
+typedef struct {
+    cx_curve_t curve;
+    unsigned int d_len;
+    unsigned char d[32];
+} cx_ecfp_private_key_t;
+
+int cx_sha256_init(cx_sha256_t *hash);
+int cx_ripemd160_init(cx_ripemd160_t *hash);
+int cx_hash(cx_hash_t *hash, int mode, const unsigned char *in, unsigned int len, unsigned char *out, unsigned int out_len);
+int cx_hash_sha256(const unsigned char *in, unsigned int len, unsigned char *out, unsigned int out_len);
+
+int cx_ecdsa_init_private_key(cx_curve_t curve, const unsigned char *rawkey, unsigned int key_len, cx_ecfp_private_key_t *pvkey);
+int cx_ecfp_generate_pair(cx_curve_t curve, cx_ecfp_public_key_t *pubkey, cx_ecfp_private_key_t *privkey, int keepprivate);
+int cx_ecdsa_sign(const cx_ecfp_private_key_t *pvkey, int mode, cx_md_t hashID, const unsigned char *hash, unsigned int hash_len,
+                  unsigned char *sig, unsigned int sig_len, unsigned int *info);
+int cx_hmac_sha256(const unsigned char *key, unsigned int key_len, const unsigned char *in, unsigned int len, unsigned char *mac, unsigned int mac_len);
+int cx_hmac_sha512(const unsigned char *key, unsigned int key_len, const unsigned char *in, unsigned int len, unsigned char *mac, unsigned int mac_len);
+
+void cx_math_addm(unsigned char *r, const unsigned char *a, const unsigned char *b, const unsigned char *m, unsigned int len);
+int cx_math_cmp(const unsigned char *a, const unsigned char *b, unsigned int len);
+int cx_math_sub(unsigned char *r, const unsigned char *a, const unsigned char *b, unsigned int len);
+int cx_math_is_zero(const unsigned char *a, unsigned int len);
@@ -0,0 +1,494 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host implementation of the secp256k1 functions used by the app: key pairs, ECDSA
+ * signatures with RFC 6979 nonces and BIP32 derivation from a seed, so the host
+ * build derives and signs like a device with that seed. The numbers are kept in
+ * 8 limbs of 32 bits, least significant first.
+ *
+ * It's a reference for tests and benchmarks, not for real keys: nothing here runs
+ * in constant time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "os.h"
+
+#define LIMBS 8
+
+// a modulus m = 2^256 - c, with c short enough for a fast reduction
+typedef struct {
+    uint32_t m[LIMBS];
+    uint32_t c[5];
+    unsigned int c_len;
+} modulus_t;
+
+// point in jacobian coordinates (X / Z^2, Y / Z^3), the infinity has Z = 0
+typedef struct {
+    uint32_t x[LIMBS];
+    uint32_t y[LIMBS];
+    uint32_t z[LIMBS];
+} point_t;
+
+static const modulus_t field_p = {
+    {0xFFFFFC2F, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+    {0x000003D1, 0x00000001},
+    2,
+};
+
+static const modulus_t order_n = {
+    {0xD0364141, 0xBFD25E8C, 0xAF48A03B, 0xBAAEDCE6, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF},
+    {0x2FC9BEBF, 0x402DA173, 0x50B75FC4, 0x45512319, 0x00000001},
+    5,
+};
+
+static const uint32_t generator_x[LIMBS] = {
+    0x16F81798, 0x59F2815B, 0x2DCE28D9, 0x029BFCDB, 0xCE870B07, 0x55A06295, 0xF9DCBBAC, 0x79BE667E,
+};
+static const uint32_t generator_y[LIMBS] = {
+    0xFB10D4B8, 0x9C47D08F, 0xA6855419, 0xFD17B448, 0x0E1108A8, 0x5DA4FBFC, 0x26A3C465, 0x483ADA77,
+};
+
+// seed of the mnemonic "abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon abandon about"
+static unsigned char seed[64] = {
+    0x5e, 0xb0, 0x0b, 0xbd, 0xdc, 0xf0, 0x69, 0x08, 0x48, 0x89, 0xa8, 0xab, 0x91, 0x55, 0x56, 0x81,
+    0x65, 0xf5, 0xc4, 0x53, 0xcc, 0xb8, 0x5e, 0x70, 0x81, 0x1a, 0xae, 0xd6, 0xf6, 0xda, 0x5f, 0xc1,
+    0x9a, 0x5a, 0xc4, 0x0b, 0x38, 0x9c, 0xd3, 0x70, 0xd0, 0x86, 0x20, 0x6d, 0xec, 0x8a, 0xa6, 0xc4,
+    0x3d, 0xae, 0xa6, 0x69, 0x0f, 0x20, 0xad, 0x3d, 0x8d, 0x48, 0xb2, 0xd2, 0xce, 0x9e, 0x38, 0xe4,
+};
+static unsigned int seed_len = sizeof(seed);
+
+static void from_bytes(uint32_t *r, const unsigned char *in) {
+    int i;
+    for (i = 0; i < LIMBS; i++) {
+        r[i] = U4BE(in, 4 * (LIMBS - 1 - i));
+    }
+}
+
+static void to_bytes(unsigned char *out, const uint32_t *a) {
+    int i;
+    for (i = 0; i < LIMBS; i++) {
+        out[4 * (LIMBS - 1 - i)] = a[i] >> 24;
+        out[4 * (LIMBS - 1 - i) + 1] = a[i] >> 16;
+        out[4 * (LIMBS - 1 - i) + 2] = a[i] >> 8;
+        out[4 * (LIMBS - 1 - i) + 3] = a[i];
+    }
+}
+
+static bool is_zero(const uint32_t *a) {
+    int i;
+    for (i = 0; i < LIMBS; i++) {
+        if (a[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compare(const uint32_t *a, const uint32_t *b) {
+    int i;
+    for (i = LIMBS - 1; i >= 0; i--) {
+        if (a[i] != b[i]) {
+            return (a[i] > b[i] ? 1 : -1);
+        }
+    }
+    return 0;
+}
+
+static uint32_t add(uint32_t *r, const uint32_t *a, const uint32_t *b) {
+    uint64_t carry = 0;
+    int i;
+    for (i = 0; i < LIMBS; i++) {
+        carry += (uint64_t)a[i] + b[i];
+        r[i] = carry;
+        carry >>= 32;
+    }
+    return carry;
+}
+
+static uint32_t sub(uint32_t *r, const uint32_t *a, const uint32_t *b) {
+    int64_t borrow = 0;
+    int i;
+    for (i = 0; i < LIMBS; i++) {
+        borrow += (int64_t)a[i] - b[i];
+        r[i] = borrow;
+        borrow >>= 32;
+    }
+    return (borrow != 0);
+}
+
+// r = a mod m, for a < 2m
+static void reduce_once(uint32_t *r, const uint32_t *a, const modulus_t *mod) {
+    if (compare(a, mod->m) >= 0) {
+        sub(r, a, mod->m);
+    } else if (r != a) {
+        memcpy(r, a, LIMBS * sizeof(uint32_t));
+    }
+}
+
+static void add_mod(uint32_t *r, const uint32_t *a, const uint32_t *b, const modulus_t *mod) {
+    if (add(r, a, b)) {
+        // r + 2^256 - m = r + c fits, as r < m
+        sub(r, r, mod->m);
+    } else {
+        reduce_once(r, r, mod);
+    }
+}
+
+static void sub_mod(uint32_t *r, const uint32_t *a, const uint32_t *b, const modulus_t *mod) {
+    if (sub(r, a, b)) {
+        add(r, r, mod->m);
+    }
+}
+
+/*
+ * r = a * b mod m. As 2^256 = c (mod m), the bits of the product over 256 are folded
+ * into the low ones multiplied by c, until they're all gone.
+ */
+static void mul_mod(uint32_t *r, const uint32_t *a, const uint32_t *b, const modulus_t *mod) {
+    uint32_t t[2 * LIMBS + 1], u[2 * LIMBS + 1];
+    uint64_t carry;
+    unsigned int i, j, high;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < LIMBS; i++) {
+        carry = 0;
+        for (j = 0; j < LIMBS; j++) {
+            carry += (uint64_t)a[i] * b[j] + t[i + j];
+            t[i + j] = carry;
+            carry >>= 32;
+        }
+        t[i + LIMBS] = carry;
+    }
+
+    for (;;) {
+        high = 2 * LIMBS + 1;
+        while (high > LIMBS && t[high - 1] == 0) {
+            high--;
+        }
+        if (high == LIMBS) {
+            break;
+        }
+        memset(u, 0, sizeof(u));
+        memcpy(u, t, LIMBS * sizeof(uint32_t));
+        for (i = 0; i < high - LIMBS; i++) {
+            carry = 0;
+            for (j = 0; j < mod->c_len; j++) {
+                carry += (uint64_t)t[LIMBS + i] * mod->c[j] + u[i + j];
+                u[i + j] = carry;
+                carry >>= 32;
+            }
+            for (j = i + mod->c_len; carry != 0; j++) {
+                carry += u[j];
+                u[j] = carry;
+                carry >>= 32;
+            }
+        }
+        memcpy(t, u, sizeof(t));
+    }
+    reduce_once(r, t, mod);
+}
+
+// r = a^(m - 2) = a^-1 mod m, as m is prime
+static void inv_mod(uint32_t *r, const uint32_t *a, const modulus_t *mod) {
+    uint32_t e[LIMBS], x[LIMBS] = {1};
+    uint32_t two[LIMBS] = {2};
+    int i;
+
+    sub(e, mod->m, two);
+    for (i = 32 * LIMBS - 1; i >= 0; i--) {
+        mul_mod(x, x, x, mod);
+        if ((e[i / 32] >> (i % 32)) & 1) {
+            mul_mod(x, x, a, mod);
+        }
+    }
+    memcpy(r, x, sizeof(x));
+}
+
+static void point_double(point_t *p) {
+    const modulus_t *f = &field_p;
+    uint32_t a[LIMBS], b[LIMBS], c[LIMBS], d[LIMBS], e[LIMBS], t[LIMBS];
+
+    if (is_zero(p->z) || is_zero(p->y)) {
+        memset(p->z, 0, sizeof(p->z));
+        return;
+    }
+    mul_mod(a, p->x, p->x, f);
+    mul_mod(b, p->y, p->y, f);
+    mul_mod(c, b, b, f);
+    // d = 2 * ((x + b)^2 - a - c)
+    add_mod(t, p->x, b, f);
+    mul_mod(d, t, t, f);
+    sub_mod(d, d, a, f);
+    sub_mod(d, d, c, f);
+    add_mod(d, d, d, f);
+    // e = 3a
+    add_mod(e, a, a, f);
+    add_mod(e, e, a, f);
+    // z3 = 2yz
+    mul_mod(p->z, p->y, p->z, f);
+    add_mod(p->z, p->z, p->z, f);
+    // x3 = e^2 - 2d
+    mul_mod(p->x, e, e, f);
+    sub_mod(p->x, p->x, d, f);
+    sub_mod(p->x, p->x, d, f);
+    // y3 = e * (d - x3) - 8c
+    sub_mod(t, d, p->x, f);
+    mul_mod(p->y, e, t, f);
+    add_mod(c, c, c, f);
+    add_mod(c, c, c, f);
+    add_mod(c, c, c, f);
+    sub_mod(p->y, p->y, c, f);
+}
+
+// p += (x, y), an affine point
+static void point_add_affine(point_t *p, const uint32_t *x, const uint32_t *y) {
+    const modulus_t *f = &field_p;
+    uint32_t zz[LIMBS], u[LIMBS], s[LIMBS], h[LIMBS], r[LIMBS], hh[LIMBS], hhh[LIMBS], v[LIMBS];
+
+    if (is_zero(p->z)) {
+        memcpy(p->x, x, sizeof(p->x));
+        memcpy(p->y, y, sizeof(p->y));
+        memset(p->z, 0, sizeof(p->z));
+        p->z[0] = 1;
+        return;
+    }
+    mul_mod(zz, p->z, p->z, f);
+    mul_mod(u, x, zz, f);
+    mul_mod(s, y, zz, f);
+    mul_mod(s, s, p->z, f);
+    sub_mod(h, u, p->x, f);
+    sub_mod(r, s, p->y, f);
+    if (is_zero(h)) {
+        if (is_zero(r)) {
+            point_double(p);
+        } else {
+            memset(p->z, 0, sizeof(p->z));
+        }
+        return;
+    }
+    mul_mod(hh, h, h, f);
+    mul_mod(hhh, h, hh, f);
+    mul_mod(v, p->x, hh, f);
+    // x3 = r^2 - h^3 - 2v
+    mul_mod(p->x, r, r, f);
+    sub_mod(p->x, p->x, hhh, f);
+    sub_mod(p->x, p->x, v, f);
+    sub_mod(p->x, p->x, v, f);
+    // y3 = r * (v - x3) - y1 * h^3
+    mul_mod(hhh, p->y, hhh, f);
+    sub_mod(v, v, p->x, f);
+    mul_mod(p->y, r, v, f);
+    sub_mod(p->y, p->y, hhh, f);
+    // z3 = z1 * h
+    mul_mod(p->z, p->z, h, f);
+}
+
+// (x, y) = k * G, for 0 < k < n
+static void multiply_generator(uint32_t *x, uint32_t *y, const uint32_t *k) {
+    uint32_t zi[LIMBS], zi2[LIMBS];
+    point_t p;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    for (i = 32 * LIMBS - 1; i >= 0; i--) {
+        point_double(&p);
+        if ((k[i / 32] >> (i % 32)) & 1) {
+            point_add_affine(&p, generator_x, generator_y);
+        }
+    }
+    inv_mod(zi, p.z, &field_p);
+    mul_mod(zi2, zi, zi, &field_p);
+    mul_mod(x, p.x, zi2, &field_p);
+    mul_mod(zi2, zi2, zi, &field_p);
+    mul_mod(y, p.y, zi2, &field_p);
+}
+
+// reads a private key, which must be in [1, n - 1]
+static void private_scalar(uint32_t *k, const unsigned char *d) {
+    from_bytes(k, d);
+    if (is_zero(k) || compare(k, order_n.m) >= 0) {
+        THROW(INVALID_PARAMETER);
+    }
+}
+
+int cx_ecdsa_init_private_key(cx_curve_t curve, const unsigned char *rawkey, unsigned int key_len, cx_ecfp_private_key_t *pvkey) {
+    if (curve != CX_CURVE_256K1 || key_len != 32) {
+        THROW(INVALID_PARAMETER);
+    }
+    pvkey->curve = curve;
+    pvkey->d_len = key_len;
+    memcpy(pvkey->d, rawkey, key_len);
+    return key_len;
+}
+
+// the app always derives its keys, so they're never generated at random
+int cx_ecfp_generate_pair(cx_curve_t curve, cx_ecfp_public_key_t *pubkey, cx_ecfp_private_key_t *privkey, int keepprivate) {
+    uint32_t k[LIMBS], x[LIMBS], y[LIMBS];
+
+    if (curve != CX_CURVE_256K1 || !keepprivate || privkey->d_len != 32) {
+        THROW(INVALID_PARAMETER);
+    }
+    private_scalar(k, privkey->d);
+    multiply_generator(x, y, k);
+    pubkey->curve = curve;
+    pubkey->W_len = 65;
+    pubkey->W[0] = 0x04;
+    to_bytes(pubkey->W + 1, x);
+    to_bytes(pubkey->W + 33, y);
+    return 0;
+}
+
+// writes a DER integer, with a leading 0 if its first bit is set
+static unsigned int der_integer(unsigned char *out, const unsigned char *value) {
+    unsigned int start = 0, len;
+
+    while (start < 31 && value[start] == 0) {
+        start++;
+    }
+    len = 32 - start;
+    out[0] = 0x02;
+    if (value[start] & 0x80) {
+        out[1] = len + 1;
+        out[2] = 0;
+        memcpy(out + 3, value + start, len);
+        return len + 3;
+    }
+    out[1] = len;
+    memcpy(out + 2, value + start, len);
+    return len + 2;
+}
+
+// K = HMAC(K, V || marker || extra), V = HMAC(K, V)
+static void rfc6979_update(unsigned char *k, unsigned char *v, int marker, const unsigned char *extra,
+                           unsigned int extra_len) {
+    unsigned char data[32 + 1 + 64];
+
+    memcpy(data, v, 32);
+    data[32] = marker;
+    memcpy(data + 33, extra, extra_len);
+    cx_hmac_sha256(k, 32, data, 33 + extra_len, k, 32);
+    cx_hmac_sha256(k, 32, v, 32, v, 32);
+    memset(data, 0, sizeof(data));
+}
+
+/*
+ * Deterministic ECDSA (RFC 6979, with HMAC-SHA256). Like the device, the signature is
+ * returned in DER and s isn't normalized.
+ */
+int cx_ecdsa_sign(const cx_ecfp_private_key_t *pvkey, int mode, cx_md_t hashID, const unsigned char *hash, unsigned int hash_len,
+                  unsigned char *sig, unsigned int sig_len, unsigned int *info) {
+    uint32_t d[LIMBS], e[LIMBS], k[LIMBS], r[LIMBS], s[LIMBS], x[LIMBS], y[LIMBS];
+    unsigned char key[64], hmac_k[32], hmac_v[32], r_bytes[32], s_bytes[32], der[72];
+    unsigned int len;
+
+    if ((mode & CX_RND_RFC6979) != CX_RND_RFC6979 || hashID != CX_SHA256 || hash_len != 32 || pvkey->d_len != 32) {
+        THROW(INVALID_PARAMETER);
+    }
+    private_scalar(d, pvkey->d);
+    from_bytes(e, hash);
+    reduce_once(e, e, &order_n);
+
+    // the HMAC key material is the private key and the reduced hash
+    memcpy(key, pvkey->d, 32);
+    to_bytes(key + 32, e);
+    memset(hmac_v, 0x01, sizeof(hmac_v));
+    memset(hmac_k, 0x00, sizeof(hmac_k));
+    rfc6979_update(hmac_k, hmac_v, 0x00, key, 64);
+    rfc6979_update(hmac_k, hmac_v, 0x01, key, 64);
+
+    for (;;) {
+        cx_hmac_sha256(hmac_k, 32, hmac_v, 32, hmac_v, 32);
+        from_bytes(k, hmac_v);
+        if (!is_zero(k) && compare(k, order_n.m) < 0) {
+            multiply_generator(x, y, k);
+            reduce_once(r, x, &order_n);
+            // s = k^-1 * (e + r * d)
+            mul_mod(s, r, d, &order_n);
+            add_mod(s, s, e, &order_n);
+            inv_mod(k, k, &order_n);
+            mul_mod(s, s, k, &order_n);
+            if (!is_zero(r) && !is_zero(s)) {
+                break;
+            }
+        }
+        rfc6979_update(hmac_k, hmac_v, 0x00, NULL, 0);
+    }
+    memset(key, 0, sizeof(key));
+    memset(hmac_k, 0, sizeof(hmac_k));
+
+    to_bytes(r_bytes, r);
+    to_bytes(s_bytes, s);
+    len = 2;
+    len += der_integer(der + len, r_bytes);
+    len += der_integer(der + len, s_bytes);
+    der[0] = 0x30;
+    der[1] = len - 2;
+    if (len > sig_len) {
+        THROW(INVALID_PARAMETER);
+    }
+    memcpy(sig, der, len);
+    if (info != NULL) {
+        *info = ((y[0] & 1) ? CX_ECCINFO_PARITY_ODD : 0);
+    }
+    return len;
+}
+
+void os_perso_set_seed(const unsigned char *new_seed, unsigned int len) {
+    if (len < 16 || len > sizeof(seed)) {
+        THROW(INVALID_PARAMETER);
+    }
+    memcpy(seed, new_seed, len);
+    seed_len = len;
+}
+
+// BIP32 private derivation from the seed's master node
+void os_perso_derive_node_bip32(unsigned int curve, const unsigned int *path, unsigned int pathLength, unsigned char *privateKey, unsigned char *chain) {
+    static const unsigned char master_key[] = "Bitcoin seed";
+    unsigned char node[64], data[37];
+    uint32_t k[LIMBS], tweak[LIMBS], x[LIMBS], y[LIMBS];
+    unsigned int i;
+
+    if (curve != CX_CURVE_256K1) {
+        THROW(INVALID_PARAMETER);
+    }
+    // node has the private key followed by the chain code
+    cx_hmac_sha512(master_key, sizeof(master_key) - 1, seed, seed_len, node, sizeof(node));
+    for (i = 0; i < pathLength; i++) {
+        private_scalar(k, node);
+        if (path[i] & 0x80000000) {
+            data[0] = 0;
+            memcpy(data + 1, node, 32);
+        } else {
+            multiply_generator(x, y, k);
+            data[0] = ((y[0] & 1) ? 0x03 : 0x02);
+            to_bytes(data + 1, x);
+        }
+        data[33] = path[i] >> 24;
+        data[34] = path[i] >> 16;
+        data[35] = path[i] >> 8;
+        data[36] = path[i];
+        cx_hmac_sha512(node + 32, 32, data, sizeof(data), node, sizeof(node));
+        // the key is invalid if the tweak is over n or the sum is 0, which is practically impossible
+        from_bytes(tweak, node);
+        if (compare(tweak, order_n.m) >= 0) {
+            THROW(EXCEPTION);
+        }
+        add_mod(k, k, tweak, &order_n);
+        to_bytes(node, k);
+    }
+    private_scalar(k, node);
+
+    memcpy(privateKey, node, 32);
+    if (chain != NULL) {
+        memcpy(chain, node + 32, 32);
+    }
+    memset(node, 0, sizeof(node));
+    memset(data, 0, sizeof(data));
+}
@@ -0,0 +1,13 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Host stand-in for the glyphs generated from glyphs/ by the SDK's Makefile
+
+#pragma once
+
+extern const bagl_icon_details_t C_icon_back;
+extern const bagl_icon_details_t C_icon_dashboard;
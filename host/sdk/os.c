@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "os.h"
+
+// each thread running the app core has its own chain of TRY blocks
+static __thread try_context_t *current_context;
+
+try_context_t *try_context_get(void) {
+    return current_context;
+}
+
+try_context_t *try_context_set(try_context_t *context) {
+    try_context_t *previous = current_context;
+    current_context = context;
+    return previous;
+}
+
+void os_longjmp(unsigned int exception) {
+    if (current_context == NULL) {
+        // the device would reset here
+        fprintf(stderr, "uncaught exception 0x%04X\n", exception);
+        abort();
+    }
+    longjmp(current_context->jmp_buf, exception);
+}
+
+// NVM is plain memory on the host
+void nvm_write(void *dst, void *src, unsigned int len) {
+    if (src == NULL) {
+        memset(dst, 0, len);
+    } else {
+        memmove(dst, src, len);
+    }
+}
+
+// the host build doesn't boot or quit the app, it runs hathor_main on its own thread
+void os_sched_exit(unsigned int exit_code) {
+}
+
+void os_boot(void) {
+}
+
+void reset(void) {
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host stand-in for the subset of the BOLOS SDK's os.h used by the app. Exceptions
+ * work like on the device, with setjmp/longjmp, but the try context is kept per
+ * thread, so several threads may run the app core at once.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <setjmp.h>
+
+typedef unsigned short exception_t;
+
+typedef struct try_context_s {
+    jmp_buf jmp_buf;
+    struct try_context_s *previous;
+    exception_t ex;
+} try_context_t;
+
+try_context_t *try_context_get(void);
+try_context_t *try_context_set(try_context_t *context);
+void os_longjmp(unsigned int exception) __attribute__((noreturn));
+
+#define BEGIN_TRY_L(L)          { try_context_t __try##L;
+#define TRY_L(L)                __try##L.ex = setjmp(__try##L.jmp_buf); if (__try##L.ex == 0) { __try##L.previous = try_context_set(&__try##L);
+#define CATCH_L(L, x)           goto __FINALLY##L; } else if (__try##L.ex == x) { __try##L.ex = 0; try_context_set(__try##L.previous);
+#define CATCH_OTHER_L(L, e)     goto __FINALLY##L; } else { exception_t e; e = __try##L.ex; __try##L.ex = 0; try_context_set(__try##L.previous);
+#define CATCH_ALL_L(L)          goto __FINALLY##L; } else { __try##L.ex = 0; try_context_set(__try##L.previous);
+#define FINALLY_L(L)            goto __FINALLY##L; } __FINALLY##L: if (try_context_get() == &__try##L) { try_context_set(__try##L.previous); }
+#define END_TRY_L(L)            if (__try##L.ex != 0) { THROW_L(L, __try##L.ex); } }
+#define THROW_L(L, x)           os_longjmp(x)
+
+#define BEGIN_TRY       BEGIN_TRY_L(_)
+#define TRY             TRY_L(_)
+#define CATCH(x)        CATCH_L(_, x)
+#define CATCH_OTHER(e)  CATCH_OTHER_L(_, e)
+#define CATCH_ALL       CATCH_ALL_L(_)
+#define FINALLY         FINALLY_L(_)
+#define END_TRY         END_TRY_L(_)
+#define THROW(x)        os_longjmp(x)
+
+#define EXCEPTION           1
+#define INVALID_PARAMETER   2
+#define EXCEPTION_IO_RESET  0x10
+
+#define U2BE(buf, off) ((((buf)[off] & 0xFF) << 8) | ((buf)[off + 1] & 0xFF))
+#define U4BE(buf, off) ((U2BE(buf, off) << 16) | (U2BE(buf, off + 2) & 0xFFFF))
+#define U4LE(buf, off) ((((buf)[off + 3] & 0xFF) << 24) | (((buf)[off + 2] & 0xFF) << 16) | \
+                        (((buf)[off + 1] & 0xFF) << 8) | ((buf)[off] & 0xFF))
+
+#define os_memmove  memmove
+#define os_memcpy   memcpy
+#define os_memset   memset
+#define os_memcmp   memcmp
+
+// there's no relocation on the host
+#define PIC(x) ((void*)(x))
+
+void nvm_write(void *dst, void *src, unsigned int len);
+void os_sched_exit(unsigned int exit_code);
+void os_boot(void);
+void reset(void);
+void os_perso_derive_node_bip32(unsigned int curve, const unsigned int *path, unsigned int pathLength, unsigned char *privateKey, unsigned char *chain);
+
+/**
+ * Host only: sets the BIP32 seed the keys are derived from, of 16 to 64 bytes. The
+ * default is the seed of the mnemonic "abandon abandon ... about", a test wallet.
+ */
+void os_perso_set_seed(const unsigned char *seed, unsigned int len);
+
+#include "cx.h"
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Host stand-in for the subset of the BOLOS SDK's os_io_seproxyhal.h used by the
+ * app: the APDU buffer, the bagl screen elements and the UX macros. There's no
+ * screen, so UX_DISPLAY hands the elements and their button handler to
+ * ux_stub_display.
+ */
+
+#pragma once
+
+#include "os.h"
+
+#define IO_APDU_BUFFER_SIZE (5 + 255)
+extern unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+
+#define CHANNEL_APDU        0
+#define CHANNEL_KEYBOARD    1
+#define CHANNEL_SPI         2
+
+#define IO_RESET_AFTER_REPLIED  0x80
+#define IO_RETURN_AFTER_TX      0x20
+#define IO_ASYNCH_REPLY         0x10
+#define IO_FLAGS                0xF8
+
+#define IO_APDU_MEDIA_USB_HID   1
+extern unsigned int G_io_apdu_media;
+
+unsigned short io_exchange(unsigned char channel_and_flags, unsigned short tx_len);
+
+#define BUTTON_LEFT         1
+#define BUTTON_RIGHT        2
+#define BUTTON_EVT_FAST     0x40000000
+#define BUTTON_EVT_RELEASED 0x80000000
+
+enum {
+    BAGL_RECTANGLE = 1,
+    BAGL_ICON = 5,
+    BAGL_LABELINE = 7,
+};
+
+#define BAGL_FILL                           1
+#define BAGL_FONT_OPEN_SANS_REGULAR_11px    10
+#define BAGL_FONT_ALIGNMENT_CENTER          0x8000
+#define BAGL_GLYPH_ICON_CROSS               1
+#define BAGL_GLYPH_ICON_CHECK               2
+#define BAGL_GLYPH_ICON_LEFT                3
+#define BAGL_GLYPH_ICON_RIGHT               4
+
+typedef struct {
+    int type;
+    unsigned char userid;
+    short x;
+    short y;
+    unsigned short width;
+    unsigned short height;
+    unsigned char stroke;
+    unsigned char radius;
+    unsigned char fill;
+    unsigned int fgcolor;
+    unsigned int bgcolor;
+    unsigned short font_id;
+    unsigned char icon_id;
+} bagl_component_t;
+
+typedef struct bagl_element_e bagl_element_t;
+typedef const bagl_element_t *(*bagl_element_callback_t)(const bagl_element_t *element);
+
+struct bagl_element_e {
+    bagl_component_t component;
+    const char *text;
+    unsigned char touch_area_brim;
+    int overfgcolor;
+    int overbgcolor;
+    bagl_element_callback_t tap;
+    bagl_element_callback_t out;
+    bagl_element_callback_t over;
+};
+
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    unsigned int bpp;
+    const unsigned int *colors;
+    const unsigned char *bitmap;
+} bagl_icon_details_t;
+
+typedef struct ux_menu_entry_s ux_menu_entry_t;
+
+struct ux_menu_entry_s {
+    const ux_menu_entry_t *menu;
+    void (*callback)(unsigned int);
+    unsigned int userid;
+    const bagl_icon_details_t *icon;
+    const char *line1;
+    const char *line2;
+    char text_x;
+    char icon_x;
+};
+
+#define UX_MENU_END {NULL, NULL, 0, NULL, NULL, NULL, 0, 0}
+
+typedef unsigned int (*button_push_callback_t)(unsigned int button_mask, unsigned int button_mask_counter);
+typedef const bagl_element_t *(*bagl_element_prepro_t)(const bagl_element_t *element);
+
+typedef struct {
+    int dummy;
+} ux_state_t;
+
+void ux_stub_display(const bagl_element_t *elements, unsigned int count, button_push_callback_t button, bagl_element_prepro_t prepro);
+void ux_stub_redisplay(void);
+void ux_stub_menu_display(unsigned int index, const ux_menu_entry_t *menu, void *prepro);
+
+#define UX_DISPLAY(elems, prepro)   ux_stub_display(elems, sizeof(elems) / sizeof(elems[0]), elems##_button, prepro)
+#define UX_REDISPLAY()              ux_stub_redisplay()
+#define UX_MENU_DISPLAY(i, m, p)    ux_stub_menu_display(i, m, p)
+#define UX_INIT()
+#define UX_FINGER_EVENT(b)
+#define UX_BUTTON_PUSH_EVENT(b)
+#define UX_DEFAULT_EVENT()
+#define UX_DISPLAYED_EVENT(x)
+#define UX_TICKER_EVENT(b, x)
+
+#define SEPROXYHAL_TAG_FINGER_EVENT                 1
+#define SEPROXYHAL_TAG_BUTTON_PUSH_EVENT            2
+#define SEPROXYHAL_TAG_STATUS_EVENT                 3
+#define SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT      4
+#define SEPROXYHAL_TAG_TICKER_EVENT                 5
+#define SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED 8
+#define IO_SEPROXYHAL_BUFFER_SIZE_B 128
+
+void io_seproxyhal_display_default(bagl_element_t *element);
+int io_seproxyhal_spi_is_status_sent(void);
+void io_seproxyhal_general_status(void);
+void io_seproxyhal_spi_send(const unsigned char *buffer, unsigned short len);
+unsigned short io_seproxyhal_spi_recv(unsigned char *buffer, unsigned short len, unsigned int flags);
+void io_seproxyhal_init(void);
+void USB_power(unsigned char enabled);
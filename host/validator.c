@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Runs the sign tx decoder (src/tx_decoder.c) on the host. Txs are decoded exactly
+ * like on the device: the data is given to the decoder in chunks and an element
+ * split between them is carried to the next one. The screens are built with the
+ * same formatting and pagination as sign_tx.c.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+#include "hathor_host.h"
+
+_Static_assert(HATHOR_MAX_PAGES == MAX_DISPLAY_PAGES, "pages must match the device's");
+_Static_assert(HATHOR_SCREEN_LENGTH == MAX_SCREEN_LENGTH, "pages must match the device's");
+
+// the sighash_all data is given to the decoder at most this many bytes at a time
+#define VALIDATION_CHUNK_LEN 0x8000
+
+// state of a validation, shared by its steps
+typedef struct {
+    tx_parse_context_t tx;
+    const uint8_t *data;
+    size_t len;
+    // offset of the sighash_all data
+    size_t sighash_offset;
+    // offset and length of the chunk given to the decoder
+    size_t offset;
+    uint16_t chunk_len;
+    // offset of the element being decoded
+    size_t element_offset;
+    hathor_tx_report_t *report;
+} validation_t;
+
+// runs a step of the validation, returning the exception that ends it
+static unsigned short try_step(void (*step)(validation_t *), validation_t *v) {
+    volatile unsigned short result = 0;
+    BEGIN_TRY {
+        TRY {
+            step(v);
+        }
+        CATCH_OTHER(e) {
+            result = e;
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+    return result;
+}
+
+// adds a screen to the report, with its text paginated like on the device
+static void add_screen(hathor_tx_report_t *report, const char *title, const unsigned char *text, const uint8_t *field_ends, uint8_t fields) {
+    display_pages_t pages;
+    hathor_screen_t *screens, *screen;
+
+    if (paginate(text, field_ends, fields, MAX_SCREEN_LENGTH, &pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    screens = realloc(report->screens, (report->screens_len + 1) * sizeof(hathor_screen_t));
+    if (screens == NULL) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    report->screens = screens;
+    screen = &screens[report->screens_len++];
+
+    strcpy(screen->title, title);
+    os_memmove(screen->text, text, field_ends[fields - 1]);
+    screen->text[field_ends[fields - 1]] = '\0';
+    screen->pages_len = pages.count;
+    for (pages.current = 0; pages.current < pages.count; pages.current++) {
+        show_page(&pages, text, screen->pages[pages.current]);
+    }
+}
+
+// parses the change output info and the tx header
+static void start_validation(validation_t *v) {
+    uint8_t *data = (uint8_t*)v->data;
+    size_t offset;
+
+    tx_parse_init(&v->tx);
+    offset = tx_parse_change_info(&v->tx, data, v->len);
+    v->sighash_offset = offset;
+    v->element_offset = offset;
+    offset += tx_parse_header(&v->tx, data + offset, v->len - offset);
+    v->offset = offset;
+
+    v->report->version = v->tx.decoder->version;
+    v->report->has_change_output = v->tx.has_change_output;
+    v->report->change_output_index = v->tx.change_output_index;
+}
+
+// decodes the chunk, adding a screen for each element shown on the device, until
+// the decoder stops
+static void decode_chunk(validation_t *v) {
+    tx_parse_context_t *tx = &v->tx;
+    unsigned char text[80];
+    char title[18];
+    uint8_t field_ends[2];
+    uint8_t len;
+
+    for (;;) {
+        if (tx->buffer_len > 0) {
+            v->element_offset = v->offset - tx->buffer_len;
+        } else {
+            v->element_offset = v->offset + (tx->data - (v->data + v->offset));
+        }
+        tx_decode_element(tx);
+
+        switch (tx->elem_type) {
+            case ELEM_OUTPUT:
+                // the change output is not shown
+                if (tx->has_change_output && tx->change_output_index == tx->decoded_output.index) {
+                    break;
+                }
+                tx_format_output(tx, &tx->decoded_output, text, field_ends);
+                tx_format_output_title(tx, &tx->decoded_output, title);
+                add_screen(v->report, title, text, field_ends, 2);
+                break;
+            case ELEM_TOKEN_INFO:
+                len = tx_format_token_info(tx, text);
+                add_screen(v->report, "Create token", text, &len, 1);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// finishes a valid tx, with the data to be signed and the confirmation screen
+static void finish_validation(validation_t *v) {
+    uint8_t len = strlen("transaction?");
+
+    sha256d((uint8_t*)v->data + v->sighash_offset, v->len - v->sighash_offset, v->report->sighash);
+    add_screen(v->report, "Send", (const unsigned char*)"transaction?", &len, 1);
+}
+
+static hathor_tx_status_e reject(hathor_tx_report_t *report, unsigned short sw, size_t offset) {
+    report->status = HATHOR_TX_INVALID;
+    report->sw = sw;
+    report->error_offset = offset;
+    return report->status;
+}
+
+hathor_tx_status_e hathor_validate_tx(const uint8_t *data, size_t len, hathor_tx_report_t *report) {
+    validation_t v;
+    unsigned short result;
+
+    os_memset(report, 0, sizeof(hathor_tx_report_t));
+    os_memset(&v, 0, sizeof(validation_t));
+    v.data = data;
+    v.len = len;
+    v.report = report;
+
+    result = try_step(start_validation, &v);
+    if (result == TX_STATE_PARTIAL) {
+        report->status = HATHOR_TX_TRUNCATED;
+        report->error_offset = v.element_offset;
+        return report->status;
+    } else if (result != 0) {
+        return reject(report, result, v.element_offset);
+    }
+
+    for (;;) {
+        v.chunk_len = (len - v.offset > VALIDATION_CHUNK_LEN ? VALIDATION_CHUNK_LEN : len - v.offset);
+        tx_set_data(&v.tx, (uint8_t*)data + v.offset, v.chunk_len);
+        result = try_step(decode_chunk, &v);
+        if (result != TX_STATE_PARTIAL) {
+            break;
+        }
+        if (v.offset + v.chunk_len == len) {
+            report->status = HATHOR_TX_TRUNCATED;
+            report->error_offset = v.element_offset;
+            return report->status;
+        }
+        if (!tx_carry_partial_element(&v.tx)) {
+            return reject(report, SW_INVALID_PARAM, v.element_offset);
+        }
+        v.offset += v.chunk_len;
+    }
+
+    switch (result) {
+        case TX_STATE_FINISHED:
+            result = try_step(finish_validation, &v);
+            if (result != 0) {
+                return reject(report, result, len);
+            }
+            report->status = HATHOR_TX_VALID;
+            report->sw = SW_OK;
+            return report->status;
+        case TX_STATE_ERR:
+            // the device replies SW_INVALID_PARAM to an invalid tx
+            return reject(report, SW_INVALID_PARAM, v.element_offset);
+        default:
+            return reject(report, result, v.element_offset);
+    }
+}
+
+typedef struct {
+    const hathor_tx_input_t *inputs;
+    hathor_tx_report_t *reports;
+    size_t count;
+    // next tx to be validated, taken by whichever thread is free
+    size_t next;
+    size_t valid;
+} validation_pool_t;
+
+static void* validation_worker(void *arg) {
+    validation_pool_t *pool = arg;
+    size_t valid = 0;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->count) {
+        if (hathor_validate_tx(pool->inputs[i].data, pool->inputs[i].len, &pool->reports[i]) == HATHOR_TX_VALID) {
+            valid++;
+        }
+    }
+    __atomic_fetch_add(&pool->valid, valid, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+size_t hathor_validate_txs(const hathor_tx_input_t *inputs, hathor_tx_report_t *reports, size_t count, unsigned int threads) {
+    validation_pool_t pool = {inputs, reports, count, 0, 0};
+    pthread_t *workers;
+    unsigned int started = 0;
+    unsigned int i;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0 ? cpus : 1);
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    workers = calloc(threads, sizeof(pthread_t));
+    if (workers != NULL) {
+        for (; started < threads; started++) {
+            if (pthread_create(&workers[started], NULL, validation_worker, &pool) != 0) {
+                break;
+            }
+        }
+    }
+    // whatever the workers didn't take is validated on this thread
+    validation_worker(&pool);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    return pool.valid;
+}
+
+void hathor_report_free(hathor_tx_report_t *report) {
+    free(report->screens);
+    report->screens = NULL;
+    report->screens_len = 0;
+}
@@ -0,0 +1,299 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The address book command keeps a list of trusted destinations, each one with a
+ * short label. When a tx sends to one of them, the output is shown as a single screen
+ * with the label and value (eg. "Kraken hot / HTR 1,000.00"), instead of the address
+ * pages. It's kept on NVM, so it survives the app being closed.
+ *
+ * The book is a hash table of ADDRESS_BOOK_SLOTS slots with linear probing. A pubkey
+ * hash is already uniform, so its first bytes pick the home slot, and a lookup only
+ * reads the few slots until the destination or an empty one. It holds up to
+ * ADDRESS_BOOK_MAX_LEN destinations, so probes stay short. Removing a destination
+ * moves back the ones after it, so there are no deleted markers.
+ *
+ * Adding a destination (or changing its label) needs the user's approval, who sees
+ * the address and label. Removing one doesn't, as it can only make the app show more.
+ * Every response has the number of destinations on the book (2 bytes).
+ *
+ * | p1 | Data
+ * |----|------------------------------------
+ * | 0  | Script type (1 byte), hash (20 bytes), label (1 to ADDRESS_BOOK_LABEL_LEN printable chars): adds it
+ * | 1  | Script type (1 byte), hash (20 bytes): removes it
+ * | 2  | None, just the number of destinations
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include <string.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+#ifdef HATHOR_HOST
+// NVM is plain memory on the host
+address_book_t N_address_book_real;
+#else
+const address_book_t N_address_book_real;
+#endif
+#define N_address_book (*(volatile address_book_t *)PIC(&N_address_book_real))
+
+static address_book_context_t *ctx = &global.address_book_context;
+
+static uint16_t home_slot(const uint8_t *hash) {
+    return U2BE(hash, 0) & (ADDRESS_BOOK_SLOTS - 1);
+}
+
+static bool slot_is(uint16_t slot, uint8_t script_type, const uint8_t *hash) {
+    volatile address_book_entry_t *entry = &N_address_book.slots[slot];
+    uint8_t i;
+
+    if (entry->script_type != script_type) {
+        return false;
+    }
+    for (i = 0; i < 20; i++) {
+        if (entry->hash[i] != hash[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// slot of a destination or, if it's not on the book, the empty slot where it goes
+static uint16_t find_slot(uint8_t script_type, const uint8_t *hash) {
+    uint16_t slot = home_slot(hash);
+
+    // the book is never full, so there's always an empty slot
+    while (N_address_book.slots[slot].script_type != 0 && !slot_is(slot, script_type, hash)) {
+        slot = (slot + 1) & (ADDRESS_BOOK_SLOTS - 1);
+    }
+    return slot;
+}
+
+bool address_book_find(uint8_t script_type, const uint8_t *hash, char *label) {
+    uint16_t slot;
+    uint8_t i;
+
+    if (N_address_book.len == 0) {
+        return false;
+    }
+    slot = find_slot(script_type, hash);
+    if (N_address_book.slots[slot].script_type == 0) {
+        return false;
+    }
+    for (i = 0; i < ADDRESS_BOOK_LABEL_LEN && N_address_book.slots[slot].label[i] != '\0'; i++) {
+        label[i] = N_address_book.slots[slot].label[i];
+    }
+    label[i] = '\0';
+    return true;
+}
+
+// adds the destination on the context or replaces its label. The handler already
+// checked there's room for it
+static void add_entry() {
+    uint16_t slot = find_slot(ctx->entry.script_type, ctx->entry.hash);
+    uint16_t len = N_address_book.len + 1;
+    bool is_new = (N_address_book.slots[slot].script_type == 0);
+
+    nvm_write((void *)&N_address_book.slots[slot], &ctx->entry, sizeof(address_book_entry_t));
+    if (is_new) {
+        nvm_write((void *)&N_address_book.len, &len, sizeof(len));
+    }
+}
+
+// removes the destination on a slot. The following ones that can't be reached past
+// the empty slot are moved back into it (backward shift deletion)
+static void remove_entry(uint16_t slot) {
+    address_book_entry_t entry;
+    uint16_t next = slot;
+    uint16_t home;
+    uint16_t len = N_address_book.len - 1;
+
+    for (;;) {
+        next = (next + 1) & (ADDRESS_BOOK_SLOTS - 1);
+        if (N_address_book.slots[next].script_type == 0) {
+            break;
+        }
+        // an entry may go back to the empty slot if its home isn't between them
+        home = home_slot((const uint8_t *)N_address_book.slots[next].hash);
+        if (((next - home) & (ADDRESS_BOOK_SLOTS - 1)) >= ((next - slot) & (ADDRESS_BOOK_SLOTS - 1))) {
+            os_memmove(&entry, (const void *)&N_address_book.slots[next], sizeof(entry));
+            nvm_write((void *)&N_address_book.slots[slot], &entry, sizeof(entry));
+            slot = next;
+        }
+    }
+    nvm_write((void *)&N_address_book.slots[slot], NULL, sizeof(address_book_entry_t));
+    nvm_write((void *)&N_address_book.len, &len, sizeof(len));
+}
+
+static void send_len() {
+    G_io_apdu_buffer[0] = N_address_book.len >> 8;
+    G_io_apdu_buffer[1] = N_address_book.len & 0xFF;
+    io_exchange_with_code(SW_OK, 2);
+}
+
+static const bagl_element_t* ui_prepro_addressBook_confirm(const bagl_element_t *element) {
+    return element;
+}
+
+// Define the confirmation screen, shown after the address and label
+static const bagl_element_t ui_addressBook_confirm[] = {
+    UI_BACKGROUND(),
+
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x01, BAGL_GLYPH_ICON_CHECK),
+
+    UI_TEXT(0x00, 0, 12, 128, "Add to"),
+    UI_TEXT(0x00, 0, 26, 128, "address book?"),
+};
+
+// This is the button handler for the confirmation screen
+static unsigned int ui_addressBook_confirm_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // cancel
+            io_exchange_with_code(SW_USER_REJECTED, 0);
+            // Return to the main screen.
+            ui_idle();
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // confirm
+            add_entry();
+            send_len();
+            ui_idle();
+            break;
+    }
+    return 0;
+}
+
+// Define the address screen, eg:
+//
+//   Trust address
+//   HHVnn9mr8yPR / eovgt7AoeJRg / S5QoXMa5fo / Kraken hot
+//
+// The user goes through the pages with left/right buttons and clicks both buttons
+// to see the confirmation screen.
+static const bagl_element_t ui_addressBook_compare[] = {
+    UI_BACKGROUND(),
+
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
+
+    UI_TEXT(0x00, 0, 12, 128, "Trust address"),
+    UI_TEXT(0x00, 0, 26, 128, global.address_book_context.line2),
+};
+
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
+static const bagl_element_t* ui_prepro_addressBook_compare(const bagl_element_t *element) {
+    switch (element->component.userid) {
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
+    default:
+        // Always display all other elements.
+        return element;
+    }
+}
+
+// This is the button handler for the address screen.
+static unsigned int ui_addressBook_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+                ctx->pages.current--;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+                ctx->pages.current++;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // PROCEED TO CONFIRMATION
+            UX_DISPLAY(ui_addressBook_confirm, ui_prepro_addressBook_confirm);
+            break;
+    }
+    return 0;
+}
+
+// reads the script type and hash of a destination
+static void read_destination(uint8_t *dataBuffer, uint16_t dataLength) {
+    if (dataLength < 21 || (dataBuffer[0] != SCRIPT_P2PKH && dataBuffer[0] != SCRIPT_P2SH)) {
+        THROW(SW_INVALID_PARAM);
+    }
+    os_memset(&ctx->entry, 0, sizeof(address_book_entry_t));
+    ctx->entry.script_type = dataBuffer[0];
+    os_memmove(ctx->entry.hash, dataBuffer + 1, 20);
+}
+
+/**
+ * handleAddressBook is the entry point for the address book command. It adds a
+ * destination, after the user authorizes it, removes one or tells how many there are.
+ */
+void handleAddressBook(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+    uint8_t field_ends[2];
+    uint16_t slot;
+    uint8_t i;
+
+    if (p1 == 2) {
+        send_len();
+        return;
+    }
+
+    if (p1 == 1) {
+        read_destination(dataBuffer, dataLength);
+        if (dataLength != 21) {
+            THROW(SW_INVALID_PARAM);
+        }
+        slot = find_slot(ctx->entry.script_type, ctx->entry.hash);
+        if (N_address_book.slots[slot].script_type != 0) {
+            remove_entry(slot);
+        }
+        send_len();
+        return;
+    }
+
+    if (p1 != 0) {
+        THROW(SW_INVALID_PARAM);
+    }
+    read_destination(dataBuffer, dataLength);
+    if (dataLength <= 21 || dataLength > 21 + ADDRESS_BOOK_LABEL_LEN) {
+        THROW(SW_INVALID_PARAM);
+    }
+    for (i = 21; i < dataLength; i++) {
+        if (dataBuffer[i] < 0x20 || dataBuffer[i] > 0x7E) {
+            THROW(SW_INVALID_PARAM);
+        }
+        ctx->entry.label[i - 21] = dataBuffer[i];
+    }
+    slot = find_slot(ctx->entry.script_type, ctx->entry.hash);
+    if (N_address_book.slots[slot].script_type == 0 && N_address_book.len >= ADDRESS_BOOK_MAX_LEN) {
+        // the book is full
+        THROW(SW_INVALID_PARAM);
+    }
+
+    field_ends[0] = tx_format_address(ctx->entry.script_type, ctx->entry.hash, ctx->info, sizeof(ctx->info));
+    os_memmove(ctx->info + field_ends[0], ctx->entry.label, dataLength - 21);
+    field_ends[1] = field_ends[0] + dataLength - 21;
+    if (paginate(ctx->info, field_ends, 2, MAX_SCREEN_LENGTH, &ctx->pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    show_page(&ctx->pages, ctx->info, ctx->line2);
+    UX_DISPLAY(ui_addressBook_compare, ui_prepro_addressBook_compare);
+    *flags |= IO_ASYNCH_REPLY;
+}
@@ -0,0 +1,274 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The find keys command tells which key indexes (44'/280'/0'/0/index) own a set of
+ * pubkey hashes, so a wallet being recovered doesn't need one get address per index.
+ * The request has the range of indexes to check and up to MAX_LOOKUP_HASHES hashes:
+ *   [first_index (4 bytes), count (4 bytes), pubkey_hash (20 bytes) * n]
+ *
+ * The user sees the number of hashes and the range, and a single approval is needed
+ * for all of it. The keys are derived in order, so each one is a single step from
+ * their parent on the derivation cache. Indexes on the own keys filter (see
+ * ownFilter.c) are skipped without a derivation if the filter doesn't have any of the
+ * hashes for them, unless it was built with other keys. As deriving a key takes a
+ * while, each response only derives up to LOOKUP_KEYS_PER_RESPONSE keys:
+ *   [next_index (4 bytes), matches (1 byte), (pubkey_hash (20 bytes), index (4 bytes)) * matches]
+ *
+ * The wallet asks for the rest of the range with p1 = 1, until next_index reaches
+ * first_index + count. The user may abort the lookup meanwhile, and then p1 = 1 fails.
+ *
+ * | p1 | Data
+ * |----|------------------------------------
+ * | 0  | First index, count and pubkey hashes
+ * | 1  | None, continue checking the range
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include <string.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+// keys derived for each response
+#define LOOKUP_KEYS_PER_RESPONSE 20
+// pubkey hash + key index
+#define LOOKUP_MATCH_LEN (20 + 4)
+
+static find_keys_context_t *ctx = &global.find_keys_context;
+
+// writes a 4-byte big endian integer
+static void write_u32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// tells whether a key index may have any of the hashes. The indexes on the own keys
+// filter are only derived if the filter may have one of them
+static bool may_match(uint32_t index) {
+    uint8_t i;
+    if (!ctx->use_filter) {
+        return true;
+    }
+    for (i = 0; i < ctx->hashes_len; i++) {
+        if (own_filter_may_have(ctx->hashes[i], index)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// checks the next indexes of the range and sends the matches. Returns to the main
+// screen after the last one
+static void send_matches() {
+    uint8_t hash[20];
+    uint8_t *matches;
+    uint8_t derived, i;
+    // tx is the offset within G_io_apdu_buffer
+    uint16_t tx = 5;
+
+    *(matches = G_io_apdu_buffer + 4) = 0;
+    for (derived = 0; derived < LOOKUP_KEYS_PER_RESPONSE && ctx->remaining > 0; ctx->next_index++, ctx->remaining--) {
+        if (!may_match(ctx->next_index)) {
+            continue;
+        }
+        if (tx > sizeof(G_io_apdu_buffer) - 2 - LOOKUP_MATCH_LEN) {
+            // no room for another match, so it has to wait for the next response
+            break;
+        }
+        key_index_pubkey_hash(ctx->next_index, hash);
+        derived++;
+        for (i = 0; i < ctx->hashes_len; i++) {
+            if (os_memcmp(hash, ctx->hashes[i], 20) == 0) {
+                os_memmove(G_io_apdu_buffer + tx, hash, 20);
+                write_u32(G_io_apdu_buffer + tx + 20, ctx->next_index);
+                tx += LOOKUP_MATCH_LEN;
+                (*matches)++;
+                break;
+            }
+        }
+    }
+    write_u32(G_io_apdu_buffer, ctx->next_index);
+    io_exchange_with_code(SW_OK, tx);
+
+    if (ctx->remaining == 0) {
+        // Return to the main screen.
+        ui_idle();
+    }
+}
+
+// Define the approval screen, shown after the range. The left button aborts the
+// lookup while the wallet checks the rest of the range.
+static const bagl_element_t ui_findKeys_approve[] = {
+    UI_BACKGROUND(),
+
+    // Rejection/approval icons, represented by a cross and a check mark,
+    // respectively.
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x02, BAGL_GLYPH_ICON_CHECK),
+
+    UI_TEXT(0x00, 0, 12, 128, global.find_keys_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.find_keys_context.line2),
+};
+
+static const bagl_element_t* ui_prepro_findKeys_approve(const bagl_element_t *element) {
+    if (element->component.userid == 0x02 && ctx->approved) {
+        // don't display the check mark after user approves, while checking the range
+        return NULL;
+    } else {
+        return element;
+    }
+}
+
+// This is the button handler for the approval screen
+static unsigned int ui_findKeys_approve_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+    case BUTTON_EVT_RELEASED | BUTTON_LEFT: // REJECT
+        if (!ctx->approved) {
+            io_exchange_with_code(SW_USER_REJECTED, 0);
+        }
+        // Return to the main screen. If the wallet was still checking the range,
+        // the lookup is aborted
+        ui_idle();
+        break;
+
+    case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // APPROVE
+        if (ctx->approved) {
+            // still checking the range. Just ignore it.
+            break;
+        }
+        ctx->approved = true;
+        strcpy(ctx->line1, "Processing");
+        strcpy(ctx->line2, "...");
+        send_matches();
+        if (ctx->approved) {
+            // there are more indexes to check
+            UX_REDISPLAY();
+        }
+        break;
+    }
+    return 0;
+}
+
+// Define the range screen, eg:
+//
+//   Look up keys
+//   3 addresses / 1000 keys / from index 0
+//
+// The user goes through the pages with left/right buttons and clicks both buttons
+// to see the approval screen.
+static const bagl_element_t ui_findKeys_compare[] = {
+    UI_BACKGROUND(),
+
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
+
+    UI_TEXT(0x00, 0, 12, 128, global.find_keys_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.find_keys_context.line2),
+};
+
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
+static const bagl_element_t* ui_prepro_findKeys_compare(const bagl_element_t *element) {
+    switch (element->component.userid) {
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
+    default:
+        // Always display all other elements.
+        return element;
+    }
+}
+
+// This is the button handler for the range screen.
+static unsigned int ui_findKeys_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+                ctx->pages.current--;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+                ctx->pages.current++;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // PROCEED TO APPROVAL
+            strcpy(ctx->line1, "Look up");
+            strcpy(ctx->line2, "keys?");
+            UX_DISPLAY(ui_findKeys_approve, ui_prepro_findKeys_approve);
+            break;
+    }
+    return 0;
+}
+
+/**
+ * handleFindKeys is the entry point for the find keys command. It checks a range
+ * of key indexes for the given pubkey hashes, after the user authorizes it.
+ */
+void handleFindKeys(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+    uint8_t field_ends[3];
+    uint8_t len;
+
+    if (p1 == 1) {
+        // continue checking the range
+        if (!ctx->approved) {
+            io_exchange_with_code(SW_DEVELOPER_ERR, 0);
+            ui_idle();
+            return;
+        }
+        send_matches();
+        return;
+    }
+
+    if (dataLength < 8 + 20 || (dataLength - 8) % 20 != 0 || (dataLength - 8) / 20 > MAX_LOOKUP_HASHES) {
+        THROW(SW_INVALID_PARAM);
+    }
+    ctx->approved = false;
+    ctx->next_index = U4BE(dataBuffer, 0);
+    ctx->remaining = U4BE(dataBuffer, 4);
+    // only non-hardened indexes
+    if (ctx->remaining == 0 || ctx->next_index >= 0x80000000 || ctx->remaining > 0x80000000 - ctx->next_index) {
+        THROW(SW_INVALID_PARAM);
+    }
+    ctx->hashes_len = (dataLength - 8) / 20;
+    os_memmove(ctx->hashes, dataBuffer + 8, dataLength - 8);
+    // a filter built with other keys (eg. another passphrase) would hide our keys
+    ctx->use_filter = own_filter_has_current_keys();
+
+    // the hashes and the range, eg. "3 addresses / 1000 keys / from index 0"
+    strcpy(ctx->line1, "Look up keys");
+    len = itoa(ctx->hashes_len, (char*)ctx->info, 10);
+    len += strcpy_len((char*)ctx->info + len, ctx->hashes_len == 1 ? " address" : " addresses");
+    field_ends[0] = len;
+    len += utoa(ctx->remaining, (char*)ctx->info + len);
+    len += strcpy_len((char*)ctx->info + len, ctx->remaining == 1 ? " key" : " keys");
+    field_ends[1] = len;
+    len += strcpy_len((char*)ctx->info + len, "from index ");
+    len += itoa(ctx->next_index, (char*)ctx->info + len, 10);
+    field_ends[2] = len;
+    if (paginate(ctx->info, field_ends, 3, MAX_SCREEN_LENGTH, &ctx->pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    show_page(&ctx->pages, ctx->info, ctx->line2);
+    UX_DISPLAY(ui_findKeys_compare, ui_prepro_findKeys_compare);
+    *flags |= IO_ASYNCH_REPLY;
+}
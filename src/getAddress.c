@@ -12,34 +12,33 @@
 #include <string.h>
 #include "hathor.h"
 #include "util.h"
+#include "tx_decoder.h"
 #include "ux.h"
 
 static get_address_context_t *ctx = &global.get_address_context;
 
 // Define the comparison screen. This is where the user will compare the address on
-// their device to the one shown on the computer. There are lef/right buttons on the
-// screen to navigate the hash. Clicking both buttons goes back to main screen.
+// their device to the one shown on the computer. The address is split in pages and
+// the left/right buttons go through them. Clicking both buttons goes back to main screen.
 static const bagl_element_t ui_getAddress_compare[] = {
     UI_BACKGROUND(),
 
-    // Left and right buttons for scrolling the text.
-    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_LEFT),
-    UI_ICON_RIGHT(0x02, BAGL_GLYPH_ICON_RIGHT),
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
 
     UI_TEXT(0x00, 0, 12, 128, "Address:"),
     UI_TEXT(0x00, 0, 26, 128, global.get_address_context.partialAddress),
 };
 
-// Preprocessor for this screen. Hides left or right arrows depending on the
-// scrolling position.
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
 static const bagl_element_t* ui_prepro_getAddress_compare(const bagl_element_t *element) {
     switch (element->component.userid) {
-    case 1:
-        // 0x01 is the left icon so return NULL if we're displaying the beginning of the text.
-        return (ctx->displayIndex == 0) ? NULL : element;
-    case 2:
-        // 0x02 is the right, so return NULL if we're displaying the end of the text.
-        return (ctx->displayIndex == sizeof(ctx->b58_address) - MAX_SCREEN_LENGTH) ? NULL : element;
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
     default:
         // Always display all other elements.
         return element;
@@ -49,25 +48,20 @@ static const bagl_element_t* ui_prepro_getAddress_compare(const bagl_element_t *
 // This is the button handler for the comparison screen.
 static unsigned int ui_getAddress_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
     switch (button_mask) {
-    // scroll left by either clicking or pressing the left button
-    case BUTTON_LEFT:
-    case BUTTON_EVT_FAST | BUTTON_LEFT: // SEEK LEFT
-        // Decrement the displayIndex when the left button is pressed (or held).
-        if (ctx->displayIndex > 0) {
-            ctx->displayIndex--;
+    case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+        if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+            ctx->pages.current--;
+            show_page(&ctx->pages, ctx->b58_address, (char*)ctx->partialAddress);
+            UX_REDISPLAY();
         }
-        os_memmove(ctx->partialAddress, ctx->b58_address+ctx->displayIndex, MAX_SCREEN_LENGTH);
-        UX_REDISPLAY();
         break;
 
-    // scroll right by either clicking or pressing the right button
-    case BUTTON_RIGHT:
-    case BUTTON_EVT_FAST | BUTTON_RIGHT: // SEEK RIGHT
-        if (ctx->displayIndex < sizeof(ctx->b58_address) - MAX_SCREEN_LENGTH) {
-            ctx->displayIndex++;
+    case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+        if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+            ctx->pages.current++;
+            show_page(&ctx->pages, ctx->b58_address, (char*)ctx->partialAddress);
+            UX_REDISPLAY();
         }
-        os_memmove(ctx->partialAddress, ctx->b58_address+ctx->displayIndex, MAX_SCREEN_LENGTH);
-        UX_REDISPLAY();
         break;
 
     case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // PROCEED
@@ -79,21 +73,28 @@ static unsigned int ui_getAddress_compare_button(unsigned int button_mask, unsig
     return 0;
 }
 
+// handleGetAddress displays the address for a key. The key is given either by its
+// index (4 bytes), for path 44'/280'/0'/0/key_index, or by its full bip32 path as
+// [path_len (1 byte), index (4 bytes) * path_len].
 void handleGetAddress(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
-    // Read the index of the signing key. U4BE is a helper macro for
-    // converting a 4-byte buffer to a uint32_t.
-    uint32_t key_index = U4BE(dataBuffer, 0);
-
-    cx_ecfp_public_key_t public_key;
-    cx_ecfp_private_key_t private_key;
+    crypto_scratch_t *scratch;
+    uint32_t path[MAX_BIP32_PATH];
+    uint8_t path_len;
     uint8_t bin_address[25];
 
-    // get key pair for path 44'/280'/0'/0/key_index
-    derive_keypair(&private_key, &public_key, NULL, 2, 0, key_index);
-    pubkey_to_address(&public_key, bin_address);
-    // erase sensitive data
-    explicit_bzero(&private_key, sizeof(private_key));
-    explicit_bzero(&public_key, sizeof(public_key));
+    if (dataLength == 4) {
+        // Read the index of the signing key. U4BE is a helper macro for
+        // converting a 4-byte buffer to a uint32_t.
+        path_len = key_index_path(U4BE(dataBuffer, 0), path);
+    } else {
+        read_bip32_path(dataBuffer, dataLength, path, &path_len);
+    }
+
+    scratch = scratch_acquire();
+    derive_keypair(&scratch->keys.private_key, &scratch->keys.public_key, NULL, path, path_len);
+    pubkey_to_address(&scratch->keys.public_key, bin_address);
+    // erases the keys
+    scratch_release();
 
     // convert to base58
     if (encode_base58(bin_address, sizeof(bin_address), ctx->b58_address, sizeof(ctx->b58_address)) == -1) {
@@ -101,10 +102,10 @@ void handleGetAddress(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t data
         THROW(SW_DEVELOPER_ERR);
     }
 
-    // move the first 12 characters into the partialAddress buffer.
-    os_memmove(ctx->partialAddress, ctx->b58_address, MAX_SCREEN_LENGTH);
-    ctx->partialAddress[MAX_SCREEN_LENGTH] = '\0';
-    ctx->displayIndex = 0;
+    // split the address in pages and show the first one
+    uint8_t address_len = sizeof(ctx->b58_address);
+    paginate(ctx->b58_address, &address_len, 1, MAX_SCREEN_LENGTH, &ctx->pages);
+    show_page(&ctx->pages, ctx->b58_address, (char*)ctx->partialAddress);
 
     UX_DISPLAY(ui_getAddress_compare, ui_prepro_getAddress_compare);
     *flags |= IO_ASYNCH_REPLY;
@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The get capabilities command tells the wallet which protocol features this
+ * version of the app supports and how much it can handle in each request, so it
+ * doesn't have to probe with trial APDUs. The response is:
+ *
+ *   [format_version (1 byte), features (4 bytes), max_signatures (4 bytes),
+ *    max_xpubs (1 byte), decode_buffer_len (2 bytes), cached_nodes (1 byte),
+ *    (path_len (1 byte), index (4 bytes) * path_len) * cached_nodes,
+ *    max_batch_txs (1 byte), max_lookup_hashes (1 byte)]
+ *
+ *   . features: bitmap of FEATURE_* flags below;
+ *   . max_signatures: maximum keys in a single sign tx or sign message request
+ *     (p1 = 1), for p2 = 0x00, 0x01, 0x02 and 0x03, in this order;
+ *   . max_xpubs: maximum accounts in a single get xpub response;
+ *   . decode_buffer_len: size of the largest tx element (input, output, token
+ *     info) accepted. Only an element split across packets is buffered;
+ *   . cached_nodes: bip32 nodes currently on the derivation cache. Keys that are
+ *     children of these nodes are derived in a single step;
+ *   . max_batch_txs: maximum txs in a sign tx batch (p1 = 4);
+ *   . max_lookup_hashes: maximum pubkey hashes in a find keys request.
+ *
+ * New fields are only appended, so older wallets can still read the response.
+ * format_version changes if any existing field changes meaning.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+#define CAPABILITIES_FORMAT_VERSION 1
+
+// features supported by this app
+#define FEATURE_BIP32_PATHS         (1 << 0)    // keys may be given by their full bip32 path
+#define FEATURE_MULTI_KEY_SIGN      (1 << 1)    // several keys on each sign tx request
+#define FEATURE_COMPACT_SIGNATURE   (1 << 2)    // sign tx p2 = 0x01
+#define FEATURE_SIGNATURE_PUBKEY    (1 << 3)    // sign tx p2 = 0x02
+#define FEATURE_XPUB_RANGE          (1 << 4)    // get xpub for a range of accounts
+#define FEATURE_MULTISIG            (1 << 5)    // P2SH outputs and redeem script registration
+#define FEATURE_TOKEN_CREATION      (1 << 6)    // token creation txs (version 2)
+#define FEATURE_AUTHORITY_OUTPUTS   (1 << 7)    // mint/melt authority outputs
+#define FEATURE_DERIVATION_CACHE    (1 << 8)    // derivation cache, reported on cached_nodes
+#define FEATURE_BATCH_SIGN          (1 << 9)    // sign tx batches, with a single review
+#define FEATURE_SIGN_MESSAGE        (1 << 10)   // sign message command
+#define FEATURE_FIND_KEYS           (1 << 11)   // find keys command
+#define FEATURE_OWN_FILTER          (1 << 12)   // own filter command and CHANGE_INFO_FILTER
+#define FEATURE_ADDRESS_BOOK        (1 << 13)   // address book command and labelled outputs
+#define FEATURE_PAYOUT_TEMPLATE     (1 << 14)   // payout template command and sign tx p1 = 5
+
+#define FEATURES (FEATURE_BIP32_PATHS | FEATURE_MULTI_KEY_SIGN | FEATURE_COMPACT_SIGNATURE \
+                  | FEATURE_SIGNATURE_PUBKEY | FEATURE_XPUB_RANGE | FEATURE_MULTISIG \
+                  | FEATURE_TOKEN_CREATION | FEATURE_AUTHORITY_OUTPUTS | FEATURE_DERIVATION_CACHE \
+                  | FEATURE_BATCH_SIGN | FEATURE_SIGN_MESSAGE | FEATURE_FIND_KEYS | FEATURE_OWN_FILTER \
+                  | FEATURE_ADDRESS_BOOK | FEATURE_PAYOUT_TEMPLATE)
+
+// handleGetCapabilities is the entry point for the getCapabilities command. It
+// unconditionally sends the capabilities of the app.
+void handleGetCapabilities(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+    uint16_t offset = 0;
+    uint8_t *count;
+    uint8_t i, j;
+
+    G_io_apdu_buffer[offset++] = CAPABILITIES_FORMAT_VERSION;
+    G_io_apdu_buffer[offset++] = (FEATURES >> 24) & 0xFF;
+    G_io_apdu_buffer[offset++] = (FEATURES >> 16) & 0xFF;
+    G_io_apdu_buffer[offset++] = (FEATURES >> 8) & 0xFF;
+    G_io_apdu_buffer[offset++] = FEATURES & 0xFF;
+    // all combinations of the compact (0x01) and public key (0x02) flags
+    for (i = 0; i < 4; i++) {
+        G_io_apdu_buffer[offset++] = max_signatures(i);
+    }
+    G_io_apdu_buffer[offset++] = get_xpub_max_accounts();
+    G_io_apdu_buffer[offset++] = MAX_TX_ELEMENT_LEN >> 8;
+    G_io_apdu_buffer[offset++] = MAX_TX_ELEMENT_LEN & 0xFF;
+
+    count = G_io_apdu_buffer + offset++;
+    *count = 0;
+    for (i = 0; i < BIP32_CACHE_SIZE; i++) {
+        const bip32_node_t *node = &session.bip32_cache[i];
+        if (node->path_len == 0) {
+            continue;
+        }
+        G_io_apdu_buffer[offset++] = node->path_len;
+        for (j = 0; j < node->path_len; j++) {
+            G_io_apdu_buffer[offset++] = node->path[j] >> 24;
+            G_io_apdu_buffer[offset++] = node->path[j] >> 16;
+            G_io_apdu_buffer[offset++] = node->path[j] >> 8;
+            G_io_apdu_buffer[offset++] = node->path[j];
+        }
+        (*count)++;
+    }
+    G_io_apdu_buffer[offset++] = MAX_BATCH_TXS;
+    G_io_apdu_buffer[offset++] = MAX_LOOKUP_HASHES;
+    io_exchange_with_code(SW_OK, offset);
+}
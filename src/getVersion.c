@@ -10,6 +10,8 @@
 #include <os.h>
 #include <os_io_seproxyhal.h>
 #include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
 #include "ux.h"
 
 // handleGetVersion is the entry point for the getVersion command. It
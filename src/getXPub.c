@@ -5,88 +5,270 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+/*
+ * The get xpub command returns the elements to build the xpub for 44'/280'/account'/0,
+ * after the user authorizes it. For each account, we send:
+ *   [public key (65 bytes, uncompressed), chain code (32 bytes), parent fingerprint (4 bytes)]
+ *
+ * The parent fingerprint is the first 4 bytes of the hash160 of the account's public
+ * key (44'/280'/account').
+ *
+ * Without any data, only account 0 is exported. The wallet may also ask for a range
+ * of accounts with [first_account (4 bytes), count (1 byte)]. The user sees the range
+ * and a single approval is needed for all of it. As many accounts as fit are sent in
+ * each response and the wallet gets the remaining ones with p1 = 1, until all have
+ * been sent. Each response derives its accounts from the 44'/280' node on the
+ * derivation cache, so no key is kept on the context while the wallet asks for the
+ * next ones. The user may abort the export meanwhile, and then p1 = 1 fails.
+ *
+ * | p1 | Data
+ * |----|------------------------------------
+ * | 0  | None or first account (4 bytes) and count (1 byte)
+ * | 1  | None, continue sending the range
+ */
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <os.h>
 #include <os_io_seproxyhal.h>
 #include <string.h>
 #include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
 #include "ux.h"
 
+// public key + chain code + parent fingerprint
+#define XPUB_LEN (65 + 32 + 4)
+
+static get_xpub_context_t *ctx = &global.get_xpub_context;
+
+/*
+ * Exports the xpub elements for 44'/280'/account'/0. The account node is a hardened
+ * child of 44'/280', which is on the derivation cache, and we only need one more
+ * non-hardened derivation for the change chain. Returns the size written to out.
+ */
+static uint16_t export_account(uint32_t account, uint8_t *out) {
+    crypto_scratch_t *scratch = scratch_acquire();
+    cx_ecfp_private_key_t *private_key = &scratch->keys.private_key;
+    cx_ecfp_public_key_t *public_key = &scratch->keys.public_key;
+    uint32_t path[3];
+    uint8_t hash_160[20];
+
+    // 44'/280'/account'. Its chain code goes where the xpub's does, until it's replaced
+    // by its child's
+    os_memmove(path, htr_bip44, BIP44_PREFIX_LEN * sizeof(uint32_t));
+    path[2] = account | 0x80000000;
+    derive_keypair(private_key, public_key, out + 65, path, 3);
+    compress_public_key(public_key->W);
+    // parent fingerprint is only first 4 bytes of hash
+    hash160(public_key->W, 33, hash_160);
+
+    // 44'/280'/account'/0
+    os_memmove(scratch->keys.private_component, private_key->d, 32);
+    os_memmove(scratch->keys.chain_code, out + 65, 32);
+    bip32_derive_child(scratch->keys.private_component, scratch->keys.chain_code, public_key->W, 0);
+    cx_ecdsa_init_private_key(CX_CURVE_256K1, scratch->keys.private_component, 32, private_key);
+    cx_ecfp_generate_pair(CX_CURVE_256K1, public_key, private_key, 1);
+
+    memcpy(out, public_key->W, public_key->W_len);
+    memcpy(out + 65, scratch->keys.chain_code, 32);
+    memcpy(out + 65 + 32, hash_160, 4);
+
+    // erases the keys
+    scratch_release();
+    return XPUB_LEN;
+}
+
+uint8_t get_xpub_max_accounts(void) {
+    return (sizeof(G_io_apdu_buffer) - 2) / XPUB_LEN;
+}
+
+// sends as many of the remaining accounts as fit in a response. Returns to the main
+// screen after the last one
+static void send_xpubs() {
+    // tx is the offset within G_io_apdu_buffer
+    uint16_t tx = 0;
+
+    while (ctx->remaining > 0 && tx <= sizeof(G_io_apdu_buffer) - 2 - XPUB_LEN) {
+        tx += export_account(ctx->account, G_io_apdu_buffer + tx);
+        ctx->account++;
+        ctx->remaining--;
+    }
+    io_exchange_with_code(SW_OK, tx);
+
+    if (ctx->remaining == 0) {
+        // Return to the main screen.
+        ui_idle();
+    }
+}
+
 // Define the approval screen. This is where the user will confirm that they
-// want to authorize access from the desktop wallet.
+// want to authorize access from the desktop wallet, after seeing the accounts.
+// The left button aborts the export while the wallet gets the remaining accounts.
 static const bagl_element_t ui_getXPub_approve[] = {
     UI_BACKGROUND(),
 
     // Rejection/approval icons, represented by a cross and a check mark,
     // respectively.
-    UI_ICON_LEFT(0x00, BAGL_GLYPH_ICON_CROSS),
-    UI_ICON_RIGHT(0x00, BAGL_GLYPH_ICON_CHECK),
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x02, BAGL_GLYPH_ICON_CHECK),
 
     // The two lines of text, which together form a complete sentence:
     //
     //    Authorize
     //    access?
     //
-    UI_TEXT(0x00, 0, 12, 128, "Authorize"),
-    UI_TEXT(0x00, 0, 26, 128, "access?"),
+    UI_TEXT(0x00, 0, 12, 128, global.get_xpub_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.get_xpub_context.line2),
 };
 
+static const bagl_element_t* ui_prepro_getXPub_approve(const bagl_element_t *element) {
+    if (element->component.userid == 0x02 && ctx->approved) {
+        // don't display the check mark after user approves, while sending a range of
+        // accounts
+        return NULL;
+    } else {
+        return element;
+    }
+}
+
 // This is the button handler for the approval screen
 static unsigned int ui_getXPub_approve_button(unsigned int button_mask, unsigned int button_mask_counter) {
-    // tx is the offset within G_io_apdu_buffer
-    uint16_t tx = 0;
-    cx_ecfp_public_key_t public_key;
-    cx_ecfp_private_key_t private_key;
-    unsigned char chain_code[32];
-    unsigned char hash_160[20];
-
     switch (button_mask) {
     case BUTTON_EVT_RELEASED | BUTTON_LEFT: // REJECT
-        // Send an error code to the computer. The application on the computer
-        // should recognize this code and display a "user refused" message
-        // instead of a generic error.
-        io_exchange_with_code(SW_USER_REJECTED, 0);
-        // Return to the main screen.
+        if (!ctx->approved) {
+            // Send an error code to the computer. The application on the computer
+            // should recognize this code and display a "user refused" message
+            // instead of a generic error.
+            io_exchange_with_code(SW_USER_REJECTED, 0);
+        }
+        // Return to the main screen. If the wallet was still getting the accounts,
+        // the export is aborted
         ui_idle();
         break;
 
     case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // APPROVE
-        // get key pair for path 44'/280'/0'/0
-        derive_keypair(&private_key, &public_key, chain_code, 1, 0);
-        memcpy(G_io_apdu_buffer + tx, public_key.W, public_key.W_len);
-        tx += public_key.W_len;
-        memcpy(G_io_apdu_buffer + tx, chain_code, 32);
-        tx += 32;
-
-        // get parent fingerprint
-        derive_keypair(&private_key, &public_key, NULL, 0);
-        compress_public_key(public_key.W);
-        hash160(public_key.W, 33, hash_160);
-        // fingerprint is only first 4 bytes of hash
-        memcpy(G_io_apdu_buffer + tx, hash_160, 4);
-        tx += 4;
-
-        // erase sensitive data
-        explicit_bzero(&private_key, sizeof(private_key));
-        explicit_bzero(&public_key, sizeof(public_key));
-        explicit_bzero(chain_code, 32);
-
-        // Send user approved
-        io_exchange_with_code(SW_OK, tx);
-
-        // Return to the main screen.
-        ui_idle();
+        if (ctx->approved) {
+            // still sending the accounts. Just ignore it.
+            break;
+        }
+        ctx->approved = true;
+        send_xpubs();
+        if (ctx->approved) {
+            // there are more accounts to send
+            strcpy(ctx->line1, "Processing");
+            strcpy(ctx->line2, "...");
+            UX_REDISPLAY();
+        }
         break;
     }
     return 0;
 }
 
+// Define the accounts screen, eg:
+//
+//   Accounts
+//   0 - 9
+//
+// The user goes through the pages with left/right buttons and clicks both buttons
+// to see the approval screen.
+static const bagl_element_t ui_getXPub_compare[] = {
+    UI_BACKGROUND(),
+
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
+
+    UI_TEXT(0x00, 0, 12, 128, global.get_xpub_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.get_xpub_context.line2),
+};
+
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
+static const bagl_element_t* ui_prepro_getXPub_compare(const bagl_element_t *element) {
+    switch (element->component.userid) {
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
+    default:
+        // Always display all other elements.
+        return element;
+    }
+}
+
+// This is the button handler for the accounts screen.
+static unsigned int ui_getXPub_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+                ctx->pages.current--;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+                ctx->pages.current++;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // PROCEED TO APPROVAL
+            strcpy(ctx->line1, "Authorize");
+            strcpy(ctx->line2, "access?");
+            UX_DISPLAY(ui_getXPub_approve, ui_prepro_getXPub_approve);
+            break;
+    }
+    return 0;
+}
+
 /**
  * handleGetXPub is the entry point for this screen. It returns all elements necessary
  * to create the xpub key: public key (uncompressed), chain code and parent fingerprint.
  */
 void handleGetXPub(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
-    UX_DISPLAY(ui_getXPub_approve, NULL);
+    uint8_t len;
+
+    if (p1 == 1) {
+        // continue sending the range of accounts
+        if (!ctx->approved) {
+            io_exchange_with_code(SW_DEVELOPER_ERR, 0);
+            ui_idle();
+            return;
+        }
+        send_xpubs();
+        return;
+    }
+
+    ctx->approved = false;
+    ctx->account = 0;
+    ctx->remaining = 1;
+    if (dataLength > 0) {
+        if (dataLength != 5) {
+            THROW(SW_INVALID_PARAM);
+        }
+        ctx->account = U4BE(dataBuffer, 0);
+        ctx->remaining = dataBuffer[4];
+        // accounts are hardened, so their indexes can't have the highest bit set
+        if (ctx->remaining == 0 || ctx->account >= 0x80000000 || ctx->account + ctx->remaining > 0x80000000) {
+            THROW(SW_INVALID_PARAM);
+        }
+    }
+
+    // the accounts being exported, eg. "Account / 0" or "Accounts / 0 - 9"
+    strcpy(ctx->line1, ctx->remaining == 1 ? "Account" : "Accounts");
+    len = itoa(ctx->account, (char*)ctx->info, 10);
+    if (ctx->remaining > 1) {
+        len += strcpy_len((char*)ctx->info + len, " - ");
+        len += itoa(ctx->account + ctx->remaining - 1, (char*)ctx->info + len, 10);
+    }
+    if (paginate(ctx->info, &len, 1, MAX_SCREEN_LENGTH, &ctx->pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    show_page(&ctx->pages, ctx->info, ctx->line2);
+    UX_DISPLAY(ui_getXPub_compare, ui_prepro_getXPub_compare);
     *flags |= IO_ASYNCH_REPLY;
 }
@@ -5,80 +5,385 @@
  * LICENSE file in the root directory of this source tree.
  */
 
-#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <os.h>
+#include <os_io_seproxyhal.h>
 #include <cx.h>
 #include "hathor.h"
 #include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
 
 // All keys that we derive start with path 44'/280'/0'
 // We make `| 0x80000000` for hardened keys
 const uint32_t htr_bip44[] = { 44 | 0x80000000, HATHOR_BIP44_CODE | 0x80000000, 0 | 0x80000000 };
 
+// order of the secp256k1 curve and half of it, for normalising signatures to low-S
+static const uint8_t secp256k1_n[] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+    0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B, 0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x41};
+static const uint8_t secp256k1_half_n[] = {
+    0x7F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x5D, 0x57, 0x6E, 0x73, 0x57, 0xA4, 0x50, 0x1D, 0xDF, 0xE9, 0x2F, 0x46, 0x68, 0x1B, 0x20, 0xA0};
+
+/*
+ * Reads a DER integer ([0x02, len, value]) into a 32-byte big endian buffer.
+ *
+ * Returns the position in buffer after the integer.
+ */
+static const uint8_t* read_der_integer(const uint8_t *in, uint8_t *out) {
+    uint8_t len;
+    if (in[0] != 0x02) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    len = in[1];
+    in += 2;
+    // positive integers with the highest bit set are padded with 0x00
+    while (len > 32 && *in == 0) {
+        in++;
+        len--;
+    }
+    if (len == 0 || len > 32) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    os_memset(out, 0, 32 - len);
+    os_memmove(out + 32 - len, in, len);
+    return in + len;
+}
+
+void der_to_compact_signature(const uint8_t *der, uint8_t *out) {
+    // skip the sequence header [0x30, len]
+    const uint8_t *buf = read_der_integer(der + 2, out);
+    read_der_integer(buf, out + 32);
+    if (cx_math_cmp(out + 32, secp256k1_half_n, 32) > 0) {
+        // s = n - s
+        cx_math_sub(out + 32, secp256k1_n, out + 32, 32);
+    }
+}
+
+crypto_scratch_t* scratch_acquire(void) {
+    global.scratch.borrowers++;
+    return &global.scratch;
+}
+
+void scratch_release(void) {
+    if (global.scratch.borrowers == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    if (--global.scratch.borrowers == 0) {
+        // erase sensitive data
+        explicit_bzero(&global.scratch, sizeof(global.scratch));
+    }
+}
+
+void bip32_derive_child(uint8_t *private_component, uint8_t *chain_code, uint8_t *public_key, uint32_t index) {
+    crypto_scratch_t *scratch = scratch_acquire();
+    uint8_t *data = scratch->keys.ckd_data;
+    uint8_t *digest = scratch->hash.digest;
+
+    if (index & 0x80000000) {
+        data[0] = 0;
+        os_memmove(data + 1, private_component, 32);
+    } else {
+        os_memmove(data, public_key, 33);
+    }
+    data[33] = index >> 24;
+    data[34] = index >> 16;
+    data[35] = index >> 8;
+    data[36] = index;
+    cx_hmac_sha512(chain_code, 32, data, sizeof(scratch->keys.ckd_data), digest, sizeof(scratch->hash.digest));
+
+    // child key is (IL + parent key) mod n and child chain code is IR. IL must be
+    // a valid key, which fails with probability lower than 1 in 2^127
+    if (cx_math_cmp(digest, secp256k1_n, 32) >= 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    cx_math_addm(private_component, digest, private_component, secp256k1_n, 32);
+    if (cx_math_is_zero(private_component, 32)) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    os_memmove(chain_code, digest + 32, 32);
+
+    // erase sensitive data, even if the caller still holds the arena
+    explicit_bzero(data, sizeof(scratch->keys.ckd_data));
+    explicit_bzero(digest, sizeof(scratch->hash.digest));
+    scratch_release();
+}
+
+// The derivation cache, on the session context, keeps the parents of the most
+// recently derived keys, so siblings (eg. 44'/280'/0'/0/1 and 44'/280'/0'/0/2)
+// are one step away. It survives failed commands, so entries are marked unused
+// while they're being changed.
+
+// computes the compressed public key of a cached node, if we don't have it yet
+static void cache_public_key(bip32_node_t *node) {
+    crypto_scratch_t *scratch;
+
+    if (node->has_public_key) {
+        return;
+    }
+    scratch = scratch_acquire();
+    cx_ecdsa_init_private_key(CX_CURVE_256K1, node->private_component, 32, &scratch->keys.private_key);
+    cx_ecfp_generate_pair(CX_CURVE_256K1, &scratch->keys.public_key, &scratch->keys.private_key, 1);
+    compress_public_key(scratch->keys.public_key.W);
+    os_memmove(node->public_key, scratch->keys.public_key.W, 33);
+    node->has_public_key = true;
+    // erase sensitive data
+    explicit_bzero(&scratch->keys.private_key, sizeof(scratch->keys.private_key));
+    scratch_release();
+}
+
+// derives the child of a cached node in place
+static void cache_derive_child(bip32_node_t *node, uint32_t index) {
+    uint8_t path_len = node->path_len;
+
+    if (!(index & 0x80000000)) {
+        cache_public_key(node);
+    }
+    node->path_len = 0;
+    bip32_derive_child(node->private_component, node->chain_code, node->public_key, index);
+    node->path[path_len] = index;
+    node->path_len = path_len + 1;
+    node->has_public_key = false;
+}
+
+/*
+ * Returns the cached node for the first depth indexes of path. If it's not cached,
+ * it's derived from its deepest cached ancestor, or from the seed if there is none,
+ * and replaces the least recently used entry. The depth must be at least
+ * BIP44_PREFIX_LEN.
+ */
+static bip32_node_t* cache_get_node(const uint32_t *path, uint8_t depth) {
+    bip32_node_t *ancestor = NULL;
+    bip32_node_t *node = &session.bip32_cache[0];
+    uint8_t i;
+
+    for (i = 0; i < BIP32_CACHE_SIZE; i++) {
+        bip32_node_t *entry = &session.bip32_cache[i];
+        if (entry->path_len > 0 && entry->path_len <= depth
+                && os_memcmp(entry->path, path, entry->path_len * sizeof(uint32_t)) == 0
+                && (ancestor == NULL || entry->path_len > ancestor->path_len)) {
+            ancestor = entry;
+        }
+        if (entry->last_used < node->last_used) {
+            node = entry;
+        }
+    }
+
+    if (ancestor != NULL && ancestor->path_len == depth) {
+        // cache hit
+        node = ancestor;
+    } else {
+        if (ancestor != NULL) {
+            // the least recently used entry may be the ancestor itself
+            os_memmove(node, ancestor, sizeof(bip32_node_t));
+        } else {
+            node->path_len = 0;
+            os_perso_derive_node_bip32(CX_CURVE_256K1, path, depth, node->private_component, node->chain_code);
+            os_memmove(node->path, path, depth * sizeof(uint32_t));
+            node->path_len = depth;
+            node->has_public_key = false;
+        }
+        while (node->path_len < depth) {
+            cache_derive_child(node, path[node->path_len]);
+        }
+    }
+    node->last_used = ++session.bip32_cache_clock;
+    return node;
+}
+
 void derive_keypair(
     cx_ecfp_private_key_t *private_key,
     cx_ecfp_public_key_t *public_key,
     unsigned char *chain_code,
-    int n_args,
-    ...
+    const uint32_t *path,
+    uint8_t path_len
 ) {
-    unsigned char private_component[32];
-    va_list ap;
-    int i;
-    uint32_t path[3 + n_args];
-    memcpy(path, htr_bip44, 3*sizeof(uint32_t));
+    crypto_scratch_t *scratch;
+    bip32_node_t *parent;
 
-    va_start(ap, n_args);
-    for(i = 0; i < n_args; i++) {
-        path[3 + i] = va_arg(ap, int);
+    if (path_len <= BIP44_PREFIX_LEN || path_len > MAX_BIP32_PATH
+            || os_memcmp(path, htr_bip44, BIP44_PREFIX_LEN * sizeof(uint32_t)) != 0) {
+        THROW(SW_INVALID_PARAM);
     }
-    va_end(ap);
 
-    os_perso_derive_node_bip32(CX_CURVE_256K1, path, 3 + n_args, private_component, chain_code);
-    cx_ecdsa_init_private_key(CX_CURVE_256K1, private_component, 32, private_key);
+    scratch = scratch_acquire();
+    parent = cache_get_node(path, path_len - 1);
+    if (!(path[path_len - 1] & 0x80000000)) {
+        cache_public_key(parent);
+    }
+    os_memmove(scratch->keys.private_component, parent->private_component, 32);
+    os_memmove(scratch->keys.chain_code, parent->chain_code, 32);
+    bip32_derive_child(scratch->keys.private_component, scratch->keys.chain_code, parent->public_key, path[path_len - 1]);
+
+    cx_ecdsa_init_private_key(CX_CURVE_256K1, scratch->keys.private_component, 32, private_key);
     cx_ecfp_generate_pair(CX_CURVE_256K1, public_key, private_key, 1);
+    if (chain_code != NULL) {
+        os_memmove(chain_code, scratch->keys.chain_code, 32);
+    }
+
+    // erase sensitive data, even if the caller still holds the arena
+    explicit_bzero(scratch->keys.private_component, 32);
+    explicit_bzero(scratch->keys.chain_code, 32);
+    scratch_release();
+}
+
+uint8_t key_index_path(uint32_t index, uint32_t *path) {
+    os_memmove(path, htr_bip44, sizeof(htr_bip44));
+    path[3] = 0;
+    path[4] = index;
+    return 5;
+}
+
+void key_index_pubkey_hash(uint32_t index, uint8_t *out) {
+    crypto_scratch_t *scratch = scratch_acquire();
+    uint32_t path[5];
+    uint8_t path_len = key_index_path(index, path);
+
+    derive_keypair(&scratch->keys.private_key, &scratch->keys.public_key, NULL, path, path_len);
+    compress_public_key(scratch->keys.public_key.W);
+    hash160(scratch->keys.public_key.W, 33, out);
+    scratch_release();
+}
+
+uint8_t read_bip32_path(uint8_t *in, size_t inlen, uint32_t *path, uint8_t *path_len) {
+    uint8_t i;
+
+    if (inlen < 1 || in[0] > MAX_BIP32_PATH || inlen < 1 + 4 * (size_t)in[0]) {
+        THROW(SW_INVALID_PARAM);
+    }
+    *path_len = in[0];
+    for (i = 0; i < *path_len; i++) {
+        path[i] = U4BE(in, 1 + 4 * i);
+    }
+    // we're only allowed to derive keys under 44'/280'
+    if (*path_len <= BIP44_PREFIX_LEN || os_memcmp(path, htr_bip44, BIP44_PREFIX_LEN * sizeof(uint32_t)) != 0) {
+        THROW(SW_INVALID_PARAM);
+    }
+    return 1 + 4 * (*path_len);
+}
+
+uint8_t read_key(uint8_t p2, uint8_t *in, uint16_t inlen, uint32_t *path, uint8_t *path_len) {
+    if (p2 & SIGN_P2_PATHS) {
+        return read_bip32_path(in, inlen, path, path_len);
+    }
+    if (inlen < 4) {
+        THROW(SW_INVALID_PARAM);
+    }
+    *path_len = key_index_path(U4BE(in, 0), path);
+    return 4;
+}
+
+uint8_t max_signatures(uint8_t p2) {
+    uint8_t sig_len = (p2 & SIGN_P2_COMPACT ? COMPACT_SIGNATURE_LEN : DER_SIGNATURE_MAX_LEN);
+    if (p2 & SIGN_P2_PUBKEY) {
+        sig_len += 33;
+    }
+    return (sizeof(G_io_apdu_buffer) - 2) / sig_len;
+}
+
+uint8_t sign_with_key(const uint8_t *hash, uint32_t *path, uint8_t path_len, uint8_t p2, uint8_t *out) {
+    crypto_scratch_t *scratch = scratch_acquire();
+
+    derive_keypair(&scratch->keys.private_key, &scratch->keys.public_key, NULL, path, path_len);
+
+    int sig_size = cx_ecdsa_sign(&scratch->keys.private_key, CX_LAST | CX_RND_RFC6979, CX_SHA256, hash, 32,
+                                 scratch->signature, sizeof(scratch->signature), NULL);
+
+    // erase sensitive data
+    explicit_bzero(&scratch->keys.private_key, sizeof(scratch->keys.private_key));
+
+    if (p2 & SIGN_P2_COMPACT) {
+        der_to_compact_signature(scratch->signature, out);
+        sig_size = COMPACT_SIGNATURE_LEN;
+    } else {
+        os_memmove(out, scratch->signature, sig_size);
+    }
+    if (p2 & SIGN_P2_PUBKEY) {
+        // we already have the public key, so the wallet doesn't need to ask for it
+        compress_public_key(scratch->keys.public_key.W);
+        os_memmove(out + sig_size, scratch->keys.public_key.W, 33);
+        sig_size += 33;
+    }
+    scratch_release();
+    return sig_size;
+}
+
+uint16_t sign_with_keys(const uint8_t *hashes, uint8_t hashes_len, uint8_t p2, const uint8_t *request, uint16_t request_len, uint8_t *copy) {
+    const uint8_t *hash = hashes;
+    uint32_t path[MAX_BIP32_PATH];
+    uint8_t path_len;
+    uint16_t offset = 0;
+    uint16_t tx = 0;
+    uint8_t count = 0;
+
+    if (request_len == 0) {
+        THROW(SW_INVALID_PARAM);
+    }
+    // the signatures overwrite the request on G_io_apdu_buffer, so we keep a copy
+    os_memmove(copy, request, request_len);
+    while (offset < request_len) {
+        if (++count > max_signatures(p2)) {
+            THROW(SW_INVALID_PARAM);
+        }
+        if (hashes_len > 0) {
+            // the key is preceded by the number of its hash
+            if (copy[offset] >= hashes_len) {
+                THROW(SW_INVALID_PARAM);
+            }
+            hash = hashes + 32 * copy[offset++];
+        }
+        offset += read_key(p2, copy + offset, request_len - offset, path, &path_len);
+        tx += sign_with_key(hash, path, path_len, p2, G_io_apdu_buffer + tx);
+    }
+    return tx;
 }
 
 void sha256d(unsigned char *in, size_t inlen, unsigned char *out) {
-    cx_sha256_t hash;
-    unsigned char buffer[32];
+    crypto_scratch_t *scratch = scratch_acquire();
+    cx_sha256_t *hash = &scratch->hash.ctx.sha256;
 
-    cx_sha256_init(&hash);
-    cx_hash(&hash.header, CX_LAST, in, inlen, buffer, 32);
-    cx_sha256_init(&hash);
-    cx_hash(&hash.header, CX_LAST, buffer, 32, out, 32);
+    cx_sha256_init(hash);
+    cx_hash(&hash->header, CX_LAST, in, inlen, scratch->hash.digest, 32);
+    cx_sha256_init(hash);
+    cx_hash(&hash->header, CX_LAST, scratch->hash.digest, 32, out, 32);
+    scratch_release();
 }
 
 void hash160(unsigned char *in, size_t inlen, unsigned char *out) {
-    union {
-        cx_sha256_t shasha;
-        cx_ripemd160_t riprip;
-    } u;
-    unsigned char buffer[32];
+    crypto_scratch_t *scratch = scratch_acquire();
 
-    cx_sha256_init(&u.shasha);
-    cx_hash(&u.shasha.header, CX_LAST, in, inlen, buffer, 32);
-    cx_ripemd160_init(&u.riprip);
-    cx_hash(&u.riprip.header, CX_LAST, buffer, 32, out, 20);
+    cx_sha256_init(&scratch->hash.ctx.sha256);
+    cx_hash(&scratch->hash.ctx.sha256.header, CX_LAST, in, inlen, scratch->hash.digest, 32);
+    cx_ripemd160_init(&scratch->hash.ctx.ripemd160);
+    cx_hash(&scratch->hash.ctx.ripemd160.header, CX_LAST, scratch->hash.digest, 32, out, 20);
+    scratch_release();
 }
 
 void compress_public_key(unsigned char *value) {
     value[0] = ((value[64] & 1) ? 0x03 : 0x02);
 }
 
-void pubkey_hash_to_address(uint8_t *hash, uint8_t *out) {
+static void hash_to_address(uint8_t version, uint8_t *hash, uint8_t *out) {
     unsigned char checksum_buffer[32];
     // prepend version
-    out[0] = P2PKH_VERSION_BYTE;
+    out[0] = version;
     os_memmove(out+1, hash, 20);
     // sha256d of above and get first 4 bytes (checksum)
     sha256d(out, 21, checksum_buffer);
     os_memmove(out+21, checksum_buffer, 4);
 }
 
+void pubkey_hash_to_address(uint8_t *hash, uint8_t *out) {
+    hash_to_address(P2PKH_VERSION_BYTE, hash, out);
+}
+
+void script_hash_to_address(uint8_t *hash, uint8_t *out) {
+    hash_to_address(P2SH_VERSION_BYTE, hash, out);
+}
+
 void pubkey_to_address(cx_ecfp_public_key_t *public_key, uint8_t *out) {
     unsigned char hash_buffer[20];
     // get compressed pubkey
@@ -98,7 +403,20 @@ void validate_p2pkh_script(uint8_t *in) {
     // pubkey hashes have 20 bytes
     uint8_t p2pkh[] = {OP_DUP, OP_HASH160, 20, OP_EQUALVERIFY, OP_CHECKSIG};
     if (os_memcmp(p2pkh, in, 3) != 0 || os_memcmp(p2pkh + 3, in + 23, 2) !=0) {
-        THROW(SW_INVALID_PARAM);
+        THROW(TX_STATE_ERR);
+    }
+}
+
+/**
+ * Validates that a script has the format of P2SH. Throws an exception if doesn't.
+ * P2SH scripts have the format:
+ *   [OP_HASH160, script_hash_len, script_hash, OP_EQUAL]
+ */
+void validate_p2sh_script(uint8_t *in) {
+    // script hashes have 20 bytes
+    uint8_t p2sh[] = {OP_HASH160, 20, OP_EQUAL};
+    if (os_memcmp(p2sh, in, 2) != 0 || in[22] != p2sh[2]) {
+        THROW(TX_STATE_ERR);
     }
 }
 
@@ -134,25 +452,73 @@ uint8_t* parse_output(uint8_t *in, size_t inlen, tx_output_t *output) {
     buf = parse_output_value(buf, inlen, &output->value);
     output->token_data = *buf;
     buf++;
+    output->authorities = 0;
+    if (output->token_data & TOKEN_AUTHORITY_MASK) {
+        // the value is the authority bitmask, not an amount. HTR has no authorities
+        if ((output->token_data & TOKEN_INDEX_MASK) == 0
+                || output->value == 0 || output->value > (AUTHORITY_MINT | AUTHORITY_MELT)) {
+            THROW(TX_STATE_ERR);
+        }
+        output->authorities = output->value;
+        output->value = 0;
+    }
     uint16_t script_len = U2BE(buf, 0);
     buf += 2;
-    assert_length(script_len, inlen - 7);
-    validate_p2pkh_script(buf);
-    os_memcpy(output->pubkey_hash, buf+3, 20);
+    assert_length(script_len, inlen - (buf - in));
+    switch (script_len) {
+        case P2PKH_SCRIPT_LEN:
+            validate_p2pkh_script(buf);
+            output->script_type = SCRIPT_P2PKH;
+            os_memcpy(output->pubkey_hash, buf+3, 20);
+            break;
+        case P2SH_SCRIPT_LEN:
+            validate_p2sh_script(buf);
+            output->script_type = SCRIPT_P2SH;
+            os_memcpy(output->pubkey_hash, buf+2, 20);
+            break;
+        default:
+            THROW(TX_STATE_ERR);
+    }
     buf += script_len;
     return buf;
 }
 
-void format_value(uint64_t value, unsigned char *out) {
+bool parse_multisig_redeem_script(uint8_t *in, size_t inlen, uint8_t *pubkey, uint8_t *m, uint8_t *n) {
+    bool found = false;
+    uint8_t i;
+
+    if (inlen < 3 || in[0] <= OP_0 || in[0] > OP_16) {
+        THROW(SW_INVALID_PARAM);
+    }
+    *m = in[0] - OP_0;
+    *n = in[inlen - 2] - OP_0;
+    if (in[inlen - 2] <= OP_0 || in[inlen - 2] > OP_16 || *m > *n
+            || in[inlen - 1] != OP_CHECKMULTISIG
+            || inlen != 3 + (size_t)(*n) * (1 + MULTISIG_PUBKEY_LEN)) {
+        THROW(SW_INVALID_PARAM);
+    }
+    for (i = 0; i < *n; i++) {
+        uint8_t *push = in + 1 + i * (1 + MULTISIG_PUBKEY_LEN);
+        if (push[0] != MULTISIG_PUBKEY_LEN) {
+            THROW(SW_INVALID_PARAM);
+        }
+        if (os_memcmp(push + 1, pubkey, MULTISIG_PUBKEY_LEN) == 0) {
+            found = true;
+        }
+    }
+    return found;
+}
+
+uint8_t format_value(uint64_t value, unsigned char *out) {
     // first deal with the part to the left of the decimal separator
     uint64_t tmp = value / 100;
+    unsigned char *start = out;
     int c;
     char buf[35];
     char *p;
 
-    utoa(tmp, buf);
     // 'c' is used here to control when a comma should be added
-    c = 2 - strlen(buf) % 3;
+    c = 2 - utoa(tmp, buf) % 3;
     for (p = buf; *p != 0; p++) {
        *out++ = *p;
        if (c == 1) {
@@ -164,14 +530,27 @@ void format_value(uint64_t value, unsigned char *out) {
 
     // now the part to the right of the decimal separator
     tmp = value % 100;
-    // reusing 'c' variable to point to the end of string, to add decimal
-    // separator and possibly pad with 0
-    c = strlen((const char*)out);
-    out[c++] = '.';
+    *out++ = '.';
     if (tmp < 10) {
-        out[c++] = '0';
+        *out++ = '0';
+    }
+    out += itoa(tmp, (char*)out, 10);
+    return out - start;
+}
+
+uint8_t format_authorities(uint8_t authorities, char *out) {
+    uint8_t len = 0;
+    if (authorities & AUTHORITY_MINT) {
+        len = strcpy_len(out, "Mint");
+    }
+    if (authorities & AUTHORITY_MELT) {
+        if (len > 0) {
+            out[len++] = '+';
+        }
+        len += strcpy_len(out + len, "Melt");
     }
-    itoa(tmp, (char*)out + c, 10);
+    out[len] = '\0';
+    return len;
 }
 
 void assert_length(size_t smaller, size_t larger) {
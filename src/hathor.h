@@ -13,10 +13,45 @@
 #define SW_OK            0x9000
 
 // opcodes
+#define OP_0            0x50
+#define OP_16           0x60
 #define OP_DUP          0x76
+#define OP_EQUAL        0x87
 #define OP_EQUALVERIFY  0x88
 #define OP_HASH160      0xA9
 #define OP_CHECKSIG     0xAC
+#define OP_CHECKMULTISIG 0xAE
+
+// transaction versions
+#define TX_VERSION_REGULAR          1
+#define TX_VERSION_TOKEN_CREATION   2
+
+// the lower bits of an output's token_data are the index of its token in the tx.
+// On token creation transactions, index 1 is the token being created
+#define TOKEN_INDEX_MASK        0x7F
+// if the highest bit of token_data is set, it's an authority output and its value
+// is a bitmask of the authorities granted
+#define TOKEN_AUTHORITY_MASK    0x80
+#define AUTHORITY_MINT          0x01
+#define AUTHORITY_MELT          0x02
+#define TOKEN_INFO_VERSION      1
+#define TOKEN_NAME_MAX_LEN      30
+#define TOKEN_SYMBOL_MAX_LEN    5
+
+// script sizes
+#define P2PKH_SCRIPT_LEN    25
+#define P2SH_SCRIPT_LEN     23
+// compressed public keys are pushed with a 1-byte length prefix
+#define MULTISIG_PUBKEY_LEN 33
+
+// signature sizes
+#define DER_SIGNATURE_MAX_LEN   72
+#define COMPACT_SIGNATURE_LEN   64
+
+// p2 flags of the commands that sign with the wallet's keys
+#define SIGN_P2_COMPACT     0x01    // 64-byte r || s signatures, instead of DER
+#define SIGN_P2_PUBKEY      0x02    // append the compressed public key to each signature
+#define SIGN_P2_PATHS       0x04    // keys are given as bip32 paths instead of key indexes
 
 
 /**
@@ -26,13 +61,123 @@
  */
 extern const uint32_t htr_bip44[3];
 
-// TODO only p2pkh and HTR for now
+// the app is only allowed to derive paths under 44'/280' (see --path in the Makefile)
+#define BIP44_PREFIX_LEN    2
+#define MAX_BIP32_PATH      10
+
+// number of intermediate nodes kept by derive_keypair
+#define BIP32_CACHE_SIZE    3
+
+// A node in the derivation cache. Entries with path_len = 0 are not used.
+typedef struct {
+    uint32_t path[MAX_BIP32_PATH];
+    uint8_t path_len;
+    uint8_t private_component[32];
+    uint8_t chain_code[32];
+    // compressed public key, only computed when a non-hardened child is derived
+    bool has_public_key;
+    uint8_t public_key[33];
+    // higher is more recently used
+    uint32_t last_used;
+} bip32_node_t;
+
+// Scratch space for the derivation, hashing and signing paths, so they don't keep
+// keys and hash contexts on the stack. It lives in the global command context and
+// is borrowed with scratch_acquire/scratch_release. Each slice has a single use, so
+// nested helpers can borrow it while their caller holds it.
+typedef struct {
+    // number of callers currently borrowing the arena
+    uint8_t borrowers;
+    // key pair returned by derive_keypair and the node it's derived from
+    struct {
+        cx_ecfp_private_key_t private_key;
+        cx_ecfp_public_key_t public_key;
+        uint8_t private_component[32];
+        uint8_t chain_code[32];
+        // input of a BIP32 child derivation: [0x00, private key, index] or [public key, index]
+        uint8_t ckd_data[37];
+    } keys;
+    // hash contexts and intermediate digests used by sha256d, hash160 and CKD
+    struct {
+        union {
+            cx_sha256_t sha256;
+            cx_ripemd160_t ripemd160;
+        } ctx;
+        uint8_t digest[64];
+    } hash;
+    // DER signature, before any conversion
+    uint8_t signature[DER_SIGNATURE_MAX_LEN];
+} crypto_scratch_t;
+
+// Filter of the pubkey hashes of a range of key indexes (44'/280'/0'/0/index), kept on
+// NVM so it's built once and reused by later sessions (see ownFilter.c). The range is
+// split in blocks of OWN_FILTER_BLOCK_KEYS indexes, each one with its own
+// OWN_FILTER_BLOCK_SIZE bytes of the filter, where each key sets OWN_FILTER_HASHES bits
+// chosen from its pubkey hash, so a hit also tells which block has the key
+#define OWN_FILTER_SIZE         4096
+#define OWN_FILTER_MAX_KEYS     2048
+#define OWN_FILTER_HASHES       11
+#define OWN_FILTER_BLOCK_KEYS   16
+#define OWN_FILTER_BLOCK_SIZE   (OWN_FILTER_SIZE / (OWN_FILTER_MAX_KEYS / OWN_FILTER_BLOCK_KEYS))
+
+typedef struct {
+    uint32_t first_index;
+    // keys in the range and how many of them have been added, from first_index on
+    uint32_t count;
+    uint32_t built;
+    // first bytes of the hash160 of 44'/280'/0'/0, so a build is only resumed on the same keys
+    uint8_t parent_fingerprint[4];
+    uint8_t bits[OWN_FILTER_SIZE];
+} own_filter_t;
+
+// Address book of trusted destinations, kept on NVM (see addressBook.c). It's a hash
+// table with linear probing, indexed by the first bytes of the pubkey hash, so an
+// output is looked up in a few slots. Slots with script_type = 0 are empty
+#define ADDRESS_BOOK_SLOTS      512
+#define ADDRESS_BOOK_MAX_LEN    448
+#define ADDRESS_BOOK_LABEL_LEN  12
+
+typedef struct {
+    uint8_t script_type;
+    uint8_t hash[20];
+    // NULL-terminated, unless it has ADDRESS_BOOK_LABEL_LEN characters
+    char label[ADDRESS_BOOK_LABEL_LEN];
+} address_book_entry_t;
+
+typedef struct {
+    uint16_t len;
+    address_book_entry_t slots[ADDRESS_BOOK_SLOTS];
+} address_book_t;
+
+// Payout templates, kept on NVM (see payoutTemplate.c). A template is the digest of
+// the token uids and ordered destinations of the txs it approves, so txs paying the
+// same destinations, with other amounts, are reviewed by their totals
+#define PAYOUT_TEMPLATES            8
+#define PAYOUT_TEMPLATE_NAME_LEN    12
+
+typedef struct {
+    uint8_t digest[32];
+    // number of destinations, 0 if the slot is empty
+    uint8_t outputs_len;
+    // NULL-terminated, unless it has PAYOUT_TEMPLATE_NAME_LEN characters
+    char name[PAYOUT_TEMPLATE_NAME_LEN];
+} payout_template_t;
+
+// output script types we know how to decode
+typedef enum {
+    SCRIPT_P2PKH = 1,
+    SCRIPT_P2SH = 2,
+} script_type_e;
+
+// TODO only HTR for now
 // TODO add timelock
 typedef struct {
     uint8_t index;      // the index of this output in the tx
-    uint64_t value;
-    // hash160 of public key
+    uint64_t value;     // always 0 for authority outputs
     uint8_t token_data;
+    uint8_t authorities;    // mint/melt bitmask, only for authority outputs
+    uint8_t script_type;
+    // hash160 of public key (p2pkh) or of the redeem script (p2sh)
     uint8_t pubkey_hash[20];
 } tx_output_t;
 
@@ -45,10 +190,33 @@ typedef enum {
 } tx_decoder_state_e;
 
 /**
- * Get the private/public keys and chain code for the desired path. This
- * function accepts a variable number of arguments and always derives paths
- * starting on 44'/280'/0'. So if there are 2 variable arguments (0 and 5),
- * the derived path will be 44'/280'/0'/0/5
+ * Borrows the crypto scratch arena. Calls may be nested, as long as each one is
+ * paired with scratch_release.
+ *
+ * @return the scratch arena
+ *
+ */
+crypto_scratch_t* scratch_acquire(void);
+
+/**
+ * Gives back the crypto scratch arena. It's erased when the last borrower
+ * releases it.
+ *
+ */
+void scratch_release(void);
+
+/**
+ * Get the private/public keys and chain code for the desired path. The path
+ * must be under 44'/280' and have at most MAX_BIP32_PATH indexes, otherwise
+ * SW_INVALID_PARAM is thrown.
+ *
+ * The parent node of the path is kept in a cache of recently used nodes, so
+ * deriving its siblings only takes one step from there. Paths that don't have
+ * a cached parent start from the deepest cached ancestor or, if there is none,
+ * from the seed.
+ *
+ * The derivation runs on the scratch arena. Callers usually pass its key pair
+ * slice as the output and must hold the arena while they use it.
  *
  * @param [out] private_key
  *   The private key for the given path.
@@ -57,21 +225,245 @@ typedef enum {
  *   The public key for the given path.
  *
  * @param [out] chain_code
- *   Chain code for this path.
+ *   Chain code for this path. May be NULL.
  *
- * @param  [in] n_args
- *   Number of variable arguments.
+ * @param  [in] path
+ *   The BIP32 path.
  *
- * @param  [in] ...
- *   The indexes for deriving the keypair.
+ * @param  [in] path_len
+ *   Number of indexes in the path.
  *
  */
 void derive_keypair(
     cx_ecfp_private_key_t *private_key,
     cx_ecfp_public_key_t *public_key,
     unsigned char *chain_code,
-    int n_args,
-    ...);
+    const uint32_t *path,
+    uint8_t path_len);
+
+/**
+ * Builds the path for a key index, 44'/280'/0'/0/index. Used by commands that
+ * receive key indexes instead of full paths.
+ *
+ * @param  [in] index
+ *   The key index.
+ *
+ * @param [out] path
+ *   The BIP32 path. Should have room for at least 5 indexes.
+ *
+ * @return the length of the path
+ */
+uint8_t key_index_path(uint32_t index, uint32_t *path);
+
+/**
+ * Gets the pubkey hash (hash160 of the compressed public key) of a key index, ie.
+ * of the key on 44'/280'/0'/0/index.
+ *
+ * @param  [in] index
+ *   The key index.
+ *
+ * @param [out] out
+ *   The pubkey hash. Should have at least 20 bytes.
+ *
+ */
+void key_index_pubkey_hash(uint32_t index, uint8_t *out);
+
+/**
+ * Tells whether the own keys filter was built with the current keys, ie. the same
+ * seed and passphrase. A filter built with other keys must not be used, as it
+ * doesn't have the current ones.
+ *
+ * @return true if there's a filter and it has the current keys
+ */
+bool own_filter_has_current_keys();
+
+/**
+ * Tells whether a key index may have the given pubkey hash, according to the own
+ * keys filter. Indexes that haven't been added to the filter may have any hash. The
+ * caller must check the filter has the current keys (see own_filter_has_current_keys).
+ *
+ * @param  [in] pubkey_hash
+ *   The 20-byte pubkey hash.
+ *
+ * @param  [in] index
+ *   The key index.
+ *
+ * @return false if the key index certainly doesn't have the hash
+ */
+bool own_filter_may_have(const uint8_t *pubkey_hash, uint32_t index);
+
+/**
+ * Finds the key index of a pubkey hash among the keys on the own keys filter. Only
+ * the blocks where the filter has the hash are derived, to confirm it, so a hash
+ * that isn't there usually costs no derivation at all. A filter built with other
+ * keys never finds anything.
+ *
+ * @param  [in] pubkey_hash
+ *   The 20-byte pubkey hash.
+ *
+ * @param [out] index
+ *   The key index, if it's found.
+ *
+ * @return true if one of the filter's keys has the hash
+ */
+bool own_filter_find_key(const uint8_t *pubkey_hash, uint32_t *index);
+
+/**
+ * Looks up a destination on the address book.
+ *
+ * @param  [in] script_type
+ *   The destination's script type (SCRIPT_P2PKH or SCRIPT_P2SH).
+ *
+ * @param  [in] hash
+ *   The 20-byte pubkey hash or script hash.
+ *
+ * @param [out] label
+ *   The destination's NULL-terminated label, if it's found. Should have at least
+ *   ADDRESS_BOOK_LABEL_LEN + 1 bytes.
+ *
+ * @return true if the destination is on the address book
+ */
+bool address_book_find(uint8_t script_type, const uint8_t *hash, char *label);
+
+/**
+ * Looks up the payout template with a given digest of a tx's destinations (see
+ * tx_finish_destinations_digest).
+ *
+ * @param  [in] digest
+ *   The 32-byte digest.
+ *
+ * @param [out] out
+ *   The template, if it's found.
+ *
+ * @return true if there's a template with this digest
+ */
+bool payout_template_find(const uint8_t *digest, payout_template_t *out);
+
+/**
+ * Reads a BIP32 path in the format [path_len (1 byte), index (4 bytes) * path_len].
+ * Throws SW_INVALID_PARAM if the path is not under 44'/280' or is too long.
+ *
+ * @param  [in] in
+ *   Data to be parsed.
+ *
+ * @param  [in] inlen
+ *   Size of data to be parsed.
+ *
+ * @param [out] path
+ *   The BIP32 path. Should have room for MAX_BIP32_PATH indexes.
+ *
+ * @param [out] path_len
+ *   Number of indexes in the path.
+ *
+ * @return the number of bytes read
+ */
+uint8_t read_bip32_path(uint8_t *in, size_t inlen, uint32_t *path, uint8_t *path_len);
+
+/**
+ * Reads a signing key from a request: a key index (4 bytes) or, if SIGN_P2_PATHS
+ * is set on p2, a BIP32 path as in read_bip32_path.
+ *
+ * @param  [in] p2
+ *   The request's p2 flags.
+ *
+ * @param  [in] in
+ *   Data to be parsed.
+ *
+ * @param  [in] inlen
+ *   Size of data to be parsed.
+ *
+ * @param [out] path
+ *   The BIP32 path. Should have room for MAX_BIP32_PATH indexes.
+ *
+ * @param [out] path_len
+ *   Number of indexes in the path.
+ *
+ * @return the number of bytes read
+ */
+uint8_t read_key(uint8_t p2, uint8_t *in, uint16_t inlen, uint32_t *path, uint8_t *path_len);
+
+/**
+ * Returns the maximum number of signatures in a single response, depending on
+ * their encoding (SIGN_P2_COMPACT and SIGN_P2_PUBKEY flags).
+ *
+ * @param  [in] p2
+ *   The request's p2 flags.
+ *
+ */
+uint8_t max_signatures(uint8_t p2);
+
+/**
+ * Signs a 32-byte hash with the key on the given path. The signature is DER
+ * encoded or, with SIGN_P2_COMPACT, in its compact form. With SIGN_P2_PUBKEY, it's
+ * followed by the key's compressed public key.
+ *
+ * @param  [in] hash
+ *   The 32-byte hash to be signed.
+ *
+ * @param  [in] path
+ *   The BIP32 path of the key.
+ *
+ * @param  [in] path_len
+ *   Number of indexes in the path.
+ *
+ * @param  [in] p2
+ *   The request's p2 flags.
+ *
+ * @param [out] out
+ *   The signature and public key. Should have room for DER_SIGNATURE_MAX_LEN + 33 bytes.
+ *
+ * @return the number of bytes written to out
+ */
+uint8_t sign_with_key(const uint8_t *hash, uint32_t *path, uint8_t path_len, uint8_t p2, uint8_t *out);
+
+/**
+ * Signs a request's hashes with each of its keys (see read_key), up to
+ * max_signatures(p2), and writes the signatures to G_io_apdu_buffer as in
+ * sign_with_key. The request is copied first, as the signatures overwrite it.
+ *
+ * @param  [in] hashes
+ *   The 32-byte hashes to be signed, one after the other.
+ *
+ * @param  [in] hashes_len
+ *   Number of hashes. If it's not 0, each key is preceded by the number of its
+ *   hash (1 byte). Otherwise, every key signs the first one.
+ *
+ * @param  [in] p2
+ *   The request's p2 flags.
+ *
+ * @param  [in] request
+ *   The keys to sign with.
+ *
+ * @param  [in] request_len
+ *   Size of the request.
+ *
+ * @param [out] copy
+ *   Copy of the request. Should have room for request_len bytes.
+ *
+ * @return the size of the signatures on G_io_apdu_buffer
+ */
+uint16_t sign_with_keys(const uint8_t *hashes, uint8_t hashes_len, uint8_t p2, const uint8_t *request, uint16_t request_len, uint8_t *copy);
+
+/**
+ * Derives a child node from its parent node, using BIP32's private parent key to
+ * private child key derivation. The parent's private key and chain code are
+ * replaced by the child's.
+ *
+ * @param [in/out] private_component
+ *   The 32-byte private key of the node.
+ *
+ * @param [in/out] chain_code
+ *   The chain code of the node.
+ *
+ * @param  [in] public_key
+ *   The 33-byte compressed public key of the parent node. Only needed for
+ *   non-hardened indexes and may be NULL otherwise.
+ *
+ * @param  [in] index
+ *   Index of the child node. Hardened if index >= 0x80000000.
+ *
+ */
+void bip32_derive_child(uint8_t *private_component, uint8_t *chain_code, uint8_t *public_key, uint32_t index);
 
 /**
  * Performs the sha256d (double sha256) of the data.
@@ -114,6 +506,20 @@ void hash160(unsigned char *in, size_t inlen, unsigned char *out);
  */
 void compress_public_key(unsigned char *value);
 
+/**
+ * Converts a DER signature, as returned by cx_ecdsa_sign, to its compact form:
+ * r and s as 32-byte big endian integers. s is normalised to the lower half of
+ * the curve order (low-S).
+ *
+ * @param  [in] der
+ *   The DER encoded signature.
+ *
+ * @param [out] out
+ *   The compact signature (r || s). Should have at least 64 bytes.
+ *
+ */
+void der_to_compact_signature(const uint8_t *der, uint8_t *out);
+
 /**
  * Derives the address (as bytes, not base58) from a public key hash.
  *
@@ -126,6 +532,18 @@ void compress_public_key(unsigned char *value);
  */
 void pubkey_hash_to_address(uint8_t *public_key_hash, uint8_t *out);
 
+/**
+ * Derives the P2SH address (as bytes, not base58) from a redeem script hash.
+ *
+ * @param  [in] script_hash
+ *   The hash160 of the redeem script.
+ *
+ * @param [out] out
+ *   Address for the given script hash.
+ *
+ */
+void script_hash_to_address(uint8_t *script_hash, uint8_t *out);
+
 /**
  * Derives the address (as bytes, not base58) from a public key.
  *
@@ -154,6 +572,31 @@ void pubkey_to_address(cx_ecfp_public_key_t *public_key, uint8_t *out);
  */
 uint8_t* parse_output(uint8_t *in, size_t inlen, tx_output_t *output);
 
+/**
+ * Validates a multisig redeem script and looks for a compressed public key
+ * among its keys. Throws SW_INVALID_PARAM if the script is malformed.
+ * Multisig redeem scripts have the format:
+ *   [OP_m, (33, pubkey) * n, OP_n, OP_CHECKMULTISIG]
+ *
+ * @param  [in] in
+ *   The redeem script.
+ *
+ * @param  [in] inlen
+ *   Size of the redeem script.
+ *
+ * @param  [in] pubkey
+ *   The 33-byte compressed public key to look for.
+ *
+ * @param [out] m
+ *   Number of signatures required.
+ *
+ * @param [out] n
+ *   Number of public keys in the script.
+ *
+ * @return true if the public key is one of the script's keys
+ */
+bool parse_multisig_redeem_script(uint8_t *in, size_t inlen, uint8_t *pubkey, uint8_t *m, uint8_t *n);
+
 /**
  * Returns the NULL-terminated string representation of an integer value,
  * with 2 decimal places and comma separator. Eg:
@@ -166,8 +609,24 @@ uint8_t* parse_output(uint8_t *in, size_t inlen, tx_output_t *output);
  * @param [out] out
  *   String representation of the value.
  *
+ * @return the length of the string
+ */
+uint8_t format_value(uint64_t value, unsigned char *out);
+
+/**
+ * Returns the NULL-terminated string representation of an authority bitmask. Eg:
+ *   AUTHORITY_MINT -> "Mint"
+ *   AUTHORITY_MINT | AUTHORITY_MELT -> "Mint+Melt"
+ *
+ * @param  [in] authorities
+ *   Authority bitmask, from an authority output.
+ *
+ * @param [out] out
+ *   String representation of the authorities. Should have at least 10 bytes.
+ *
+ * @return the length of the string
  */
-void format_value(uint64_t value, unsigned char *out);
+uint8_t format_authorities(uint8_t authorities, char *out);
 
 /**
  * Raises an exception in case the expected size is not smaller
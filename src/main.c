@@ -10,12 +10,15 @@
 #include <os_io_seproxyhal.h>
 #include "glyphs.h"
 #include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
 #include "ux.h"
 
 // These are global variables declared in ux.h. They can't be defined there
 // because multiple files include ux.h; they need to be defined in exactly one
 // place. See ux.h for their descriptions.
-commandContext global;
+APP_STATE commandContext global;
+APP_STATE sessionContext session;
 ux_state_t ux;
 
 // Here we define the main menu, using the Ledger-provided menu API. This menu
@@ -52,8 +55,8 @@ static const ux_menu_entry_t menu_main[] = {
 // ui_idle displays the main menu. Note that your app isn't required to use a
 // menu as its idle screen; you can define your own completely custom screen.
 void ui_idle(void) {
-    // reset any global state we may have
-    os_memset(&global, 0, sizeof(global));
+    // reset the state of the last command. The session state is kept
+    reset_command_context();
     // The first argument is the starting index within menu_main, and the last
     // argument is a preprocessor; I've never seen an app that uses either
     // argument.
@@ -70,13 +73,27 @@ void io_exchange_with_code(uint16_t code, uint16_t tx) {
     io_exchange(CHANNEL_APDU | IO_RETURN_AFTER_TX, tx);
 }
 
+void reset_command_context(void) {
+    explicit_bzero(&global, sizeof(global));
+}
+
+void reset_session_context(void) {
+    explicit_bzero(&session, sizeof(session));
+}
+
 // The APDU protocol uses a single-byte instruction code (INS) to specify
 // which command should be executed. We'll use this code to dispatch on a
 // table of function pointers.
-#define INS_GET_VERSION     0x01
-#define INS_GET_ADDRESS     0x02
-#define INS_SIGN_TX         0x04
-#define INS_GET_XPUB        0x10
+#define INS_GET_VERSION      0x01
+#define INS_GET_ADDRESS      0x02
+#define INS_GET_CAPABILITIES 0x03
+#define INS_SIGN_TX          0x04
+#define INS_SIGN_MESSAGE     0x05
+#define INS_FIND_KEYS        0x06
+#define INS_OWN_FILTER       0x07
+#define INS_ADDRESS_BOOK     0x08
+#define INS_PAYOUT_TEMPLATE  0x09
+#define INS_GET_XPUB         0x10
 
 // This is the function signature for a command handler. 'flags' and 'tx' are
 // out-parameters that will control the behavior of the next io_exchange call
@@ -86,16 +103,28 @@ typedef void handler_fn_t(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t
 
 handler_fn_t handleGetVersion;
 handler_fn_t handleGetAddress;
+handler_fn_t handleGetCapabilities;
 handler_fn_t handle_sign_tx;
+handler_fn_t handle_sign_message;
+handler_fn_t handleFindKeys;
+handler_fn_t handleOwnFilter;
+handler_fn_t handleAddressBook;
+handler_fn_t handlePayoutTemplate;
 handler_fn_t handleGetXPub;
 
 static handler_fn_t* lookupHandler(uint8_t ins) {
     switch (ins) {
-    case INS_GET_VERSION:    return handleGetVersion;
-    case INS_GET_ADDRESS:    return handleGetAddress;
-    case INS_SIGN_TX:        return handle_sign_tx;
-    case INS_GET_XPUB:       return handleGetXPub;
-    default:                 return NULL;
+    case INS_GET_VERSION:      return handleGetVersion;
+    case INS_GET_ADDRESS:      return handleGetAddress;
+    case INS_GET_CAPABILITIES: return handleGetCapabilities;
+    case INS_SIGN_TX:          return handle_sign_tx;
+    case INS_SIGN_MESSAGE:     return handle_sign_message;
+    case INS_FIND_KEYS:        return handleFindKeys;
+    case INS_OWN_FILTER:       return handleOwnFilter;
+    case INS_ADDRESS_BOOK:     return handleAddressBook;
+    case INS_PAYOUT_TEMPLATE:  return handlePayoutTemplate;
+    case INS_GET_XPUB:         return handleGetXPub;
+    default:                   return NULL;
     }
 }
 
@@ -123,7 +152,8 @@ static void hathor_main(void) {
     volatile unsigned int flags = 0;
 
     // reset global state when starting
-    os_memset(&global, 0, sizeof(global));
+    reset_command_context();
+    reset_session_context();
 
     // Exchange APDUs until EXCEPTION_IO_RESET is thrown.
     for (;;) {
@@ -157,6 +187,11 @@ static void hathor_main(void) {
                 if (!handlerFn) {
                     THROW(0x6D00);
                 }
+                // a command must never see the state another one left on the union
+                if (G_io_apdu_buffer[OFFSET_INS] != global.ins) {
+                    reset_command_context();
+                    global.ins = G_io_apdu_buffer[OFFSET_INS];
+                }
                 handlerFn(G_io_apdu_buffer[OFFSET_P1], G_io_apdu_buffer[OFFSET_P2],
                           G_io_apdu_buffer + OFFSET_CDATA, G_io_apdu_buffer[OFFSET_LC], &flags, &tx);
             }
@@ -177,12 +212,12 @@ static void hathor_main(void) {
                 // this is done; perhaps to handle single-byte exception
                 // codes?
 
-                // Clear the global state so next requests are not impacted. Only
+                // Clear the command state so next requests are not impacted. Only
                 // needed when last exception was an error, because SW_OK may
                 // indicate we require more data from the wallet and need to keep
-                // the same state
+                // the same state. The session state is still valid
                 if (e != SW_OK) {
-                    os_memset(&global, 0, sizeof(global));
+                    reset_command_context();
                 }
 
                 switch (e & 0xF000) {
@@ -283,6 +318,24 @@ unsigned short io_exchange_al(unsigned char channel, unsigned short tx_len) {
     return 0;
 }
 
+#ifdef HATHOR_HOST
+// Entry point of the host build (see host/device.c), which runs the app on its own
+// thread. There's no boot or USB to set up, so it only runs until the transport
+// is closed.
+void hathor_host_main(void) {
+    BEGIN_TRY {
+        TRY {
+            ui_idle();
+            hathor_main();
+        }
+        CATCH(EXCEPTION_IO_RESET) {
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+}
+#else
 static void app_exit(void) {
     BEGIN_TRY_L(exit) {
         TRY_L(exit) {
@@ -324,3 +377,4 @@ __attribute__((section(".boot"))) int main(void) {
     app_exit();
     return 0;
 }
+#endif
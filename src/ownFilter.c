@@ -0,0 +1,300 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The own filter command builds a bloom filter of the pubkey hashes of a range of key
+ * indexes (44'/280'/0'/0/index), so the app can tell whether a hash belongs to this
+ * wallet without deriving every key of the range (see own_filter_find_key). The filter
+ * has OWN_FILTER_SIZE bytes and up to OWN_FILTER_MAX_KEYS keys. It's kept on NVM, so
+ * it survives the app being closed.
+ *
+ * The range is split in blocks of OWN_FILTER_BLOCK_KEYS indexes, each one with its own
+ * OWN_FILTER_BLOCK_SIZE bytes of the filter, where each key sets OWN_FILTER_HASHES bits
+ * chosen from its pubkey hash and the number of its block. A lookup tests the hash on
+ * each block and only derives the keys of the blocks where the filter has it, to
+ * confirm the match. About 1 in 2000 tests of a full block that doesn't have the hash
+ * is a false positive. A block is built in RAM and written at once, so building the
+ * filter costs a single NVM write per block.
+ *
+ * Starting a new filter replaces the old one and needs the user's approval. The keys
+ * take a while to derive, so the filter is built a block at a time: each request adds
+ * the next block, until all keys are there. A build may be resumed on a later session,
+ * as long as the keys are the same (eg. the same passphrase). A filter built with other
+ * keys isn't used by the lookups. Every response has the filter's status:
+ *   [first_index (4 bytes), count (4 bytes), built (4 bytes)]
+ *
+ * | p1 | Data
+ * |----|------------------------------------
+ * | 0  | First index and count (4 bytes each): starts a new filter and adds its first block
+ * | 1  | None, adds the next block
+ * | 2  | None, just the status
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include <string.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+#define BLOCK_BITS (OWN_FILTER_BLOCK_SIZE * 8)
+
+#ifdef HATHOR_HOST
+// NVM is plain memory on the host
+own_filter_t N_own_filter_real;
+#else
+const own_filter_t N_own_filter_real;
+#endif
+#define N_own_filter (*(volatile own_filter_t *)PIC(&N_own_filter_real))
+
+static own_filter_context_t *ctx = &global.own_filter_context;
+
+// writes a 4-byte big endian integer
+static void write_u32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// position of the i-th bit of a pubkey hash within its block's bytes. The hash is
+// already uniform, so its words are used as the hash functions, by double hashing.
+// The odd step keeps the bits of each hash function apart
+static uint32_t bit_position(const uint8_t *pubkey_hash, uint32_t block, uint8_t i) {
+    uint32_t base = U4LE(pubkey_hash, 0) + block * (U4LE(pubkey_hash, 8) | 1);
+    return (base + i * (U4LE(pubkey_hash, 4) | 1)) % BLOCK_BITS;
+}
+
+static bool block_has(const uint8_t *pubkey_hash, uint32_t block) {
+    volatile uint8_t *bits = N_own_filter.bits + block * OWN_FILTER_BLOCK_SIZE;
+    uint32_t position;
+    uint8_t i;
+
+    for (i = 0; i < OWN_FILTER_HASHES; i++) {
+        position = bit_position(pubkey_hash, block, i);
+        if (!(bits[position / 8] & (1 << (position % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// first bytes of the hash160 of 44'/280'/0'/0, the parent of the filter's keys
+static void parent_fingerprint(uint8_t *out) {
+    crypto_scratch_t *scratch = scratch_acquire();
+    uint32_t path[5];
+    uint8_t hash[20];
+
+    key_index_path(0, path);
+    derive_keypair(&scratch->keys.private_key, &scratch->keys.public_key, NULL, path, 4);
+    compress_public_key(scratch->keys.public_key.W);
+    hash160(scratch->keys.public_key.W, 33, hash);
+    scratch_release();
+    os_memmove(out, hash, 4);
+}
+
+bool own_filter_has_current_keys() {
+    uint8_t fingerprint[4];
+    uint8_t i;
+
+    if (N_own_filter.count == 0) {
+        return false;
+    }
+    parent_fingerprint(fingerprint);
+    for (i = 0; i < sizeof(fingerprint); i++) {
+        if (fingerprint[i] != N_own_filter.parent_fingerprint[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool own_filter_may_have(const uint8_t *pubkey_hash, uint32_t index) {
+    uint32_t offset = index - N_own_filter.first_index;
+
+    if (index < N_own_filter.first_index || offset >= N_own_filter.built) {
+        return true;
+    }
+    return block_has(pubkey_hash, offset / OWN_FILTER_BLOCK_KEYS);
+}
+
+bool own_filter_find_key(const uint8_t *pubkey_hash, uint32_t *index) {
+    uint32_t first_index = N_own_filter.first_index;
+    uint32_t built = N_own_filter.built;
+    uint32_t block, offset;
+    uint8_t hash[20];
+
+    if (!own_filter_has_current_keys()) {
+        // the filter doesn't have any of our keys
+        return false;
+    }
+    for (block = 0; block * OWN_FILTER_BLOCK_KEYS < built; block++) {
+        if (!block_has(pubkey_hash, block)) {
+            continue;
+        }
+        offset = block * OWN_FILTER_BLOCK_KEYS;
+        for (; offset < (block + 1) * OWN_FILTER_BLOCK_KEYS && offset < built; offset++) {
+            key_index_pubkey_hash(first_index + offset, hash);
+            if (os_memcmp(hash, pubkey_hash, 20) == 0) {
+                *index = first_index + offset;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// replaces the filter by an empty one. The count is written last, so a filter that
+// was only partly reset can't be resumed
+static void reset_filter(uint32_t first_index, uint32_t count) {
+    uint8_t fingerprint[4];
+    uint32_t zero = 0;
+
+    parent_fingerprint(fingerprint);
+    nvm_write((void *)&N_own_filter.count, &zero, sizeof(zero));
+    nvm_write((void *)&N_own_filter.built, &zero, sizeof(zero));
+    nvm_write((void *)N_own_filter.bits, NULL, OWN_FILTER_SIZE);
+    nvm_write((void *)&N_own_filter.first_index, &first_index, sizeof(first_index));
+    nvm_write((void *)N_own_filter.parent_fingerprint, fingerprint, sizeof(fingerprint));
+    nvm_write((void *)&N_own_filter.count, &count, sizeof(count));
+}
+
+// adds the keys of the next block, if the filter isn't complete. Its bytes are built in
+// RAM and written at once. If it's interrupted, the block is added again, as built is
+// only updated at the end
+static void add_next_block() {
+    uint32_t first_index = N_own_filter.first_index;
+    uint32_t count = N_own_filter.count;
+    uint32_t built = N_own_filter.built;
+    uint32_t block = built / OWN_FILTER_BLOCK_KEYS;
+    uint8_t bits[OWN_FILTER_BLOCK_SIZE];
+    uint32_t position;
+    uint8_t hash[20];
+    uint8_t i;
+
+    if (built >= count || block >= OWN_FILTER_SIZE / OWN_FILTER_BLOCK_SIZE) {
+        // all keys are there, an empty block would erase the last one
+        return;
+    }
+    // a block is always added whole, so it starts empty
+    os_memset(bits, 0, sizeof(bits));
+    for (; built < count && built < (block + 1) * OWN_FILTER_BLOCK_KEYS; built++) {
+        key_index_pubkey_hash(first_index + built, hash);
+        for (i = 0; i < OWN_FILTER_HASHES; i++) {
+            position = bit_position(hash, block, i);
+            bits[position / 8] |= 1 << (position % 8);
+        }
+    }
+    nvm_write((void *)&N_own_filter.bits[block * OWN_FILTER_BLOCK_SIZE], bits, sizeof(bits));
+    nvm_write((void *)&N_own_filter.built, &built, sizeof(built));
+}
+
+static void send_status() {
+    write_u32(G_io_apdu_buffer, N_own_filter.first_index);
+    write_u32(G_io_apdu_buffer + 4, N_own_filter.count);
+    write_u32(G_io_apdu_buffer + 8, N_own_filter.built);
+    io_exchange_with_code(SW_OK, 12);
+}
+
+// Define the approval screen, eg:
+//
+//   Build key filter
+//     2048 keys?
+//
+static const bagl_element_t ui_ownFilter_approve[] = {
+    UI_BACKGROUND(),
+
+    // Rejection/approval icons, represented by a cross and a check mark,
+    // respectively.
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x01, BAGL_GLYPH_ICON_CHECK),
+
+    UI_TEXT(0x00, 0, 12, 128, "Build key filter"),
+    UI_TEXT(0x00, 0, 26, 128, global.own_filter_context.line2),
+};
+
+static const bagl_element_t* ui_prepro_ownFilter_approve(const bagl_element_t *element) {
+    if (element->component.userid == 1 && ctx->approved) {
+        // don't display icons after user approves, while adding the first block
+        return NULL;
+    } else {
+        return element;
+    }
+}
+
+// This is the button handler for the approval screen
+static unsigned int ui_ownFilter_approve_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    if (ctx->approved) {
+        // still adding the first block. Just ignore it.
+        return 0;
+    }
+
+    switch (button_mask) {
+    case BUTTON_EVT_RELEASED | BUTTON_LEFT: // REJECT
+        io_exchange_with_code(SW_USER_REJECTED, 0);
+        // Return to the main screen.
+        ui_idle();
+        break;
+
+    case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // APPROVE
+        ctx->approved = true;
+        reset_filter(ctx->first_index, ctx->count);
+        add_next_block();
+        send_status();
+        // the other blocks are added without the user
+        ui_idle();
+        break;
+    }
+    return 0;
+}
+
+/**
+ * handleOwnFilter is the entry point for the own filter command. It starts a new
+ * filter, after the user authorizes it, adds its keys a block at a time and tells
+ * how far the build is.
+ */
+void handleOwnFilter(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+    uint8_t len;
+
+    if (p1 == 2) {
+        send_status();
+        return;
+    }
+
+    if (p1 == 1) {
+        if (!own_filter_has_current_keys()) {
+            // there's no filter being built, or it was built with other keys and has
+            // to be started again
+            THROW(SW_IMPROPER_INIT);
+        }
+        if (N_own_filter.built < N_own_filter.count) {
+            add_next_block();
+        }
+        send_status();
+        return;
+    }
+
+    if (p1 != 0 || dataLength != 8) {
+        THROW(SW_INVALID_PARAM);
+    }
+    ctx->approved = false;
+    ctx->first_index = U4BE(dataBuffer, 0);
+    ctx->count = U4BE(dataBuffer, 4);
+    // only non-hardened indexes
+    if (ctx->count == 0 || ctx->count > OWN_FILTER_MAX_KEYS || ctx->first_index >= 0x80000000
+            || ctx->count > 0x80000000 - ctx->first_index) {
+        THROW(SW_INVALID_PARAM);
+    }
+
+    len = itoa(ctx->count, ctx->line2, 10);
+    strcpy(ctx->line2 + len, ctx->count == 1 ? " key?" : " keys?");
+    UX_DISPLAY(ui_ownFilter_approve, ui_prepro_ownFilter_approve);
+    *flags |= IO_ASYNCH_REPLY;
+}
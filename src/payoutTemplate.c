@@ -0,0 +1,399 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The payout template command registers the destinations of a recurring payout (eg.
+ * payroll), so its txs get a condensed review: the template's name and the total of
+ * each token, instead of every output (see sign_tx.c, p1 = 5). A template is the
+ * digest of its token uids and ordered destinations, the same one the tx decoder
+ * computes (see tx_finish_destinations_digest). Amounts aren't part of it, so they
+ * may change on every payout. Up to PAYOUT_TEMPLATES templates are kept on NVM, so
+ * they survive the app being closed.
+ *
+ * The user reviews the template once, when it's registered: its name, tokens and
+ * each destination, in order. Destinations on the address book show their label.
+ * Registering a template with the name of another one replaces it. Removing a
+ * template doesn't need the user's approval, as its txs can still be signed with
+ * a full review.
+ *
+ * | p1 | Data
+ * |----|------------------------------------
+ * | 0  | Name length (1 byte), name, number of tokens (1 byte), token uids (32 bytes each)
+ * | 1  | Destinations, as script type (1 byte) and hash (20 bytes), up to 12 per packet
+ * | 2  | None, asks the user to save the template
+ * | 3  | Name: removes the template
+ *
+ * The responses to p1 = 2 and p1 = 3 have the number of templates (1 byte).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include <string.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+// destinations in a packet: script type and hash
+#define DESTINATION_LEN             21
+#define MAX_PACKET_DESTINATIONS     12
+
+typedef struct {
+    payout_template_t templates[PAYOUT_TEMPLATES];
+} payout_templates_t;
+
+#ifdef HATHOR_HOST
+// NVM is plain memory on the host
+payout_templates_t N_payout_templates_real;
+#else
+const payout_templates_t N_payout_templates_real;
+#endif
+#define N_payout_templates (*(volatile payout_templates_t *)PIC(&N_payout_templates_real))
+
+static payout_template_context_t *ctx = &global.payout_template_context;
+
+bool payout_template_find(const uint8_t *digest, payout_template_t *out) {
+    uint8_t i, j;
+
+    for (i = 0; i < PAYOUT_TEMPLATES; i++) {
+        if (N_payout_templates.templates[i].outputs_len == 0) {
+            continue;
+        }
+        for (j = 0; j < 32 && N_payout_templates.templates[i].digest[j] == digest[j]; j++);
+        if (j == 32) {
+            os_memmove(out, (const void *)&N_payout_templates.templates[i], sizeof(payout_template_t));
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool same_name(uint8_t slot, const char *name) {
+    uint8_t i;
+
+    for (i = 0; i < PAYOUT_TEMPLATE_NAME_LEN; i++) {
+        if (N_payout_templates.templates[slot].name[i] != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// slot of the template with a given name, or PAYOUT_TEMPLATES if there's none
+static uint8_t find_name(const char *name) {
+    uint8_t i;
+
+    for (i = 0; i < PAYOUT_TEMPLATES; i++) {
+        if (N_payout_templates.templates[i].outputs_len != 0 && same_name(i, name)) {
+            break;
+        }
+    }
+    return i;
+}
+
+// slot where a template with a given name is saved: the one with its name or the
+// first empty one. PAYOUT_TEMPLATES if there's no room
+static uint8_t save_slot(const char *name) {
+    uint8_t i = find_name(name);
+
+    if (i < PAYOUT_TEMPLATES) {
+        return i;
+    }
+    for (i = 0; i < PAYOUT_TEMPLATES; i++) {
+        if (N_payout_templates.templates[i].outputs_len == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void send_len() {
+    uint8_t i;
+
+    G_io_apdu_buffer[0] = 0;
+    for (i = 0; i < PAYOUT_TEMPLATES; i++) {
+        if (N_payout_templates.templates[i].outputs_len != 0) {
+            G_io_apdu_buffer[0]++;
+        }
+    }
+    io_exchange_with_code(SW_OK, 1);
+}
+
+// reads a name of 1 to PAYOUT_TEMPLATE_NAME_LEN printable characters, padded with 0s
+static void read_name(const uint8_t *in, uint8_t len, char *out) {
+    uint8_t i;
+
+    if (len == 0 || len > PAYOUT_TEMPLATE_NAME_LEN) {
+        THROW(SW_INVALID_PARAM);
+    }
+    os_memset(out, 0, PAYOUT_TEMPLATE_NAME_LEN);
+    for (i = 0; i < len; i++) {
+        if (in[i] < 0x20 || in[i] > 0x7E) {
+            THROW(SW_INVALID_PARAM);
+        }
+        out[i] = in[i];
+    }
+}
+
+// copies the template's name to a NULL-terminated string
+static void copy_name(char *out) {
+    os_memmove(out, ctx->entry.name, PAYOUT_TEMPLATE_NAME_LEN);
+    out[PAYOUT_TEMPLATE_NAME_LEN] = '\0';
+}
+
+// number of items on the current stage: the name and each token, or each destination
+static uint8_t stage_len() {
+    return (ctx->stage == TEMPLATE_HEADER ? 1 + ctx->tokens_len : ctx->packet_len);
+}
+
+/*
+ * Prepare an item of the template, eg:
+ *   Payout template / Payroll
+ *   Token 1/1 / 00a1b2c3d4e5 / ...    (the whole token uid, in hex)
+ *   Destination 1 / HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo
+ *   Destination 2 / Kraken hot     (on the address book)
+ */
+static void prepare_item() {
+    static const char hex_digits[] = "0123456789abcdef";
+    const uint8_t *destination;
+    uint8_t len, i;
+
+    if (ctx->stage == TEMPLATE_HEADER && ctx->item == 0) {
+        strcpy(ctx->line1, "Payout template");
+        copy_name((char*)ctx->info);
+        len = strlen((char*)ctx->info);
+    } else if (ctx->stage == TEMPLATE_HEADER) {
+        len = strcpy_len(ctx->line1, "Token ");
+        len += itoa(ctx->item, ctx->line1 + len, 10);
+        ctx->line1[len++] = '/';
+        itoa(ctx->tokens_len, ctx->line1 + len, 10);
+        len = 0;
+        for (i = 0; i < 32; i++) {
+            ctx->info[len++] = hex_digits[ctx->tokens[ctx->item - 1][i] >> 4];
+            ctx->info[len++] = hex_digits[ctx->tokens[ctx->item - 1][i] & 0x0F];
+        }
+    } else {
+        len = strcpy_len(ctx->line1, "Destination ");
+        itoa(ctx->entry.outputs_len - ctx->packet_len + ctx->item + 1, ctx->line1 + len, 10);
+        destination = ctx->destinations + ctx->item * DESTINATION_LEN;
+        if (address_book_find(destination[0], destination + 1, (char*)ctx->info)) {
+            len = strlen((char*)ctx->info);
+        } else {
+            len = tx_format_address(destination[0], destination + 1, ctx->info, sizeof(ctx->info));
+        }
+    }
+    if (paginate(ctx->info, &len, 1, MAX_SCREEN_LENGTH, &ctx->pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    show_page(&ctx->pages, ctx->info, ctx->line2);
+}
+
+static const bagl_element_t* ui_prepro_payoutTemplate_confirm(const bagl_element_t *element) {
+    return element;
+}
+
+// Define the confirmation screen, after all destinations, eg:
+//
+//   Save template
+//   Payroll
+//
+static const bagl_element_t ui_payoutTemplate_confirm[] = {
+    UI_BACKGROUND(),
+
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x01, BAGL_GLYPH_ICON_CHECK),
+
+    UI_TEXT(0x00, 0, 12, 128, "Save template"),
+    UI_TEXT(0x00, 0, 26, 128, global.payout_template_context.line2),
+};
+
+// This is the button handler for the confirmation screen
+static unsigned int ui_payoutTemplate_confirm_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    uint8_t slot;
+
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // cancel
+            io_exchange_with_code(SW_USER_REJECTED, 0);
+            // Return to the main screen.
+            ui_idle();
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // confirm
+            // the handler already checked there's a slot for it
+            slot = save_slot(ctx->entry.name);
+            cx_hash(&ctx->sha256.header, CX_LAST, ctx->entry.digest, 0, ctx->entry.digest, 32);
+            nvm_write((void *)&N_payout_templates.templates[slot], &ctx->entry, sizeof(payout_template_t));
+            ctx->stage = TEMPLATE_NONE;
+            send_len();
+            ui_idle();
+            break;
+    }
+    return 0;
+}
+
+// Define the template screen. The user goes through the pages of each item with
+// left/right buttons and clicks both buttons to see the next one. After the last
+// item of a packet, we ask for the next one.
+static const bagl_element_t ui_payoutTemplate_compare[] = {
+    UI_BACKGROUND(),
+
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
+
+    UI_TEXT(0x00, 0, 12, 128, global.payout_template_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.payout_template_context.line2),
+};
+
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
+static const bagl_element_t* ui_prepro_payoutTemplate_compare(const bagl_element_t *element) {
+    switch (element->component.userid) {
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
+    default:
+        // Always display all other elements.
+        return element;
+    }
+}
+
+// This is the button handler for the template screen.
+static unsigned int ui_payoutTemplate_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    if (ctx->stage == TEMPLATE_WAITING) {
+        // waiting for the next packet. Just ignore it.
+        return 0;
+    }
+
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+                ctx->pages.current--;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+                ctx->pages.current++;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // NEXT ITEM
+            if (++ctx->item < stage_len()) {
+                prepare_item();
+                UX_REDISPLAY();
+            } else {
+                ctx->stage = TEMPLATE_WAITING;
+                io_exchange_with_code(SW_OK, 0);
+            }
+            break;
+    }
+    return 0;
+}
+
+// starts a template with its name and tokens and shows them to the user
+static void start_template(uint8_t *dataBuffer, uint16_t dataLength) {
+    uint8_t name_len, tokens_len, i;
+
+    if (dataLength < 1 || dataLength < 2 + dataBuffer[0]) {
+        THROW(SW_INVALID_PARAM);
+    }
+    name_len = dataBuffer[0];
+    tokens_len = dataBuffer[1 + name_len];
+    if (tokens_len > MAX_BATCH_TOKENS || dataLength != 2 + name_len + tokens_len * 32) {
+        THROW(SW_INVALID_PARAM);
+    }
+    os_memset(ctx, 0, sizeof(payout_template_context_t));
+    read_name(dataBuffer + 1, name_len, ctx->entry.name);
+    ctx->tokens_len = tokens_len;
+    for (i = 0; i < tokens_len; i++) {
+        os_memmove(ctx->tokens[i], dataBuffer + 2 + name_len + i * 32, 32);
+    }
+
+    // same as the tx decoder, from the number of tokens on
+    cx_sha256_init(&ctx->sha256);
+    cx_hash(&ctx->sha256.header, 0, dataBuffer + 1 + name_len, 1 + tokens_len * 32, NULL, 0);
+    ctx->stage = TEMPLATE_HEADER;
+}
+
+// adds a packet of destinations to the template and shows them to the user
+static void add_destinations(uint8_t *dataBuffer, uint16_t dataLength) {
+    uint8_t count = dataLength / DESTINATION_LEN;
+    uint8_t i;
+
+    if (dataLength == 0 || dataLength % DESTINATION_LEN != 0 || count > MAX_PACKET_DESTINATIONS
+            || ctx->entry.outputs_len + count > 255) {
+        THROW(SW_INVALID_PARAM);
+    }
+    for (i = 0; i < count; i++) {
+        if (dataBuffer[i * DESTINATION_LEN] != SCRIPT_P2PKH && dataBuffer[i * DESTINATION_LEN] != SCRIPT_P2SH) {
+            THROW(SW_INVALID_PARAM);
+        }
+    }
+    cx_hash(&ctx->sha256.header, 0, dataBuffer, dataLength, NULL, 0);
+    ctx->entry.outputs_len += count;
+    ctx->destinations = dataBuffer;
+    ctx->packet_len = count;
+    ctx->stage = TEMPLATE_DESTINATIONS;
+}
+
+/**
+ * handlePayoutTemplate is the entry point for the payout template command. It shows
+ * a new template to the user, a packet at a time, and saves it after the user
+ * authorizes it. It also removes templates.
+ */
+void handlePayoutTemplate(uint8_t p1, uint8_t p2, uint8_t *dataBuffer, uint16_t dataLength, volatile unsigned int *flags, volatile unsigned int *tx) {
+    char name[PAYOUT_TEMPLATE_NAME_LEN];
+    uint8_t slot;
+
+    switch (p1) {
+        case 0:
+            start_template(dataBuffer, dataLength);
+            break;
+        case 1:
+            if (ctx->stage != TEMPLATE_WAITING) {
+                THROW(SW_INVALID_PARAM);
+            }
+            add_destinations(dataBuffer, dataLength);
+            break;
+        case 2:
+            if (ctx->stage != TEMPLATE_WAITING || ctx->entry.outputs_len == 0 || dataLength != 0) {
+                THROW(SW_INVALID_PARAM);
+            }
+            if (save_slot(ctx->entry.name) == PAYOUT_TEMPLATES) {
+                // there's no room for it
+                THROW(SW_INVALID_PARAM);
+            }
+            ctx->stage = TEMPLATE_CONFIRM;
+            copy_name(ctx->line2);
+            UX_DISPLAY(ui_payoutTemplate_confirm, ui_prepro_payoutTemplate_confirm);
+            *flags |= IO_ASYNCH_REPLY;
+            return;
+        case 3:
+            read_name(dataBuffer, dataLength, name);
+            slot = find_name(name);
+            if (slot < PAYOUT_TEMPLATES) {
+                nvm_write((void *)&N_payout_templates.templates[slot], NULL, sizeof(payout_template_t));
+            }
+            send_len();
+            return;
+        default:
+            THROW(SW_INVALID_PARAM);
+    }
+
+    ctx->item = 0;
+    prepare_item();
+    UX_DISPLAY(ui_payoutTemplate_compare, ui_prepro_payoutTemplate_compare);
+    *flags |= IO_ASYNCH_REPLY;
+}
@@ -0,0 +1,303 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * The sign message command signs an arbitrary message with one or more keys of
+ * the wallet, after a single approval. The message may be much larger than an
+ * APDU, so it's never stored: it's streamed into a sha256 context as it arrives.
+ *
+ * The first packet (p1 = 0) starts with the message length (4 bytes, big endian),
+ * followed by the first bytes of the message. The remaining bytes come in the
+ * following p1 = 0 packets, up to 255 bytes at a time. We reply to each of them
+ * with SW_OK until the whole message has been received.
+ *
+ * Like Bitcoin's signed messages, what we sign is the sha256d of
+ *      [0x17, "Hathor Signed Message:\n", compact size of the message, message]
+ *
+ * so a signed message can never be mistaken for a transaction. The compact size is
+ * a single byte up to 0xFC, otherwise 0xFD or 0xFE followed by the size in 2 or 4
+ * bytes, little endian.
+ *
+ * After the last byte is received, the user is shown the start of the message and
+ * the first bytes of the digest, so they may be compared with the wallet's, and has
+ * to approve signing it. The wallet then asks for the signatures with p1 = 1, with
+ * the same key formats and p2 flags of the sign tx command: key indexes (4 bytes
+ * each) or bip32 paths (SIGN_P2_PATHS), DER or compact signatures (SIGN_P2_COMPACT)
+ * and, optionally, the public keys (SIGN_P2_PUBKEY). Several keys may be given in
+ * each request and any number of requests may be sent. p1 = 2 finishes the command.
+ *
+ * | p1 | Data
+ * |----|------------------------------------
+ * | 0  | Message length (first packet only), then the message, up to 255 bytes at a time
+ * | 1  | Key indexes (4 bytes each) or bip32 paths to sign the message
+ * | 2  | None
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <os_io_seproxyhal.h>
+#include <string.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+#include "ux.h"
+
+// bytes of the digest shown to the user
+#define DIGEST_DISPLAY_LEN 6
+
+static const char signed_message_magic[] = "Hathor Signed Message:\n";
+
+static sign_message_context_t *ctx = &global.sign_message_context;
+
+// adds the compact size of a value to the hash
+static void hash_compact_size(uint32_t value) {
+    uint8_t buf[5];
+    uint8_t len;
+
+    if (value < 0xFD) {
+        buf[0] = value;
+        len = 1;
+    } else if (value <= 0xFFFF) {
+        buf[0] = 0xFD;
+        buf[1] = value;
+        buf[2] = value >> 8;
+        len = 3;
+    } else {
+        buf[0] = 0xFE;
+        buf[1] = value;
+        buf[2] = value >> 8;
+        buf[3] = value >> 16;
+        buf[4] = value >> 24;
+        len = 5;
+    }
+    cx_hash(&ctx->sha256.header, 0, buf, len, NULL, 0);
+}
+
+/*
+ * Prepare the message review. Eg, for a message starting with "I own this address":
+ *   Sign message / I own this
+ *   Sign message / address
+ *   Sign message / Digest
+ *   Sign message / 1a2b3c4d5e6f
+ */
+static void prepare_display() {
+    static const char hex_digits[] = "0123456789abcdef";
+    uint8_t field_ends[2];
+    uint8_t len = ctx->prefix_len;
+    uint8_t i;
+
+    if (ctx->length == 0) {
+        len = strcpy_len((char*)ctx->info, "(empty)");
+    } else if (ctx->length > MESSAGE_PREFIX_LEN) {
+        len += strcpy_len((char*)ctx->info + len, "...");
+    }
+    field_ends[0] = len;
+    len += strcpy_len((char*)ctx->info + len, "Digest ");
+    for (i = 0; i < DIGEST_DISPLAY_LEN; i++) {
+        ctx->info[len++] = hex_digits[ctx->digest[i] >> 4];
+        ctx->info[len++] = hex_digits[ctx->digest[i] & 0x0F];
+    }
+    field_ends[1] = len;
+
+    if (paginate(ctx->info, field_ends, 2, MAX_SCREEN_LENGTH, &ctx->pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    show_page(&ctx->pages, ctx->info, ctx->line2);
+    strcpy(ctx->line1, "Sign message");
+}
+
+static const bagl_element_t* ui_prepro_sign_message_confirm(const bagl_element_t *element) {
+    if (element->component.userid == 1 && ctx->state == USER_APPROVED) {
+        // don't display icons after user confirms (when processing signatures)
+        return NULL;
+    } else {
+        return element;
+    }
+}
+
+static const bagl_element_t ui_sign_message_confirm[] = {
+    UI_BACKGROUND(),
+
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x01, BAGL_GLYPH_ICON_CHECK),
+
+    UI_TEXT(0x00, 0, 12, 128, global.sign_message_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.sign_message_context.line2),
+};
+
+// This is the button handler for the confirmation screen
+static unsigned int ui_sign_message_confirm_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    if (ctx->state == USER_APPROVED) {
+        // button pressed after it's been already confirmed,
+        // while processing signatures. Just ignore it.
+        return 0;
+    }
+
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // cancel
+            io_exchange_with_code(SW_USER_REJECTED, 0);
+            // Return to the main screen.
+            ui_idle();
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // confirm
+            ctx->state = USER_APPROVED;
+            io_exchange_with_code(SW_OK, 0);
+            strcpy(ctx->line1, "Processing");
+            strcpy(ctx->line2, "...");
+            UX_REDISPLAY();
+            break;
+    }
+    return 0;
+}
+
+// Define the message screen. User will be able to go through the pages of the
+// message and digest with left/right buttons. When he's done, he will click both
+// buttons and see the confirmation screen.
+static const bagl_element_t ui_sign_message_compare[] = {
+    UI_BACKGROUND(),
+
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
+
+    UI_TEXT(0x00, 0, 12, 128, global.sign_message_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.sign_message_context.line2),
+};
+
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
+static const bagl_element_t* ui_prepro_sign_message_compare(const bagl_element_t *element) {
+    switch (element->component.userid) {
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
+    default:
+        // Always display all other elements.
+        return element;
+    }
+}
+
+// This is the button handler for the message screen.
+static unsigned int ui_sign_message_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+                ctx->pages.current--;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+                ctx->pages.current++;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
+                UX_REDISPLAY();
+            }
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // PROCEED TO CONFIRMATION
+            strcpy(ctx->line1, "Sign");
+            strcpy(ctx->line2, "message?");
+            UX_DISPLAY(ui_sign_message_confirm, ui_prepro_sign_message_confirm);
+            break;
+    }
+    return 0;
+}
+
+// receives a chunk of the message and adds it to the hash. After the last one, the
+// message is shown to the user for approval
+static void receive_message(uint8_t *data_buffer, uint16_t data_length, volatile unsigned int *flags) {
+    uint8_t i;
+
+    if (ctx->state == UNINITIALIZED) {
+        // the first chunk starts with the message length
+        if (data_length < 4) {
+            THROW(SW_INVALID_PARAM);
+        }
+        ctx->state = RECEIVING_DATA;
+        ctx->length = U4BE(data_buffer, 0);
+        ctx->remaining = ctx->length;
+        ctx->prefix_len = 0;
+        data_buffer += 4;
+        data_length -= 4;
+
+        cx_sha256_init(&ctx->sha256);
+        hash_compact_size(sizeof(signed_message_magic) - 1);
+        cx_hash(&ctx->sha256.header, 0, (uint8_t*)signed_message_magic, sizeof(signed_message_magic) - 1, NULL, 0);
+        hash_compact_size(ctx->length);
+    }
+
+    if (data_length > ctx->remaining) {
+        THROW(SW_INVALID_PARAM);
+    }
+    cx_hash(&ctx->sha256.header, 0, data_buffer, data_length, NULL, 0);
+    ctx->remaining -= data_length;
+
+    // keep the start of the message for display, replacing what can't be shown
+    for (i = 0; i < data_length && ctx->prefix_len < MESSAGE_PREFIX_LEN; i++) {
+        ctx->info[ctx->prefix_len++] = (data_buffer[i] >= 0x20 && data_buffer[i] <= 0x7E) ? data_buffer[i] : '?';
+    }
+
+    if (ctx->remaining > 0) {
+        // ask for the rest of the message
+        THROW(SW_OK);
+    }
+
+    // finish the sha256 and hash it again
+    cx_hash(&ctx->sha256.header, CX_LAST, ctx->digest, 0, ctx->digest, 32);
+    cx_sha256_init(&ctx->sha256);
+    cx_hash(&ctx->sha256.header, CX_LAST, ctx->digest, 32, ctx->digest, 32);
+
+    prepare_display();
+    UX_DISPLAY(ui_sign_message_compare, ui_prepro_sign_message_compare);
+    *flags |= IO_ASYNCH_REPLY;
+}
+
+// signs the message digest with each requested key and sends all signatures in a
+// single response
+static void send_signatures(uint8_t p2, uint8_t *data_buffer, uint16_t data_length) {
+    io_exchange_with_code(SW_OK, sign_with_keys(ctx->digest, 0, p2, data_buffer, data_length, ctx->keys));
+}
+
+void handle_sign_message(uint8_t p1, uint8_t p2, uint8_t *data_buffer, uint16_t data_length, volatile unsigned int *flags, volatile unsigned int *tx) {
+    switch (p1) {
+        case 0:
+            // we're receiving the message
+            if (ctx->state == USER_APPROVED) {
+                // can't receive more data after user's approval
+                io_exchange_with_code(SW_INVALID_PARAM, 0);
+                ui_idle();
+                return;
+            }
+            receive_message(data_buffer, data_length, flags);
+            break;
+
+        case 1:
+            // asking for signatures
+            if (ctx->state != USER_APPROVED) {
+                // the user must have approved already
+                io_exchange_with_code(SW_DEVELOPER_ERR, 0);
+                ui_idle();
+                return;
+            }
+            send_signatures(p2, data_buffer, data_length);
+            break;
+
+        case 2:
+            // all done, go back to main menu
+            io_exchange_with_code(SW_OK, 0);
+            ui_idle();
+            break;
+
+        default:
+            THROW(SW_INVALID_PARAM);
+    }
+}
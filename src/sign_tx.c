@@ -22,6 +22,15 @@
  *      . 0x03 - change is output with index 3 (output index start at 0)
  *      . [0x00, 0x00, 0x00, 0x05] - change is sent to key with index 5 (44'/280'/0'/0/5)
  *
+ * Keys on other accounts or chains are given by their full bip32 path, under
+ * 44'/280', as [path_len (1 byte), index (4 bytes) * path_len]. For the change,
+ * the first byte must then be 0x02. Eg, for 44'/280'/1'/1/5:
+ *      [0x02, 0x03, 0x05, 0x8000002C, 0x80000118, 0x80000001, 0x00000001, 0x00000005]
+ *
+ * If the first byte is 0x03, only the change output index follows and the key is
+ * looked up on the own keys filter (see ownFilter.c), among the keys of its range:
+ *      [0x03, 0x03]
+ *
  * Immediately after the change output info, still in the first packet, we start
  * receiving the sighash_all data for the transaction. This is the data that will
  * be signed by Ledger so the inputs can be spent. This data may be very large
@@ -31,8 +40,14 @@
  * use p1 = 0.
  *
  * The code on sign_tx parses the sighash_all data to display information about
- * the transaction to the user. Currently, we only display output info, but we
- * will include token information in the future.
+ * the transaction to the user. Currently, we only display output info and, on
+ * token creation transactions, the new token's symbol and minted amount.
+ *
+ * The sighash_all data starts with the tx version (2 bytes), which selects the
+ * decoder for the rest of the data (see tx_decoders):
+ *   . regular txs (version 1): token uids, inputs and outputs;
+ *   . token creation txs (version 2): inputs, outputs and the new token's info
+ *     (name and symbol).
  *
  * The data is parsed iteratively until everything is received from the wallet.
  * This means that in the first packet we may only have data available for the
@@ -47,22 +62,69 @@
  * wallet, so there's no harm in 'hiding' this output from the user. This is
  * done in `verify_change_output`.
  *
+ * Multisig wallets (P2SH) register their redeem script once per session, before
+ * sending the change output info of a tx, using p1 = 3. This packet has the index of
+ * one of our keys (4 bytes) followed by the redeem script:
+ *      [key_index (4 bytes), OP_m, (33, pubkey) * n, OP_n, OP_CHECKMULTISIG]
+ *
+ * We check that the public key for the given index is one of the script's keys. The
+ * user then reviews the wallet's P2SH address and the fingerprint of each cosigner's
+ * key (the first 4 bytes of its hash160), and approves the m-of-n wallet. From then
+ * on, until the app is closed, a P2SH output paying to the hash160 of this script may
+ * be used as the change output. Registering another script replaces it, while the
+ * same one is accepted again without a review. Signatures for the multisig inputs
+ * are requested with p1 = 1, just like any other input, as they all sign the same
+ * sighash_all data.
+ *
  * After we receive all data and the user confirms all outputs, a final screen
  * is displayed asking whether the user wants to sign the tx. If he agrees, we
  * send this info back to the wallet and expect to receive in the next packet(s)
- * the key index to sign the sighash_all data. Each packet from this point on
- * corresponds to a request to sign the data with the corresponding key and use
- * p1 = 1. We reply to each request with the signature for the given key. When
- * the wallet collects all signatures it needs, it sends a packet saying that
- * all is done (p1 = 2). Ledger will then go back to the main display.
+ * the key indexes to sign the sighash_all data. Each packet from this point on
+ * corresponds to a request to sign the data with one or more keys and use
+ * p1 = 1. We reply to each request with the signatures for the given keys, in
+ * the same order. When the wallet collects all signatures it needs, it sends a
+ * packet saying that all is done (p1 = 2). Ledger will then go back to the main
+ * display.
+ *
+ * Signatures are DER encoded by default, so up to 3 fit in a response. With
+ * p2 = 0x01, they're sent in compact form instead: r and s as 32-byte big endian
+ * integers, with low-S. Those have a fixed size and up to 4 fit in a response.
+ * With p2 = 0x02, each signature is followed by the 33-byte compressed public key
+ * of its key, which the wallet needs for the input data. Both flags may be combined,
+ * but then only 2 signatures fit in a response. With p2 = 0x04, keys are given as
+ * bip32 paths instead of key indexes.
+ *
+ * Batches of regular txs (version 1) may be approved at once, using p1 = 4 instead
+ * of p1 = 0. The first packet starts with the number of txs in the batch (up to
+ * MAX_BATCH_TXS), followed by the first tx's change output info and sighash_all
+ * data, just like p1 = 0. Each of the following txs must start on a new packet, with
+ * its own change output info. Each tx is hashed into its own sighash and, instead of
+ * showing every output, we show a single review after the last tx: the number of
+ * txs, the total sent of each token and every destination address. Batches can't
+ * have authority outputs and are limited to MAX_BATCH_TOKENS custom tokens and
+ * MAX_BATCH_DESTINATIONS addresses. After the approval, signatures are requested
+ * with p1 = 1 and p2 = 0x08, where each key is preceded by the number of its tx
+ * in the batch (1 byte, starting at 0). Eg, key index 5 for the third tx:
+ *      [0x02, 0x00, 0x00, 0x00, 0x05]
+ *
+ * A regular tx may instead be received with p1 = 5, just like p1 = 0, to be reviewed
+ * by a payout template (see payoutTemplate.c). Its outputs aren't shown: the decoder
+ * hashes its token uids and the destinations of its outputs, other than the change,
+ * and the digest must match a template. The user then reviews the template's name,
+ * the number of outputs and the total of each token, like a batch review. Signatures
+ * are requested as for a single tx.
  *
  * Summary:
  *
  * | p1 | Data
  * |----|------------------------------------
  * | 0  | Change output info and sighash_all, up to 255 bytes at a time
- * | 1  | Key index to sign the sighash data (4 bytes)
+ * | 1  | Key indexes (4 bytes each) or bip32 paths to sign the sighash data, preceded
+ * |    | by the tx number on batches
  * | 2  | None
+ * | 3  | Key index (4 bytes) or bip32 path and multisig redeem script, before any p1 = 0 packet
+ * | 4  | Number of txs (first packet only), then change output info and sighash_all of each tx
+ * | 5  | Change output info and sighash_all of a tx matching a payout template
  */
 
 #include <stdint.h>
@@ -72,99 +134,150 @@
 #include <string.h>
 #include "hathor.h"
 #include "util.h"
+#include "tx_decoder.h"
 #include "ux.h"
 
 static sign_tx_context_t *ctx = &global.sign_tx_context;
 
-typedef enum {
-    ELEM_TOKEN_UID,
-    ELEM_INPUT,
-    ELEM_OUTPUT,
-} tx_element_type_e;
-
-// verifies an output sends its funds to a given key index, belonging to this
-// wallet. Used for confirming the change output is actually sent back to the
-// wallet owner and not another wallet. Returns false if not valid.
-bool verify_change_output(tx_output_t output, uint8_t index) {
-    // bip32 path for 44'/280'/0'/0/key_index
+// p2 flag when asking for signatures (p1 = 1), besides the SIGN_P2_* flags. Paths
+// (SIGN_P2_PATHS) may also be used for p1 = 3
+#define SIGN_TX_P2_BATCH    0x08    // each key is preceded by the number of its tx in the batch
+
+// verifies an output sends its funds to a given key, belonging to this wallet.
+// Used for confirming the change output is actually sent back to the wallet
+// owner and not another wallet. Without a path, the key is looked up on the own
+// keys filter. Returns false if not valid.
+bool verify_change_output(const tx_output_t *output, uint32_t *path, uint8_t path_len) {
+    crypto_scratch_t *scratch;
     uint8_t hash[20];
-    cx_ecfp_public_key_t public_key;
-    cx_ecfp_private_key_t private_key;
-
-    // get key pair for path 44'/280'/0'/0/index
-    derive_keypair(&private_key, &public_key, NULL, 2, 0, index);
-    compress_public_key(public_key.W);
-    hash160(public_key.W, 33, hash);
-    // erase sensitive data
-    explicit_bzero(&private_key, sizeof(private_key));
-    explicit_bzero(&public_key, sizeof(public_key));
-    if (os_memcmp(hash, output.pubkey_hash, 20) != 0) {
+    uint32_t index;
+
+    if (output->script_type == SCRIPT_P2SH) {
+        // multisig change must go back to the redeem script approved by the user
+        return session.has_redeem_script && os_memcmp(session.redeem_script_hash, output->pubkey_hash, 20) == 0;
+    }
+    if (path_len == 0) {
+        return own_filter_find_key(output->pubkey_hash, &index);
+    }
+
+    scratch = scratch_acquire();
+    derive_keypair(&scratch->keys.private_key, &scratch->keys.public_key, NULL, path, path_len);
+    compress_public_key(scratch->keys.public_key.W);
+    hash160(scratch->keys.public_key.W, 33, hash);
+    scratch_release();
+    if (os_memcmp(hash, output->pubkey_hash, 20) != 0) {
         // not the same
         return false;
     }
     return true;
 }
 
-// tries to decode an element from the context's buffer
-void _decode_next_element() {
-    if (ctx->remaining_tokens > 0) {
-        // read one token uid
-        if (ctx->buffer_len < 32) {
-            THROW(TX_STATE_PARTIAL);
-        }
-        // for now, we ignore it
-        ctx->remaining_tokens--;
-        ctx->buffer_len -= 32;
-        ctx->elem_type = ELEM_TOKEN_UID;
-        os_memmove(ctx->buffer, ctx->buffer + 32, ctx->buffer_len);
-    } else if (ctx->remaining_inputs > 0) {
-        // read input
-        if (ctx->buffer_len < 35) {     // tx_id (32 bytes) + index (1 byte) + data_len (2 bytes)
-            THROW(TX_STATE_PARTIAL);
+// adds a token uid of the current tx to the batch, if it's not there yet
+static void batch_add_token(const uint8_t *uid) {
+    sign_tx_batch_t *batch = &ctx->batch;
+    uint8_t i;
+
+    if (batch->tx_tokens_len == MAX_BATCH_TOKENS) {
+        THROW(TX_STATE_ERR);
+    }
+    for (i = 0; i < batch->tokens_len; i++) {
+        if (os_memcmp(batch->tokens[i].uid, uid, 32) == 0) {
+            break;
         }
-        // we require the input data to be empty because we're signing the whole
-        // bytes we get from the wallet (in sighash_all, inputs must have no data)
-        if (U2BE(ctx->buffer, 33) > 0) {
+    }
+    if (i == batch->tokens_len) {
+        if (batch->tokens_len == MAX_BATCH_TOKENS) {
             THROW(TX_STATE_ERR);
         }
-        // we ignore it
-        ctx->remaining_inputs--;
-        ctx->buffer_len -= 35;
-        ctx->elem_type = ELEM_INPUT;
-        os_memmove(ctx->buffer, ctx->buffer + 35, ctx->buffer_len);
-    } else if (ctx->current_output < ctx->outputs_len) {
-        uint8_t *buf = parse_output(ctx->buffer, ctx->buffer_len, &ctx->decoded_output);
-        ctx->decoded_output.index = ctx->current_output;
-        ctx->elem_type = ELEM_OUTPUT;
-        ctx->buffer_len -= (buf - ctx->buffer);
-        os_memmove(ctx->buffer, buf, ctx->buffer_len);
-        ctx->current_output++;
+        os_memmove(batch->tokens[i].uid, uid, 32);
+        batch->tokens[i].total = 0;
+        batch->tokens_len++;
+    }
+    batch->tx_token_map[batch->tx_tokens_len++] = i;
+}
+
+// adds an output of the current tx to the batch totals. Authority outputs are not
+// part of the batch review, so they're not accepted
+static void batch_add_total(const tx_output_t *output) {
+    sign_tx_batch_t *batch = &ctx->batch;
+    uint8_t token_index = output->token_data & TOKEN_INDEX_MASK;
+    uint64_t *total;
+
+    if (output->authorities) {
+        THROW(TX_STATE_ERR);
+    }
+    if (token_index == 0) {
+        total = &batch->htr_total;
+    } else if (token_index <= batch->tx_tokens_len) {
+        total = &batch->tokens[batch->tx_token_map[token_index - 1]].total;
     } else {
-        // end of data we should read. Is there something left on the buffer?
-        if (ctx->buffer_len > 0) {
-            THROW(TX_STATE_ERR);
+        THROW(TX_STATE_ERR);
+    }
+    if (*total + output->value < *total) {
+        // overflow
+        THROW(TX_STATE_ERR);
+    }
+    *total += output->value;
+}
+
+// adds an output of the current tx to the batch totals and destinations
+static void batch_add_output(const tx_output_t *output) {
+    sign_tx_batch_t *batch = &ctx->batch;
+    uint8_t i;
+
+    batch_add_total(output);
+    for (i = 0; i < batch->destinations_len; i++) {
+        if (batch->destinations[i].script_type == output->script_type
+                && os_memcmp(batch->destinations[i].hash, output->pubkey_hash, 20) == 0) {
+            return;
         }
-        THROW(TX_STATE_FINISHED);
     }
+    // every destination must be on the review
+    if (batch->destinations_len == MAX_BATCH_DESTINATIONS) {
+        THROW(TX_STATE_ERR);
+    }
+    batch->destinations[i].script_type = output->script_type;
+    os_memmove(batch->destinations[i].hash, output->pubkey_hash, 20);
+    batch->destinations_len++;
+}
 
-    switch (ctx->elem_type) {
+// tries to decode an element from the context's data
+void _decode_next_element() {
+    tx_decode_element(&ctx->tx);
+
+    switch (ctx->tx.elem_type) {
         case ELEM_TOKEN_UID:
-            // not displaying token uid now
+            // not displaying token uid now, we only need it for the batch totals
+            if (ctx->batch.active || ctx->payout) {
+                batch_add_token(ctx->tx.token_uid);
+            }
             break;
         case ELEM_INPUT:
             // not displaying inputs
             break;
         case ELEM_OUTPUT:
             // check if this is the change output
-            if (ctx->has_change_output && ctx->change_output_index == ctx->decoded_output.index) {
-                if (!verify_change_output(ctx->decoded_output, ctx->change_key_index)) {
+            if (ctx->tx.has_change_output && ctx->tx.change_output_index == ctx->tx.decoded_output.index) {
+                if (!verify_change_output(&ctx->tx.decoded_output, ctx->tx.change_path, ctx->tx.change_path_len)) {
                     THROW(TX_STATE_ERR);
                 }
+            } else if (ctx->batch.active) {
+                // outputs of a batch are only displayed on its review, at the end
+                batch_add_output(&ctx->tx.decoded_output);
+            } else if (ctx->payout) {
+                // the template has the destinations, so only the totals are shown
+                batch_add_total(&ctx->tx.decoded_output);
             } else {
                 // if it's not change output, raise TX_STATE_READY to display output on screen
                 THROW(TX_STATE_READY);
             }
             break;
+        case ELEM_TOKEN_NAME:
+            // we only display the symbol
+            break;
+        case ELEM_TOKEN_INFO:
+            // display the new token
+            THROW(TX_STATE_READY);
     }
 }
 
@@ -172,7 +285,7 @@ tx_decoder_state_e decode_next_element() {
     volatile tx_decoder_state_e result;
     BEGIN_TRY {
         TRY {
-            // read until we reach a displayable element or the end of the buffer
+            // read until we reach a displayable element or the end of the packet
             for (;;) {
                 _decode_next_element();
             }
@@ -184,30 +297,18 @@ tx_decoder_state_e decode_next_element() {
         }
     }
     END_TRY;
+    if (result == TX_STATE_PARTIAL && !tx_carry_partial_element(&ctx->tx)) {
+        result = TX_STATE_ERR;
+    }
     return result;
 }
 
-/*
- * Parses the change output info and returns its size. The first byte indicates
- * whether there's change or not (no change output if byte=0x00). There are 2
- * possible return values:
- *   . 1: if there's no change output, it's only 1 byte;
- *   . 6: if there is, it's [change_exists (1 byte) + output_index (1 byte) + key_index (4 bytes)]
- */
-static uint8_t parse_change_output_info(uint8_t *in, size_t inlen) {
-    uint8_t *buf = in;
-    assert_length(1, inlen);
-    // check output change. If next byte is greater than 0, there's a change output
-    ctx->has_change_output = (*buf > 0 ? true : false);
-    buf++;
-    if (ctx->has_change_output) {
-        assert_length(5, inlen - 1);
-        ctx->change_output_index = *buf;
-        buf++;
-        ctx->change_key_index = U4BE(buf, 0);
-        buf += 4;
-    }
-    return buf - in;
+// splits info in pages and shows the first one on line2
+static void paginate_info(const uint8_t *field_ends, uint8_t fields) {
+    if (paginate(ctx->info, field_ends, fields, MAX_SCREEN_LENGTH, &ctx->pages) == 0) {
+        THROW(SW_DEVELOPER_ERR);
+    }
+    show_page(&ctx->pages, ctx->info, ctx->line2);
 }
 
 /*
@@ -215,41 +316,168 @@ static uint8_t parse_change_output_info(uint8_t *in, size_t inlen) {
  *   Output 1/3
  *   HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo HTR 12.00
  *
- * The second line is always scrollable, as it doesn't fit Ledger's display.
+ * The second line doesn't fit Ledger's display, so it's split in pages: the
+ * address takes 3 of them and the token and value get their own page(s), eg:
+ *   HHVnn9mr8yPR / eovgt7AoeJRg / S5QoXMa5fo / HTR 12.00
+ *
  * First line shows the current output index and total outputs, not considering
  * the change output. Indexes start at 1.
+ *
+ * Authority outputs don't carry any value, so we show the authorities instead:
+ *   Authority 2/3
+ *   HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo Mint+Melt
+ *
+ * Outputs sending value to a destination on the address book show its label
+ * instead of the title and address, on a single screen:
+ *   Kraken hot
+ *   HTR 1,000.00
+ *
+ * Authority outputs always have their title and address, so they can't be
+ * mistaken for a payment.
+ */
+static void prepare_display_output(const tx_output_t *output) {
+    uint8_t field_ends[2];
+    tx_format_output(&ctx->tx, output, ctx->info, field_ends);
+    if (!output->authorities && address_book_find(output->script_type, output->pubkey_hash, ctx->line1)) {
+        // drop the address, keeping only the token and value
+        field_ends[1] -= field_ends[0];
+        os_memmove(ctx->info, ctx->info + field_ends[0], field_ends[1]);
+        paginate_info(&field_ends[1], 1);
+        return;
+    }
+    paginate_info(field_ends, 2);
+    tx_format_output_title(&ctx->tx, output, ctx->line1);
+}
+
+/*
+ * Prepare the token being created on a token creation tx, with the total amount
+ * minted on its outputs:
+ *   Create token
+ *   TKN 1,000.00
+ */
+static void prepare_display_token_info() {
+    uint8_t len = tx_format_token_info(&ctx->tx, ctx->info);
+    paginate_info(&len, 1);
+
+    strcpy(ctx->line1, "Create token");
+}
+
+// prepare the last decoded element to be displayed
+static void prepare_display_element() {
+    switch (ctx->tx.elem_type) {
+        case ELEM_OUTPUT:
+            prepare_display_output(&ctx->tx.decoded_output);
+            break;
+        case ELEM_TOKEN_INFO:
+            prepare_display_token_info();
+            break;
+        default:
+            THROW(SW_INVALID_PARAM);
+    }
+}
+
+// number of items on the batch review: the summary, the HTR total, the total of
+// each custom token and each destination. Payouts don't show their destinations
+static uint8_t batch_review_len() {
+    return 2 + ctx->batch.tokens_len + (ctx->payout ? 0 : ctx->batch.destinations_len);
+}
+
+/*
+ * Prepare an item of the batch review, instead of showing each output of each tx.
+ * Eg, for 8 txs sending HTR and a custom token to 2 addresses:
+ *   Review batch / 8 txs
+ *   Total HTR / 1,000.00
+ *   Total token 1/1 / 00a1b2c3d4e5 / ... / 50.00    (the whole token uid, in hex)
+ *   Destination 1/2 / HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo
+ *   Destination 2/2 / HJ6Mxy3j2nNeRK5NW4yTd9bHNuSovHr9Bm
+ *
+ * Destinations on the address book show their label instead of the address.
+ *
+ * A payout starts with its template's name and number of outputs instead, and its
+ * destinations are not shown. Its tokens were reviewed in full with the template, so
+ * their totals only have the first 4 bytes of the uid:
+ *   Payroll / 12 outputs
+ *   Total HTR / 1,000.00
+ *   Total 00a1b2c3 / 50.00
  */
-static void prepare_display_output(tx_output_t output) {
-    // first prepare the address + value line
-    unsigned char address[25];
-    pubkey_hash_to_address(output.pubkey_hash, address);
-    uint8_t len = encode_base58(address, 25, ctx->info, sizeof(ctx->info));
-    os_memmove(ctx->info + len, " HTR ", 5);
-    format_value(output.value, ctx->info + len + 5);
-
-    // line1
-    uint8_t total_outputs = ctx->outputs_len;
-    // fake_output_index is used to display consecutive indexes to the user when there's
-    // change output. Also, output indexes start at 0, so add 1 to start on 1
-    uint8_t fake_output_index = ctx->decoded_output.index + 1;
-    if (ctx->has_change_output) {
-        // change output is not shown to user
-        // if there's change output, subtract one
-        total_outputs = ctx->outputs_len - 1;
-        if (ctx->decoded_output.index > ctx->change_output_index) {
-            // outputs after the change output don't need to add 1
-            fake_output_index = ctx->decoded_output.index;
+static void prepare_batch_review_item() {
+    static const char hex_digits[] = "0123456789abcdef";
+    sign_tx_batch_t *batch = &ctx->batch;
+    uint8_t item = batch->review_item;
+    uint8_t field_ends[2];
+    const uint8_t *uid;
+    uint8_t len, i;
+
+    if (item == 0 && ctx->payout) {
+        os_memmove(ctx->line1, ctx->payout_template.name, PAYOUT_TEMPLATE_NAME_LEN);
+        ctx->line1[PAYOUT_TEMPLATE_NAME_LEN] = '\0';
+        len = itoa(ctx->payout_template.outputs_len, (char*)ctx->info, 10);
+        len += strcpy_len((char*)ctx->info + len, ctx->payout_template.outputs_len == 1 ? " output" : " outputs");
+        paginate_info(&len, 1);
+        return;
+    }
+    if (item == 0) {
+        strcpy(ctx->line1, "Review batch");
+        len = itoa(batch->tx_count, (char*)ctx->info, 10);
+        len += strcpy_len((char*)ctx->info + len, " txs");
+        paginate_info(&len, 1);
+        return;
+    }
+
+    item--;
+    if (item == 0) {
+        strcpy(ctx->line1, "Total HTR");
+        len = format_value(batch->htr_total, ctx->info);
+        paginate_info(&len, 1);
+        return;
+    }
+    if (item <= batch->tokens_len && ctx->payout) {
+        len = strcpy_len(ctx->line1, "Total ");
+        for (i = 0; i < 4; i++) {
+            ctx->line1[len++] = hex_digits[batch->tokens[item - 1].uid[i] >> 4];
+            ctx->line1[len++] = hex_digits[batch->tokens[item - 1].uid[i] & 0x0F];
         }
+        ctx->line1[len] = '\0';
+        len = format_value(batch->tokens[item - 1].total, ctx->info);
+        paginate_info(&len, 1);
+        return;
     }
-    strcpy(ctx->line1, "Output ");
-    itoa(fake_output_index, ctx->line1 + 7, 10);
-    len = strlen(ctx->line1);
+    if (item <= batch->tokens_len) {
+        // nothing else binds the token, so its whole uid is shown before the total
+        len = strcpy_len(ctx->line1, "Total token ");
+        len += itoa(item, ctx->line1 + len, 10);
+        ctx->line1[len++] = '/';
+        itoa(batch->tokens_len, ctx->line1 + len, 10);
+        uid = batch->tokens[item - 1].uid;
+        len = 0;
+        for (i = 0; i < 32; i++) {
+            ctx->info[len++] = hex_digits[uid[i] >> 4];
+            ctx->info[len++] = hex_digits[uid[i] & 0x0F];
+        }
+        field_ends[0] = len;
+        field_ends[1] = len + format_value(batch->tokens[item - 1].total, ctx->info + len);
+        paginate_info(field_ends, 2);
+        return;
+    }
+
+    item -= batch->tokens_len + 1;
+    if (address_book_find(batch->destinations[item].script_type, batch->destinations[item].hash, (char*)ctx->info)) {
+        len = strlen((char*)ctx->info);
+    } else {
+        len = tx_format_address(batch->destinations[item].script_type, batch->destinations[item].hash, ctx->info, sizeof(ctx->info));
+    }
+    paginate_info(&len, 1);
+    len = strcpy_len(ctx->line1, "Destination ");
+    len += itoa(item + 1, ctx->line1 + len, 10);
     ctx->line1[len++] = '/';
-    itoa(total_outputs, ctx->line1 + len, 10);
+    itoa(batch->destinations_len, ctx->line1 + len, 10);
+}
 
-    // line2
-    os_memmove(ctx->line2, ctx->info + ctx->display_index, MAX_SCREEN_LENGTH);
-    ctx->line2[MAX_SCREEN_LENGTH] = '\0';
+// finishes the sha256 of the tx data and hashes it again, giving the data to be signed
+static void finish_sighash(uint8_t *out) {
+    cx_hash(&ctx->sha256.header, CX_LAST, out, 0, out, 32);
+    cx_sha256_init(&ctx->sha256);
+    cx_hash(&ctx->sha256.header, CX_LAST, out, 32, out, 32);
 }
 
 static const bagl_element_t* ui_prepro_sign_tx_confirm(const bagl_element_t *element) {
@@ -292,6 +520,10 @@ static unsigned int ui_sign_tx_confirm_button(unsigned int button_mask, unsigned
         case BUTTON_RIGHT:
         case BUTTON_EVT_FAST | BUTTON_RIGHT: // confirm
             ctx->state = USER_APPROVED;
+            if (!ctx->batch.active) {
+                // each tx of a batch has been hashed when it was received
+                finish_sighash(ctx->sighash_all);
+            }
             io_exchange_with_code(SW_OK, 0);
             strcpy(ctx->line1, "Processing");
             strcpy(ctx->line2, "...");
@@ -301,31 +533,144 @@ static unsigned int ui_sign_tx_confirm_button(unsigned int button_mask, unsigned
     return 0;
 }
 
-// Define the sign tx screen. User will be able to scroll through an output.
+// shows the final confirmation, for a single tx or the whole batch
+static void display_confirm() {
+    uint8_t len;
+    if (ctx->batch.active) {
+        strcpy(ctx->line1, "Send batch");
+        len = strcpy_len(ctx->line2, "of ");
+        len += itoa(ctx->batch.tx_count, ctx->line2 + len, 10);
+        strcpy(ctx->line2 + len, " txs?");
+    } else if (ctx->payout) {
+        strcpy(ctx->line1, "Send payout");
+        strcpy(ctx->line2, "transaction?");
+    } else {
+        strcpy(ctx->line1, "Send");
+        strcpy(ctx->line2, "transaction?");
+    }
+    UX_DISPLAY(ui_sign_tx_confirm, ui_prepro_sign_tx_confirm);
+}
+
+static const bagl_element_t* ui_prepro_sign_tx_multisig(const bagl_element_t *element) {
+    return element;
+}
+
+// Define the multisig screen, where the user approves co-signing for an m-of-n wallet
+static const bagl_element_t ui_sign_tx_multisig[] = {
+    UI_BACKGROUND(),
+
+    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_CROSS),
+    UI_ICON_RIGHT(0x01, BAGL_GLYPH_ICON_CHECK),
+
+    UI_TEXT(0x00, 0, 12, 128, global.sign_tx_context.line1),
+    UI_TEXT(0x00, 0, 26, 128, global.sign_tx_context.line2),
+};
+
+// This is the button handler for the multisig screen
+static unsigned int ui_sign_tx_multisig_button(unsigned int button_mask, unsigned int button_mask_counter) {
+    switch (button_mask) {
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // reject
+            io_exchange_with_code(SW_USER_REJECTED, 0);
+            // Return to the main screen.
+            ui_idle();
+            break;
+
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // approve
+            // the wallet is kept for the session, so the txs are sent on later commands
+            os_memmove(session.redeem_script_hash, ctx->redeem_script_hash, 20);
+            session.has_redeem_script = true;
+            io_exchange_with_code(SW_OK, 0);
+            ui_idle();
+            break;
+    }
+    return 0;
+}
+
+// writes "m of n" to out and returns its length
+static uint8_t format_multisig(char *out) {
+    uint8_t len = itoa(ctx->multisig_m, out, 10);
+
+    len += strcpy_len(out + len, " of ");
+    len += itoa(ctx->multisig_n, out + len, 10);
+    return len;
+}
+
+/*
+ * Prepare an item of the multisig review: the wallet's address, then the fingerprint
+ * of each cosigner's key (the first 4 bytes of its hash160), eg:
+ *   Multisig 2 of 3 / HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo   (P2SH address)
+ *   Cosigner 1/3 / 1a2b3c4d
+ *   Cosigner 2/3 / 5e6f7a8b / This device
+ */
+static void prepare_multisig_item() {
+    static const char hex_digits[] = "0123456789abcdef";
+    const uint8_t *pubkey;
+    uint8_t field_ends[2];
+    uint8_t hash[20];
+    uint8_t len, i;
+
+    if (ctx->multisig_item == 0) {
+        len = strcpy_len(ctx->line1, "Multisig ");
+        format_multisig(ctx->line1 + len);
+        len = tx_format_address(SCRIPT_P2SH, ctx->redeem_script_hash, ctx->info, sizeof(ctx->info));
+        paginate_info(&len, 1);
+        return;
+    }
+
+    len = strcpy_len(ctx->line1, "Cosigner ");
+    len += itoa(ctx->multisig_item, ctx->line1 + len, 10);
+    ctx->line1[len++] = '/';
+    itoa(ctx->multisig_n, ctx->line1 + len, 10);
+
+    // the script has OP_m and the pushes of each pubkey: (33, pubkey) * n
+    pubkey = ctx->redeem_script + 1 + (ctx->multisig_item - 1) * (1 + MULTISIG_PUBKEY_LEN) + 1;
+    hash160((uint8_t *)pubkey, MULTISIG_PUBKEY_LEN, hash);
+    len = 0;
+    for (i = 0; i < 4; i++) {
+        ctx->info[len++] = hex_digits[hash[i] >> 4];
+        ctx->info[len++] = hex_digits[hash[i] & 0x0F];
+    }
+    field_ends[0] = len;
+    if (os_memcmp(hash, ctx->multisig_own_hash, 20) == 0) {
+        len += strcpy_len((char*)ctx->info + len, "This device");
+    }
+    field_ends[1] = len;
+    paginate_info(field_ends, (field_ends[1] > field_ends[0] ? 2 : 1));
+}
+
+// shows the final confirmation of the multisig wallet, eg: "Use multisig" / "2 of 3?"
+static void display_multisig_confirm() {
+    uint8_t len;
+
+    strcpy(ctx->line1, "Use multisig");
+    len = format_multisig(ctx->line2);
+    strcpy(ctx->line2 + len, "?");
+    UX_DISPLAY(ui_sign_tx_multisig, ui_prepro_sign_tx_multisig);
+}
+
+// Define the sign tx screen. User will be able to go through the pages of an output
 // (address + value) with left/right buttons. When he's done, he will click both
 // buttons and see next output. A final confirmation screen appears before 
 // sending tokens.
 static const bagl_element_t ui_sign_tx_compare[] = {
     UI_BACKGROUND(),
 
-    // Left and right buttons for scrolling the text.
-    UI_ICON_LEFT(0x01, BAGL_GLYPH_ICON_LEFT),
-    UI_ICON_RIGHT(0x02, BAGL_GLYPH_ICON_RIGHT),
+    // Left and right buttons for changing pages.
+    UI_ICON_LEFT(PAGE_ARROW_LEFT, BAGL_GLYPH_ICON_LEFT),
+    UI_ICON_RIGHT(PAGE_ARROW_RIGHT, BAGL_GLYPH_ICON_RIGHT),
 
     UI_TEXT(0x00, 0, 12, 128, global.sign_tx_context.line1),
     UI_TEXT(0x00, 0, 26, 128, global.sign_tx_context.line2),
 };
 
-// Preprocessor for this screen. Hides left or right arrows depending on the
-// scrolling position.
+// Preprocessor for this screen. Hides left or right arrows on the first and
+// last pages.
 static const bagl_element_t* ui_prepro_sign_tx_compare(const bagl_element_t *element) {
     switch (element->component.userid) {
-    case 1:
-        // 0x01 is the left icon so return NULL if we're displaying the beginning of the text.
-        return (ctx->display_index == 0) ? NULL : element;
-    case 2:
-        // 0x02 is the right, so return NULL if we're displaying the end of the text.
-        return ctx->display_index == (strlen((const char*)ctx->info) - MAX_SCREEN_LENGTH) ? NULL : element;
+    case PAGE_ARROW_LEFT:
+    case PAGE_ARROW_RIGHT:
+        // the arrows' userids are the flags of the pages where they're shown
+        return (ctx->pages.arrows[ctx->pages.current] & element->component.userid) ? element : NULL;
     default:
         // Always display all other elements.
         return element;
@@ -335,30 +680,43 @@ static const bagl_element_t* ui_prepro_sign_tx_compare(const bagl_element_t *ele
 // This is the button handler for the outputs screen.
 static unsigned int ui_sign_tx_compare_button(unsigned int button_mask, unsigned int button_mask_counter) {
     switch (button_mask) {
-        // scroll left by either clicking or pressing the left button
-        case BUTTON_LEFT:
-        case BUTTON_EVT_FAST | BUTTON_LEFT: // SEEK LEFT
-            if (ctx->display_index != 0) {
-                ctx->display_index--;
-                os_memmove(ctx->line2, ctx->info + ctx->display_index, MAX_SCREEN_LENGTH);
+        case BUTTON_EVT_RELEASED | BUTTON_LEFT: // PREVIOUS PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_LEFT) {
+                ctx->pages.current--;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
                 UX_REDISPLAY();
             }
-
             break;
 
-        // scroll right by either clicking or pressing the right button
-        case BUTTON_RIGHT:
-        case BUTTON_EVT_FAST | BUTTON_RIGHT: // SEEK RIGHT
-            if (ctx->display_index != strlen((const char*)ctx->info) - MAX_SCREEN_LENGTH) {
-                ctx->display_index++;
-                os_memmove(ctx->line2, ctx->info + ctx->display_index, MAX_SCREEN_LENGTH);
+        case BUTTON_EVT_RELEASED | BUTTON_RIGHT: // NEXT PAGE
+            if (ctx->pages.arrows[ctx->pages.current] & PAGE_ARROW_RIGHT) {
+                ctx->pages.current++;
+                show_page(&ctx->pages, ctx->info, ctx->line2);
                 UX_REDISPLAY();
             }
-
             break;
 
         case BUTTON_EVT_RELEASED | BUTTON_LEFT | BUTTON_RIGHT: // PROCEED TO NEXT OUTPUT
-            ctx->display_index = 0;
+            if (ctx->redeem_script != NULL) {
+                // next cosigner of the multisig review
+                if (++ctx->multisig_item <= ctx->multisig_n) {
+                    prepare_multisig_item();
+                    UX_REDISPLAY();
+                } else {
+                    display_multisig_confirm();
+                }
+                break;
+            }
+            if (ctx->batch.active || ctx->payout) {
+                // next item of the batch review
+                if (++ctx->batch.review_item < batch_review_len()) {
+                    prepare_batch_review_item();
+                    UX_REDISPLAY();
+                } else {
+                    display_confirm();
+                }
+                break;
+            }
             switch(decode_next_element()) {
                 case TX_STATE_ERR:
                     io_exchange_with_code(SW_INVALID_PARAM, 0);
@@ -371,96 +729,109 @@ static unsigned int ui_sign_tx_compare_button(unsigned int button_mask, unsigned
                     break;
                 case TX_STATE_READY:
                     //display element
-                    if (ctx->elem_type == ELEM_OUTPUT) {
-                        prepare_display_output(ctx->decoded_output);
-                    } else {
-                        THROW(SW_INVALID_PARAM);
-                    }
-
+                    prepare_display_element();
                     UX_REDISPLAY();
                     break;
                 case TX_STATE_FINISHED:
                     // Go to confirmation screen
-                    strcpy(ctx->line1, "Send");
-                    strcpy(ctx->line2, "transaction?");
-                    UX_DISPLAY(ui_sign_tx_confirm, ui_prepro_sign_tx_confirm);
+                    display_confirm();
                     break;
             }
     }
     return 0;
 }
 
-// signs the data on sighash_all with the requested key, given by its index. It places
-// the result directly on G_io_apdu_buffer and sends
-void sign_with_key(uint32_t key_index) {
-    cx_ecfp_public_key_t public_key;
-    cx_ecfp_private_key_t private_key;
-
-    // get key pair for path 44'/280'/0'/0/key_index
-    derive_keypair(&private_key, &public_key, NULL, 2, 0, key_index);
-
-    if (ctx->sighash_all[0] == '\0') {
-        // finish the first hash of the data
-        cx_hash(&ctx->sha256.header, CX_LAST, ctx->sighash_all, 0, ctx->sighash_all, 32);
-        // now get second sha256 of data
-        cx_sha256_init(&ctx->sha256);
-        cx_hash(&ctx->sha256.header, CX_LAST, ctx->sighash_all, 32, ctx->sighash_all, 32);
+// receives the multisig redeem script. One of the script's public keys must belong to
+// this wallet, given by its key index or path. The user then reviews the wallet's
+// address and cosigners and approves the m-of-n wallet, unless it's already the one
+// registered on the session
+void receive_redeem_script(uint8_t p2, uint8_t *data_buffer, uint16_t data_length, volatile unsigned int *flags) {
+    crypto_scratch_t *scratch;
+    uint32_t path[MAX_BIP32_PATH];
+    uint8_t path_len;
+    bool found;
+
+    uint8_t offset = read_key(p2, data_buffer, data_length, path, &path_len);
+    scratch = scratch_acquire();
+    derive_keypair(&scratch->keys.private_key, &scratch->keys.public_key, NULL, path, path_len);
+    compress_public_key(scratch->keys.public_key.W);
+    hash160(scratch->keys.public_key.W, 33, ctx->multisig_own_hash);
+
+    found = parse_multisig_redeem_script(data_buffer + offset, data_length - offset, scratch->keys.public_key.W, &ctx->multisig_m, &ctx->multisig_n);
+    scratch_release();
+    if (!found) {
+        // we can't co-sign for this script
+        THROW(SW_INVALID_PARAM);
+    }
+    hash160(data_buffer + offset, data_length - offset, ctx->redeem_script_hash);
+    if (session.has_redeem_script && os_memcmp(session.redeem_script_hash, ctx->redeem_script_hash, 20) == 0) {
+        // the user already approved it
+        io_exchange_with_code(SW_OK, 0);
+        return;
     }
-    // sign message (sha256d of sighash_all data)
-    int sig_size = cx_ecdsa_sign(&private_key, CX_LAST | CX_RND_RFC6979, CX_SHA256, ctx->sighash_all, 32, G_io_apdu_buffer, 256, NULL);
 
-    // erase sensitive data
-    explicit_bzero(&private_key, sizeof(private_key));
-    explicit_bzero(&public_key, sizeof(public_key));
+    ctx->redeem_script = data_buffer + offset;
+    ctx->multisig_item = 0;
+    prepare_multisig_item();
+    UX_DISPLAY(ui_sign_tx_compare, ui_prepro_sign_tx_compare);
+    *flags |= IO_ASYNCH_REPLY;
+}
 
-    io_exchange_with_code(SW_OK, sig_size);
+// signs the sighash_all data, or the sighash of the given tx in a batch, with each
+// requested key and sends all signatures in a single response
+static void send_signatures(uint8_t p2, uint8_t *data_buffer, uint16_t data_length) {
+    uint16_t tx;
+
+    if (ctx->batch.active != ((p2 & SIGN_TX_P2_BATCH) != 0)) {
+        THROW(SW_INVALID_PARAM);
+    }
+    if (ctx->batch.active) {
+        // each key is preceded by the number of its tx in the batch
+        tx = sign_with_keys(ctx->batch.sighashes[0], ctx->batch.tx_count, p2, data_buffer, data_length, ctx->sign_request);
+    } else {
+        tx = sign_with_keys(ctx->sighash_all, 0, p2, data_buffer, data_length, ctx->sign_request);
+    }
+    io_exchange_with_code(SW_OK, tx);
 }
 
-// receives data and adds to the buffer. Tries to parse an element from the buffer and
-// possibly displays it on screen
+// receives data and adds it to the hash. Tries to parse an element from it, in place,
+// and possibly displays it on screen
 void receive_data(uint8_t *data_buffer, uint16_t data_length, volatile unsigned int *flags) {
+    uint8_t digest[32];
+
     if (ctx->state == UNINITIALIZED) {
         // starting new tx; not initialized yet
         ctx->state = RECEIVING_DATA;
-        ctx->buffer_len = 0;
-        ctx->has_change_output = false;
-        ctx->change_output_index = 0;
-        ctx->change_key_index = 0;
-        ctx->current_output = 0;
-        ctx->display_index = 0;
-        ctx->sighash_all[0] = '\0';
+        ctx->batch.tx_tokens_len = 0;
+        tx_parse_init(&ctx->tx);
+        ctx->tx.hash_destinations = ctx->payout;
         cx_sha256_init(&ctx->sha256);
 
         // the first chunk of data has the change output info
-        uint8_t offset = parse_change_output_info(data_buffer, data_length);
+        uint8_t offset = tx_parse_change_info(&ctx->tx, data_buffer, data_length);
 
         // copy all remaining bytes to hash
         cx_hash(&ctx->sha256.header, 0, data_buffer + offset, data_length - offset, NULL, 0);
 
-        // also get length of tokens, inputs and outputs
-        assert_length(5, data_length - offset);    // version + remaining_tokens + remaining_inputs + outputs_len
-        //transaction->version = U2BE(data_buffer, offset);
-        offset += 2;
-        ctx->remaining_tokens = data_buffer[offset];
-        offset++;
-        ctx->remaining_inputs = data_buffer[offset];
-        offset++;
-        ctx->outputs_len = data_buffer[offset];
-        offset++;
-
-        // copy remaining bytes to decode buffer
-        ctx->buffer_len = data_length - offset;
-        os_memcpy(ctx->buffer, data_buffer + offset, ctx->buffer_len);
+        // the version tells us how to decode the rest of the tx, starting with its
+        // header (length of tokens, inputs and outputs)
+        offset += tx_parse_header(&ctx->tx, data_buffer + offset, data_length - offset);
+        if ((ctx->batch.active || ctx->payout) && ctx->tx.decoder->version != TX_VERSION_REGULAR) {
+            // batches and payouts only have regular txs
+            THROW(SW_INVALID_PARAM);
+        }
+
+        // the remaining bytes are decoded where they are
+        tx_set_data(&ctx->tx, data_buffer + offset, data_length - offset);
     } else {
         // add it to the hash
         cx_hash(&ctx->sha256.header, 0, data_buffer, data_length, NULL, 0);
 
-        // copy to decode buffer
-        os_memcpy(ctx->buffer + ctx->buffer_len, data_buffer, data_length);
-        ctx->buffer_len += data_length;
+        tx_set_data(&ctx->tx, data_buffer, data_length);
     }
 
-    // at this point, ctx->buffer has bytes to be decoded
+    // at this point, ctx->tx has bytes to be decoded. The packet stays on
+    // G_io_apdu_buffer until we reply, even while an element is displayed
     switch(decode_next_element()) {
         case TX_STATE_ERR:
             io_exchange_with_code(SW_INVALID_PARAM, 0);
@@ -472,20 +843,55 @@ void receive_data(uint8_t *data_buffer, uint16_t data_length, volatile unsigned
             THROW(SW_OK);
         case TX_STATE_READY:
             //display element
-            prepare_display_output(ctx->decoded_output);
+            prepare_display_element();
             UX_DISPLAY(ui_sign_tx_compare, ui_prepro_sign_tx_compare);
             *flags |= IO_ASYNCH_REPLY;
             return;
         case TX_STATE_FINISHED:
+            if (ctx->payout) {
+                // the template replaces the review of each output
+                tx_finish_destinations_digest(&ctx->tx, digest);
+                if (!payout_template_find(digest, &ctx->payout_template)) {
+                    THROW(SW_INVALID_PARAM);
+                }
+                ctx->batch.review_item = 0;
+                prepare_batch_review_item();
+                UX_DISPLAY(ui_sign_tx_compare, ui_prepro_sign_tx_compare);
+                *flags |= IO_ASYNCH_REPLY;
+                return;
+            }
+            if (ctx->batch.active) {
+                finish_sighash(ctx->batch.sighashes[ctx->batch.current_tx]);
+                ctx->batch.current_tx++;
+                if (ctx->batch.current_tx < ctx->batch.tx_count) {
+                    // the next tx starts on the next packet
+                    ctx->state = UNINITIALIZED;
+                    THROW(SW_OK);
+                }
+                // all txs received, go to the batch review
+                ctx->batch.review_item = 0;
+                prepare_batch_review_item();
+                UX_DISPLAY(ui_sign_tx_compare, ui_prepro_sign_tx_compare);
+                *flags |= IO_ASYNCH_REPLY;
+                return;
+            }
             // Go to confirmation screen
-            strcpy(ctx->line1, "Send");
-            strcpy(ctx->line2, "transaction?");
-            UX_DISPLAY(ui_sign_tx_confirm, ui_prepro_sign_tx_confirm);
+            display_confirm();
             *flags |= IO_ASYNCH_REPLY;
             return;
     }
 }
 
+// starts a batch of txs, received with p1 = 4
+static void start_batch(uint8_t tx_count) {
+    if (tx_count == 0 || tx_count > MAX_BATCH_TXS) {
+        THROW(SW_INVALID_PARAM);
+    }
+    os_memset(&ctx->batch, 0, sizeof(ctx->batch));
+    ctx->batch.active = true;
+    ctx->batch.tx_count = tx_count;
+}
+
 void handle_sign_tx(uint8_t p1, uint8_t p2, uint8_t *data_buffer, uint16_t data_length, volatile unsigned int *flags, volatile unsigned int *tx) {
     if (p1 == 2) {
         // all done, go back to main menu
@@ -502,19 +908,63 @@ void handle_sign_tx(uint8_t p1, uint8_t p2, uint8_t *data_buffer, uint16_t data_
             return;
         }
 
-        uint32_t key_index = U4BE(data_buffer, 0);
-        sign_with_key(key_index);
+        send_signatures(p2, data_buffer, data_length);
     }
 
     if (p1 == 0) {
         // we're receiving transaction data
-        if (ctx->state == USER_APPROVED) {
-            // can't receive more data after user's approval
+        if (ctx->state == USER_APPROVED || ctx->batch.active || ctx->payout) {
+            // can't receive more data after user's approval, nor mix it with a batch or payout
+            io_exchange_with_code(SW_INVALID_PARAM, 0);
+            ui_idle();
+            return;
+        }
+
+        receive_data(data_buffer, data_length, flags);
+    }
+
+    if (p1 == 3) {
+        // we're receiving a multisig redeem script
+        if (ctx->state != UNINITIALIZED || ctx->redeem_script != NULL || ctx->batch.active || ctx->payout) {
+            // it must come before any transaction data
+            io_exchange_with_code(SW_INVALID_PARAM, 0);
+            ui_idle();
+            return;
+        }
+
+        receive_redeem_script(p2, data_buffer, data_length, flags);
+    }
+
+    if (p1 == 4) {
+        // we're receiving a batch of transactions
+        if (ctx->state == USER_APPROVED || (ctx->state != UNINITIALIZED && !ctx->batch.active) || ctx->payout) {
+            // can't receive more data after user's approval, nor mix it with a single tx
+            io_exchange_with_code(SW_INVALID_PARAM, 0);
+            ui_idle();
+            return;
+        }
+
+        if (!ctx->batch.active) {
+            // the first packet starts with the number of txs
+            if (data_length < 1) {
+                THROW(SW_INVALID_PARAM);
+            }
+            start_batch(data_buffer[0]);
+            data_buffer++;
+            data_length--;
+        }
+        receive_data(data_buffer, data_length, flags);
+    }
+    if (p1 == 5) {
+        // we're receiving a tx to be reviewed by a payout template
+        if (ctx->state == USER_APPROVED || ctx->batch.active || (ctx->state != UNINITIALIZED && !ctx->payout)) {
+            // can't receive more data after user's approval, nor mix it with other txs
             io_exchange_with_code(SW_INVALID_PARAM, 0);
             ui_idle();
             return;
         }
 
+        ctx->payout = true;
         receive_data(data_buffer, data_length, flags);
     }
 }
@@ -0,0 +1,336 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Decoder for the sighash_all data of the sign tx command (see sign_tx.c). It only
+ * works on the state it's given and doesn't touch the screen or the keys, so the
+ * host build of the app core (see host/) shares it to pre-validate txs.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <os.h>
+#include <string.h>
+#include "hathor.h"
+#include "util.h"
+#include "tx_decoder.h"
+
+void tx_parse_init(tx_parse_context_t *tx) {
+    os_memset(tx, 0, sizeof(tx_parse_context_t));
+    tx->token_info_state = TOKEN_INFO_NAME;
+}
+
+uint8_t tx_parse_change_info(tx_parse_context_t *tx, uint8_t *in, size_t inlen) {
+    uint8_t *buf = in;
+    assert_length(1, inlen);
+    // check output change. If next byte is greater than 0, there's a change output
+    tx->has_change_output = (*buf > 0 ? true : false);
+    buf++;
+    if (tx->has_change_output) {
+        assert_length(2, inlen);
+        tx->change_output_index = *buf;
+        buf++;
+        if (in[0] == CHANGE_INFO_PATH) {
+            buf += read_bip32_path(buf, inlen - (buf - in), tx->change_path, &tx->change_path_len);
+        } else if (in[0] == CHANGE_INFO_FILTER) {
+            tx->change_path_len = 0;
+        } else {
+            assert_length(6, inlen);
+            tx->change_path_len = key_index_path(U4BE(buf, 0), tx->change_path);
+            buf += 4;
+        }
+    }
+    return buf - in;
+}
+
+// skips the first len bytes of the data, as they've already been decoded. If they
+// complete an element split across packets, decoding resumes on the packet, right
+// after the element's last byte
+static void consume_data(tx_parse_context_t *tx, uint16_t len) {
+    if (tx->buffer_len > 0) {
+        len -= tx->buffer_len;
+        tx->buffer_len = 0;
+        tx->data = tx->packet;
+        tx->data_len = tx->packet_len;
+    }
+    tx->data += len;
+    tx->data_len -= len;
+}
+
+static void decode_token_uid(tx_parse_context_t *tx) {
+    // read one token uid
+    if (tx->data_len < 32) {
+        THROW(TX_STATE_PARTIAL);
+    }
+    // it's only needed for batch totals, which read it before the next element
+    tx->token_uid = tx->data;
+    if (tx->hash_destinations) {
+        cx_hash(&tx->destinations_sha256.header, 0, tx->data, 32, NULL, 0);
+    }
+    tx->remaining_tokens--;
+    tx->elem_type = ELEM_TOKEN_UID;
+    consume_data(tx, 32);
+}
+
+static void decode_input(tx_parse_context_t *tx) {
+    // read input
+    if (tx->data_len < 35) {        // tx_id (32 bytes) + index (1 byte) + data_len (2 bytes)
+        THROW(TX_STATE_PARTIAL);
+    }
+    // we require the input data to be empty because we're signing the whole
+    // bytes we get from the wallet (in sighash_all, inputs must have no data)
+    if (U2BE(tx->data, 33) > 0) {
+        THROW(TX_STATE_ERR);
+    }
+    // we ignore it
+    tx->remaining_inputs--;
+    tx->elem_type = ELEM_INPUT;
+    consume_data(tx, 35);
+}
+
+static void decode_output(tx_parse_context_t *tx) {
+    uint8_t *buf = parse_output(tx->data, tx->data_len, &tx->decoded_output);
+    tx->decoded_output.index = tx->current_output;
+    tx->elem_type = ELEM_OUTPUT;
+    if (tx->hash_destinations && !(tx->has_change_output && tx->change_output_index == tx->current_output)) {
+        cx_hash(&tx->destinations_sha256.header, 0, &tx->decoded_output.script_type, 1, NULL, 0);
+        cx_hash(&tx->destinations_sha256.header, 0, tx->decoded_output.pubkey_hash, 20, NULL, 0);
+    }
+    consume_data(tx, buf - tx->data);
+    tx->current_output++;
+}
+
+/*
+ * Decodes the token name or symbol of a token creation tx, whichever comes next.
+ * Both have a 1-byte length followed by the string and the name is preceded by
+ * the token info version:
+ *   [info_version (1 byte), name_len (1 byte), name, symbol_len (1 byte), symbol]
+ *
+ * We only keep the symbol, to be displayed to the user.
+ */
+static void decode_token_info(tx_parse_context_t *tx) {
+    uint8_t offset = (tx->token_info_state == TOKEN_INFO_NAME ? 1 : 0);
+    uint8_t max_len = (tx->token_info_state == TOKEN_INFO_NAME ? TOKEN_NAME_MAX_LEN : TOKEN_SYMBOL_MAX_LEN);
+
+    assert_length(offset + 1, tx->data_len);
+    if (offset > 0 && tx->data[0] != TOKEN_INFO_VERSION) {
+        THROW(TX_STATE_ERR);
+    }
+    uint8_t len = tx->data[offset];
+    if (len == 0 || len > max_len) {
+        THROW(TX_STATE_ERR);
+    }
+    assert_length(offset + 1 + len, tx->data_len);
+
+    if (tx->token_info_state == TOKEN_INFO_SYMBOL) {
+        os_memmove(tx->token_symbol, tx->data + 1, len);
+        tx->token_symbol[len] = '\0';
+        tx->token_symbol_len = len;
+        tx->elem_type = ELEM_TOKEN_INFO;
+    } else {
+        tx->elem_type = ELEM_TOKEN_NAME;
+    }
+    tx->token_info_state++;
+    consume_data(tx, offset + 1 + len);
+}
+
+static void decode_end(tx_parse_context_t *tx) {
+    // end of data we should read. Is there something left?
+    if (tx->data_len > 0) {
+        THROW(TX_STATE_ERR);
+    }
+    THROW(TX_STATE_FINISHED);
+}
+
+// regular txs have [num_tokens, num_inputs, num_outputs]
+static void parse_regular_tx_header(tx_parse_context_t *tx, uint8_t *in) {
+    tx->remaining_tokens = in[0];
+    tx->remaining_inputs = in[1];
+    tx->outputs_len = in[2];
+}
+
+// on regular txs, the token uids come first, then inputs and outputs
+static void decode_regular_tx_element(tx_parse_context_t *tx) {
+    if (tx->remaining_tokens > 0) {
+        decode_token_uid(tx);
+    } else if (tx->remaining_inputs > 0) {
+        decode_input(tx);
+    } else if (tx->current_output < tx->outputs_len) {
+        decode_output(tx);
+    } else {
+        decode_end(tx);
+    }
+}
+
+// token creation txs have [num_inputs, num_outputs]. There's no token list, as the
+// only token besides HTR is the one being created
+static void parse_token_creation_tx_header(tx_parse_context_t *tx, uint8_t *in) {
+    tx->remaining_tokens = 0;
+    tx->remaining_inputs = in[0];
+    tx->outputs_len = in[1];
+}
+
+// on token creation txs, inputs and outputs come first, then the token info
+static void decode_token_creation_tx_element(tx_parse_context_t *tx) {
+    if (tx->remaining_inputs > 0) {
+        decode_input(tx);
+    } else if (tx->current_output < tx->outputs_len) {
+        decode_output(tx);
+        // authority outputs don't mint anything
+        if ((tx->decoded_output.token_data & TOKEN_INDEX_MASK) == 1 && !tx->decoded_output.authorities) {
+            tx->minted_amount += tx->decoded_output.value;
+        }
+    } else if (tx->token_info_state != TOKEN_INFO_DONE) {
+        decode_token_info(tx);
+    } else {
+        decode_end(tx);
+    }
+}
+
+static const tx_decoder_t tx_decoders[] = {
+    {TX_VERSION_REGULAR, 3, parse_regular_tx_header, decode_regular_tx_element},
+    {TX_VERSION_TOKEN_CREATION, 2, parse_token_creation_tx_header, decode_token_creation_tx_element},
+};
+
+// returns the decoder for the given tx version, or NULL if we don't support it
+static const tx_decoder_t* lookup_decoder(uint16_t version) {
+    uint8_t i;
+    for (i = 0; i < sizeof(tx_decoders) / sizeof(tx_decoders[0]); i++) {
+        if (tx_decoders[i].version == version) {
+            return &tx_decoders[i];
+        }
+    }
+    return NULL;
+}
+
+uint8_t tx_parse_header(tx_parse_context_t *tx, uint8_t *in, size_t inlen) {
+    // the version tells us how to decode the rest of the tx
+    assert_length(2, inlen);
+    tx->decoder = lookup_decoder(U2BE(in, 0));
+    if (tx->decoder == NULL) {
+        THROW(SW_INVALID_PARAM);
+    }
+
+    // also get length of tokens, inputs and outputs
+    assert_length(2 + tx->decoder->header_len, inlen);
+    void (*parse_header)(tx_parse_context_t *, uint8_t *) = (void (*)(tx_parse_context_t *, uint8_t *)) PIC(tx->decoder->parse_header);
+    parse_header(tx, in + 2);
+    if (tx->hash_destinations) {
+        cx_sha256_init(&tx->destinations_sha256);
+        cx_hash(&tx->destinations_sha256.header, 0, &tx->remaining_tokens, 1, NULL, 0);
+    }
+    return 2 + tx->decoder->header_len;
+}
+
+void tx_finish_destinations_digest(tx_parse_context_t *tx, uint8_t *out) {
+    cx_hash(&tx->destinations_sha256.header, CX_LAST, out, 0, out, 32);
+}
+
+void tx_set_data(tx_parse_context_t *tx, uint8_t *in, uint16_t inlen) {
+    tx->data = in;
+    tx->data_len = inlen;
+}
+
+/*
+ * Starts decoding the element split across packets. Its bytes from the previous
+ * packets are on the buffer and only as many bytes of the current packet as the
+ * largest element may need are copied after them. Once it's decoded, consume_data
+ * goes back to the packet.
+ */
+static void start_split_element(tx_parse_context_t *tx) {
+    uint16_t len = MAX_TX_ELEMENT_LEN - tx->buffer_len;
+
+    if (len > tx->data_len) {
+        len = tx->data_len;
+    }
+
+    os_memmove(tx->buffer + tx->buffer_len, tx->data, len);
+    tx->packet = tx->data;
+    tx->packet_len = tx->data_len;
+    tx->data = tx->buffer;
+    tx->data_len = tx->buffer_len + len;
+}
+
+void tx_decode_element(tx_parse_context_t *tx) {
+    if (tx->buffer_len > 0) {
+        start_split_element(tx);
+    }
+    void (*decode_element)(tx_parse_context_t *) = (void (*)(tx_parse_context_t *)) PIC(tx->decoder->decode_element);
+    decode_element(tx);
+}
+
+bool tx_carry_partial_element(tx_parse_context_t *tx) {
+    if (tx->data_len >= MAX_TX_ELEMENT_LEN) {
+        return false;
+    }
+    if (tx->data != tx->buffer) {
+        os_memmove(tx->buffer, tx->data, tx->data_len);
+    }
+    tx->buffer_len = tx->data_len;
+    tx->data_len = 0;
+    return true;
+}
+
+uint8_t tx_format_address(uint8_t script_type, const uint8_t *hash, unsigned char *out, size_t outlen) {
+    unsigned char address[25];
+    if (script_type == SCRIPT_P2SH) {
+        script_hash_to_address((uint8_t*)hash, address);
+    } else {
+        pubkey_hash_to_address((uint8_t*)hash, address);
+    }
+    return encode_base58(address, 25, out, outlen);
+}
+
+uint8_t tx_format_output(const tx_parse_context_t *tx, const tx_output_t *output, unsigned char *out, uint8_t *field_ends) {
+    // address and value are separate fields, so they're shown on different pages
+    uint8_t len = tx_format_address(output->script_type, output->pubkey_hash, out, 35);
+    field_ends[0] = len;
+    if (output->authorities) {
+        len += format_authorities(output->authorities, (char*)out + len);
+    } else {
+        // on token creation txs, the new token's symbol only comes after the outputs
+        const char *token = "HTR ";
+        if (tx->decoder->version == TX_VERSION_TOKEN_CREATION && (output->token_data & TOKEN_INDEX_MASK) == 1) {
+            token = "new token ";
+        }
+        len += strcpy_len((char*)out + len, token);
+        len += format_value(output->value, out + len);
+    }
+    field_ends[1] = len;
+    return len;
+}
+
+uint8_t tx_format_output_title(const tx_parse_context_t *tx, const tx_output_t *output, char *out) {
+    uint8_t total_outputs = tx->outputs_len;
+    // fake_output_index is used to display consecutive indexes to the user when there's
+    // change output. Also, output indexes start at 0, so add 1 to start on 1
+    uint8_t fake_output_index = output->index + 1;
+    uint8_t len;
+
+    if (tx->has_change_output) {
+        // change output is not shown to user
+        // if there's change output, subtract one
+        total_outputs = tx->outputs_len - 1;
+        if (output->index > tx->change_output_index) {
+            // outputs after the change output don't need to add 1
+            fake_output_index = output->index;
+        }
+    }
+    len = strcpy_len(out, (output->authorities ? "Authority " : "Output "));
+    len += itoa(fake_output_index, out + len, 10);
+    out[len++] = '/';
+    len += itoa(total_outputs, out + len, 10);
+    return len;
+}
+
+uint8_t tx_format_token_info(const tx_parse_context_t *tx, unsigned char *out) {
+    uint8_t len = tx->token_symbol_len;
+    os_memmove(out, tx->token_symbol, len);
+    out[len++] = ' ';
+    len += format_value(tx->minted_amount, out + len);
+    return len;
+}
@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) Hathor Labs and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// largest element of a tx: an output with an 8-byte value and a P2PKH script.
+// Inputs have 35 bytes and token info has up to 32
+#define MAX_TX_ELEMENT_LEN (8 + 1 + 2 + P2PKH_SCRIPT_LEN)
+
+// first byte of the change output info when the change key is given as a bip32 path,
+// or when it's found on the own keys filter
+#define CHANGE_INFO_PATH    0x02
+#define CHANGE_INFO_FILTER  0x03
+
+// elements of the sighash_all data
+typedef enum {
+    ELEM_TOKEN_UID,
+    ELEM_INPUT,
+    ELEM_OUTPUT,
+    ELEM_TOKEN_NAME,
+    ELEM_TOKEN_INFO,
+} tx_element_type_e;
+
+// token creation info comes in 2 parts after the outputs: the name and the symbol
+enum token_info_state_e {
+    TOKEN_INFO_NAME,
+    TOKEN_INFO_SYMBOL,
+    TOKEN_INFO_DONE,
+};
+
+typedef struct tx_parse_context_s tx_parse_context_t;
+
+// Decoding rules for each transaction version. The sighash_all data always starts
+// with the 2-byte version, followed by a header of header_len bytes. See tx_decoders
+// in tx_decoder.c.
+typedef struct {
+    uint16_t version;
+    uint8_t header_len;
+    void (*parse_header)(tx_parse_context_t *tx, uint8_t *in);
+    void (*decode_element)(tx_parse_context_t *tx);
+} tx_decoder_t;
+
+// State of the sighash_all decoder. It only depends on the data it's given, so the
+// host build (see host/) decodes txs exactly like the device does.
+struct tx_parse_context_s {
+    // decoder for this tx version
+    const tx_decoder_t *decoder;
+    // is there a change output in the tx? It there is, it won't be displayed to the user
+    bool has_change_output;
+    // on a given tx, which one is the change output (if it exists)
+    uint8_t change_output_index;
+    // which key the change is sent to. Empty if it's to be found on the own keys filter
+    uint32_t change_path[MAX_BIP32_PATH];
+    uint8_t change_path_len;
+    // bytes still to be decoded. Elements are decoded in place, on the packet
+    // received, except for one split across packets, which is decoded from buffer
+    uint8_t *data;
+    uint16_t data_len;
+    // packet to go back to after the split element
+    uint8_t *packet;
+    uint16_t packet_len;
+    // bytes of the element split across packets, from the previous packets
+    uint8_t buffer[MAX_TX_ELEMENT_LEN];
+    uint16_t buffer_len;
+    // tx info
+    uint8_t remaining_tokens;
+    uint8_t remaining_inputs;
+    uint8_t outputs_len;
+    uint8_t current_output;
+    // token creation info. The symbol is NULL-terminated
+    uint8_t token_info_state;
+    char token_symbol[TOKEN_SYMBOL_MAX_LEN + 1];
+    uint8_t token_symbol_len;
+    uint64_t minted_amount;
+    // type of decoded element
+    uint8_t elem_type;
+    tx_output_t decoded_output;
+    // last decoded token uid. Only valid until the next element is decoded
+    const uint8_t *token_uid;
+    // if set before the header is parsed, the token uids and the destinations of
+    // the outputs are hashed as they're decoded (see tx_finish_destinations_digest)
+    bool hash_destinations;
+    cx_sha256_t destinations_sha256;
+};
+
+/**
+ * Resets the decoder for a new tx.
+ *
+ * @param [out] tx
+ *   The decoder state.
+ *
+ */
+void tx_parse_init(tx_parse_context_t *tx);
+
+/**
+ * Parses the change output info that precedes the sighash_all data. It may be:
+ *   . [0x00]: there's no change output;
+ *   . [CHANGE_INFO_PATH, output_index (1 byte), bip32 path]: the change is sent to
+ *     the key with the given path;
+ *   . [CHANGE_INFO_FILTER, output_index (1 byte)]: the change is sent to one of the
+ *     keys on the own keys filter. change_path_len is 0, as the key isn't known yet;
+ *   . [any other value, output_index (1 byte), key_index (4 bytes)]: the change is
+ *     sent to the key 44'/280'/0'/0/key_index.
+ *
+ * @param [in/out] tx
+ *   The decoder state.
+ *
+ * @param  [in] in
+ *   Data to be parsed.
+ *
+ * @param  [in] inlen
+ *   Size of data to be parsed.
+ *
+ * @return the number of bytes read
+ */
+uint8_t tx_parse_change_info(tx_parse_context_t *tx, uint8_t *in, size_t inlen);
+
+/**
+ * Finishes the digest of the tx's token uids and destinations, after the tx is
+ * decoded with hash_destinations set. It's the sha256 of:
+ *   [tokens_len (1 byte), token_uid (32 bytes) * tokens_len, (script_type (1 byte), hash (20 bytes)) * outputs]
+ *
+ * with the outputs in order, except for the change output. Amounts aren't part of
+ * it, so txs paying the same destinations have the same digest. Payout templates
+ * (see payoutTemplate.c) are the same digest.
+ *
+ * @param [in/out] tx
+ *   The decoder state.
+ *
+ * @param [out] out
+ *   The 32-byte digest.
+ *
+ */
+void tx_finish_destinations_digest(tx_parse_context_t *tx, uint8_t *out);
+
+/**
+ * Parses the tx version and the header of its decoder, at the start of the
+ * sighash_all data. Throws SW_INVALID_PARAM if the version is not supported.
+ *
+ * @param [in/out] tx
+ *   The decoder state.
+ *
+ * @param  [in] in
+ *   Data to be parsed.
+ *
+ * @param  [in] inlen
+ *   Size of data to be parsed.
+ *
+ * @return the number of bytes read
+ */
+uint8_t tx_parse_header(tx_parse_context_t *tx, uint8_t *in, size_t inlen);
+
+/**
+ * Sets the next bytes of the sighash_all data to be decoded. They must stay
+ * available until tx_decode_element throws TX_STATE_PARTIAL.
+ *
+ * @param [in/out] tx
+ *   The decoder state.
+ *
+ * @param  [in] in
+ *   The data.
+ *
+ * @param  [in] inlen
+ *   Size of the data.
+ *
+ */
+void tx_set_data(tx_parse_context_t *tx, uint8_t *in, uint16_t inlen);
+
+/**
+ * Decodes the next element of the tx and sets its type on elem_type. Throws
+ * TX_STATE_PARTIAL if there's not enough data, TX_STATE_ERR if the data is
+ * invalid and TX_STATE_FINISHED after the last element.
+ *
+ * @param [in/out] tx
+ *   The decoder state.
+ *
+ */
+void tx_decode_element(tx_parse_context_t *tx);
+
+/**
+ * Keeps the bytes of a partial element, after tx_decode_element throws
+ * TX_STATE_PARTIAL, so it's completed by the next data.
+ *
+ * @param [in/out] tx
+ *   The decoder state.
+ *
+ * @return false if they're already more than any element may have
+ */
+bool tx_carry_partial_element(tx_parse_context_t *tx);
+
+/**
+ * Writes the base58 address for a P2PKH or P2SH hash.
+ *
+ * @param  [in] script_type
+ *   SCRIPT_P2PKH or SCRIPT_P2SH.
+ *
+ * @param  [in] hash
+ *   The pubkey or script hash.
+ *
+ * @param [out] out
+ *   The NULL-terminated address.
+ *
+ * @param  [in] outlen
+ *   Size of out.
+ *
+ * @return the length of the address
+ */
+uint8_t tx_format_address(uint8_t script_type, const uint8_t *hash, unsigned char *out, size_t outlen);
+
+/**
+ * Writes the text shown for an output: its address and then its token and value,
+ * or its authorities. Eg:
+ *   HHVnn9mr8yPReovgt7AoeJRgS5QoXMa5fo HTR 12.00
+ *
+ * @param  [in] tx
+ *   The decoder state.
+ *
+ * @param  [in] output
+ *   The output.
+ *
+ * @param [out] out
+ *   The text. Should have at least 80 bytes.
+ *
+ * @param [out] field_ends
+ *   The end of the address and of the value, so they're paginated separately.
+ *
+ * @return the length of the text
+ */
+uint8_t tx_format_output(const tx_parse_context_t *tx, const tx_output_t *output, unsigned char *out, uint8_t *field_ends);
+
+/**
+ * Writes the title shown for an output, with its position among the outputs
+ * shown to the user (the change output is not). Eg: "Output 1/3", "Authority 2/3".
+ *
+ * @param  [in] tx
+ *   The decoder state.
+ *
+ * @param  [in] output
+ *   The output.
+ *
+ * @param [out] out
+ *   The NULL-terminated title. Should have at least 18 bytes.
+ *
+ * @return the length of the title
+ */
+uint8_t tx_format_output_title(const tx_parse_context_t *tx, const tx_output_t *output, char *out);
+
+/**
+ * Writes the text shown for the token created by a token creation tx: its symbol
+ * and the amount minted. Eg: "TKN 1,000.00".
+ *
+ * @param  [in] tx
+ *   The decoder state.
+ *
+ * @param [out] out
+ *   The text. Should have at least 34 bytes.
+ *
+ * @return the length of the text
+ */
+uint8_t tx_format_token_info(const tx_parse_context_t *tx, unsigned char *out);
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <os.h>
+#include "util.h"
 
 #define B58_MAX_INPUT_SIZE 120
 
@@ -78,12 +79,13 @@ void strrev(char *str) {
     }
 }
 
-void itoa(int value, char* result, int base) {
+uint8_t itoa(int value, char* result, int base) {
     // check that the base if valid
-    if (base < 2 || base > 36) { *result = '\0'; }
+    if (base < 2 || base > 36) { *result = '\0'; return 0; }
 
     char* ptr = result, *ptr1 = result, tmp_char;
     int tmp_value;
+    uint8_t len;
 
     do {
         tmp_value = value;
@@ -93,20 +95,22 @@ void itoa(int value, char* result, int base) {
 
     // Apply negative sign
     if (tmp_value < 0) *ptr++ = '-';
+    len = ptr - result;
     *ptr-- = '\0';
     while(ptr1 < ptr) {
         tmp_char = *ptr;
         *ptr-- = *ptr1;
         *ptr1++ = tmp_char;
     }
+    return len;
 }
 
-void utoa(uint64_t value, char *s) {
+uint8_t utoa(uint64_t value, char *s) {
     // small optimization
     if (value < 10) {
         s[0] = '0' + (uint8_t)value;
         s[1] = 0;
-        return;
+        return 1;
     }
     uint64_t tmp = value;
     uint8_t idx = 0;
@@ -117,4 +121,63 @@ void utoa(uint64_t value, char *s) {
     }
     s[idx] = 0;
     strrev(s);
+    return idx;
+}
+
+uint8_t strcpy_len(char *out, const char *in) {
+    uint8_t len = 0;
+    while ((out[len] = in[len]) != '\0') {
+        len++;
+    }
+    return len;
+}
+
+uint8_t paginate(const unsigned char *text, const uint8_t *field_ends, uint8_t fields, uint8_t page_len, display_pages_t *pages) {
+    uint8_t count = 0;
+    uint8_t start = 0;
+    uint8_t end, i;
+
+    for (i = 0; i < fields; i++) {
+        while (start < field_ends[i]) {
+            if (count == MAX_DISPLAY_PAGES) {
+                return 0;
+            }
+            end = field_ends[i];
+            if (end - start > page_len) {
+                // break at the last space or after the last comma that fits, so
+                // words and groups of digits aren't split between pages
+                end = start + page_len;
+                while (end > start && text[end] != ' ' && text[end - 1] != ',') {
+                    end--;
+                }
+                if (end == start) {
+                    end = start + page_len;
+                }
+            }
+            pages->offsets[count] = start;
+            pages->lens[count] = end - start;
+            pages->arrows[count] = PAGE_ARROW_LEFT | PAGE_ARROW_RIGHT;
+            count++;
+            start = end;
+            // spaces we break at are not shown
+            while (start < field_ends[i] && text[start] == ' ') {
+                start++;
+            }
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    pages->arrows[0] &= ~PAGE_ARROW_LEFT;
+    pages->arrows[count - 1] &= ~PAGE_ARROW_RIGHT;
+    pages->text_len = field_ends[fields - 1];
+    pages->count = count;
+    pages->current = 0;
+    return count;
+}
+
+void show_page(const display_pages_t *pages, const unsigned char *text, char *out) {
+    uint8_t len = pages->lens[pages->current];
+    os_memmove(out, text + pages->offsets[pages->current], len);
+    out[len] = '\0';
 }
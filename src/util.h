@@ -50,8 +50,9 @@ void strrev(char *str);
  * @param  [in] base
  *   Base to use when converting.
  *
+ * @return the length of the string
  */
-void itoa(int value, char *result, int base);
+uint8_t itoa(int value, char *result, int base);
 
 /**
  * Returns the string representation of an unsigned integer, in base 10. It's
@@ -64,5 +65,85 @@ void itoa(int value, char *result, int base);
  * @param [out] result
  *   String representation of the value.
  *
+ * @return the length of the string
  */
-void utoa(uint64_t value, char *result);
+uint8_t utoa(uint64_t value, char *result);
+
+/**
+ * Copies a NULL-terminated string, like strcpy, and returns its length, so there's
+ * no need for another pass with strlen.
+ *
+ * @param [out] out
+ *   Destination buffer.
+ *
+ * @param  [in] in
+ *   String to be copied.
+ *
+ * @return the length of the string
+ */
+uint8_t strcpy_len(char *out, const char *in);
+
+// maximum number of pages for a text shown one screen at a time. The longest is a
+// token uid in hex (6 pages) followed by the largest value (3 pages)
+#define MAX_DISPLAY_PAGES   9
+
+// arrows shown on a page, when there are pages before (left) or after it (right).
+// Same as the userid of the arrow icons on paginated screens
+#define PAGE_ARROW_LEFT     0x01
+#define PAGE_ARROW_RIGHT    0x02
+
+// Pages of a text shown one screen at a time. They're worked out once, when the
+// text is prepared, so screens only need table lookups when drawing and handling
+// buttons.
+typedef struct {
+    // length of the whole text
+    uint8_t text_len;
+    // number of pages and the one being shown
+    uint8_t count;
+    uint8_t current;
+    // offset and length of each page within the text
+    uint8_t offsets[MAX_DISPLAY_PAGES];
+    uint8_t lens[MAX_DISPLAY_PAGES];
+    // PAGE_ARROW_* flags for each page
+    uint8_t arrows[MAX_DISPLAY_PAGES];
+} display_pages_t;
+
+/**
+ * Splits a text into pages of at most page_len characters, to be shown one page at
+ * a time. The text is made of consecutive fields (eg. address and amount), which
+ * never share a page. Fields longer than a page are broken at the last space (not
+ * shown) or after the last comma that fits, if there is one.
+ *
+ * @param  [in] text
+ *   The text to be split. It doesn't need to be NULL-terminated.
+ *
+ * @param  [in] field_ends
+ *   Offset where each field ends. The last one is the length of the text.
+ *
+ * @param  [in] fields
+ *   Number of fields. Must be at least 1.
+ *
+ * @param  [in] page_len
+ *   Maximum number of characters in a page.
+ *
+ * @param [out] pages
+ *   The pages of the text, starting on the first one.
+ *
+ * @return the number of pages or 0 if they don't fit in MAX_DISPLAY_PAGES
+ */
+uint8_t paginate(const unsigned char *text, const uint8_t *field_ends, uint8_t fields, uint8_t page_len, display_pages_t *pages);
+
+/**
+ * Copies the current page of a text to a NULL-terminated string.
+ *
+ * @param  [in] pages
+ *   Pages of the text.
+ *
+ * @param  [in] text
+ *   The paginated text.
+ *
+ * @param [out] out
+ *   Destination string. Should have room for the longest page plus the NULL.
+ *
+ */
+void show_page(const display_pages_t *pages, const unsigned char *text, char *out);
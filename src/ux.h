@@ -6,7 +6,7 @@
  */
 
 // this is the maximum string length to be displayed on Ledger. Usefull
-// for content that has to scroll horizontally on the screen.
+// for content that has to be split in pages on the screen.
 #define MAX_SCREEN_LENGTH 12
 
 typedef struct {
@@ -14,12 +14,27 @@ typedef struct {
     uint32_t keyIndex;
     // base-58 address
     uint8_t b58_address[34];
-    // the starting index to be shown
-    uint8_t displayIndex;
+    // pages of the address
+    display_pages_t pages;
     // NULL-terminated string for display
     uint8_t partialAddress[MAX_SCREEN_LENGTH + 1];
 } get_address_context_t;
 
+typedef struct {
+    // the user has authorized exporting the keys
+    bool approved;
+    // next account to be exported and how many are left
+    uint32_t account;
+    uint8_t remaining;
+    // display variables
+    unsigned char info[24];     // range of accounts, eg. "0 - 9"
+    // pages of info shown on line2
+    display_pages_t pages;
+    // NULL-terminated string for display
+    char line1[MAX_SCREEN_LENGTH + 1];
+    char line2[MAX_SCREEN_LENGTH + 1];
+} get_xpub_context_t;
+
 /**
  * States have the following meanings:
  * . uninitialized: signing process not strated yet;
@@ -32,45 +47,222 @@ enum sign_tx_state_e {
     USER_APPROVED,
 };
 
+// limits of a batch of txs: txs, distinct custom tokens and distinct destinations
+#define MAX_BATCH_TXS           8
+#define MAX_BATCH_TOKENS        3
+#define MAX_BATCH_DESTINATIONS  6
+
+typedef struct {
+    uint8_t uid[32];
+    uint64_t total;
+} batch_token_t;
+
+typedef struct {
+    uint8_t script_type;
+    uint8_t hash[20];
+} batch_destination_t;
+
+// Several txs approved with a single review. Each tx is hashed into its own sighash
+// and their outputs are aggregated into totals per token and a list of destinations.
+typedef struct {
+    bool active;
+    uint8_t tx_count;
+    // tx being received
+    uint8_t current_tx;
+    uint8_t sighashes[MAX_BATCH_TXS][32];
+    uint64_t htr_total;
+    uint8_t tokens_len;
+    batch_token_t tokens[MAX_BATCH_TOKENS];
+    // batch token for each token uid of the current tx
+    uint8_t tx_tokens_len;
+    uint8_t tx_token_map[MAX_BATCH_TOKENS];
+    uint8_t destinations_len;
+    batch_destination_t destinations[MAX_BATCH_DESTINATIONS];
+    // item of the review being displayed
+    uint8_t review_item;
+} sign_tx_batch_t;
+
 typedef struct {
     enum sign_tx_state_e state;
-    // used for caching the bytes when receiving a partial element
-    uint8_t buffer[300];
-    // total size used in the buffer
-    uint16_t buffer_len;
+    union {
+        // decoder of the tx being received
+        tx_parse_context_t tx;
+        // copy of the signing request, after the user approves the tx
+        uint8_t sign_request[255];
+    };
     // sha256 context for the hash
     cx_sha256_t sha256;
     uint8_t sighash_all[32];
-    // is there a change output in the tx? It there is, it won't be displayed to the user
-    bool has_change_output;
-    // on a given tx, which one is the change output (if it exists)
-    uint8_t change_output_index;
-    // which key the change is sent to
-    uint32_t change_key_index;
-    // tx info
-    uint8_t remaining_tokens;
-    uint8_t remaining_inputs;
-    uint8_t outputs_len;
-    // type of decoded element
-    uint8_t elem_type;
-    uint8_t current_output;
-    tx_output_t decoded_output;
+    // multisig redeem script being reviewed, before it's registered on the session.
+    // It stays on G_io_apdu_buffer until we reply
+    const uint8_t *redeem_script;
+    uint8_t redeem_script_hash[20];
+    // m-of-n of the script and hash160 of our key on it
+    uint8_t multisig_m;
+    uint8_t multisig_n;
+    uint8_t multisig_own_hash[20];
+    // item of the multisig review being displayed
+    uint8_t multisig_item;
+    // batch of txs, when they're received with p1 = 4
+    sign_tx_batch_t batch;
+    // the tx is matched against the payout templates, when it's received with p1 = 5.
+    // Its totals are kept on the batch, which isn't active
+    bool payout;
+    payout_template_t payout_template;
     // display variables
-    unsigned char info[70];     // address + HTR value
-    // the starting index to be shown on a scrolling line (line2 here)
-    uint8_t display_index;
+    unsigned char info[96];     // address + token + value, or token uid in hex + value
+    // pages of info shown on line2
+    display_pages_t pages;
     // NULL-terminated string for display
-    char line1[15];
+    char line1[18];
     char line2[MAX_SCREEN_LENGTH + 1];
 } sign_tx_context_t;
 
+// pubkey hashes looked up at once by the find keys command
+#define MAX_LOOKUP_HASHES 8
+
+typedef struct {
+    // the user has authorized the lookup
+    bool approved;
+    // next key index to be checked and how many are left
+    uint32_t next_index;
+    uint32_t remaining;
+    // the own keys filter has the current keys, so it's used to skip indexes
+    bool use_filter;
+    // pubkey hashes being looked up
+    uint8_t hashes_len;
+    uint8_t hashes[MAX_LOOKUP_HASHES][20];
+    // display variables
+    unsigned char info[48];     // number of hashes, count and first index
+    // pages of info shown on line2
+    display_pages_t pages;
+    // NULL-terminated string for display
+    char line1[MAX_SCREEN_LENGTH + 1];
+    char line2[MAX_SCREEN_LENGTH + 1];
+} find_keys_context_t;
+
+typedef struct {
+    // the user has authorized replacing the filter
+    bool approved;
+    // range of the new filter
+    uint32_t first_index;
+    uint32_t count;
+    // NULL-terminated string for display
+    char line2[MAX_SCREEN_LENGTH + 1];
+} own_filter_context_t;
+
+typedef struct {
+    // destination being added, after the user approves it
+    address_book_entry_t entry;
+    // address and label
+    unsigned char info[35 + ADDRESS_BOOK_LABEL_LEN];
+    // pages of info shown on line2
+    display_pages_t pages;
+    // NULL-terminated string for display
+    char line2[MAX_SCREEN_LENGTH + 1];
+} address_book_context_t;
+
+// stages of a payout template being registered, each one reviewed by the user
+enum payout_template_stage_e {
+    TEMPLATE_NONE,
+    // name and tokens
+    TEMPLATE_HEADER,
+    // a packet of destinations
+    TEMPLATE_DESTINATIONS,
+    // waiting for the next packet
+    TEMPLATE_WAITING,
+    // asking the user to save it
+    TEMPLATE_CONFIRM,
+};
+
+typedef struct {
+    enum payout_template_stage_e stage;
+    // template being registered. The digest is only finished when it's saved
+    payout_template_t entry;
+    cx_sha256_t sha256;
+    // token uids, shown in full as they're approved for good
+    uint8_t tokens_len;
+    uint8_t tokens[MAX_BATCH_TOKENS][32];
+    // destinations of the packet being reviewed. It stays on G_io_apdu_buffer
+    // until we reply
+    const uint8_t *destinations;
+    uint8_t packet_len;
+    // item of the stage being displayed
+    uint8_t item;
+    // display variables
+    unsigned char info[64];     // address or token uid in hex
+    display_pages_t pages;
+    char line1[18];
+    char line2[MAX_SCREEN_LENGTH + 1];
+} payout_template_context_t;
+
+// beginning of a message shown to the user, in bytes
+#define MESSAGE_PREFIX_LEN 20
+
+typedef struct {
+    enum sign_tx_state_e state;
+    // message size and bytes not received yet
+    uint32_t length;
+    uint32_t remaining;
+    // bytes at the start of info copied from the message
+    uint8_t prefix_len;
+    // sha256 context for the message, with the signed message prefix
+    cx_sha256_t sha256;
+    // sha256d of the prefixed message, which is signed
+    uint8_t digest[32];
+    // copy of the signing request, as the signatures overwrite it on the apdu buffer
+    uint8_t keys[255];
+    // display variables
+    unsigned char info[48];     // message prefix + digest
+    // pages of info shown on line2
+    display_pages_t pages;
+    // NULL-terminated string for display
+    char line1[MAX_SCREEN_LENGTH + 1];
+    char line2[MAX_SCREEN_LENGTH + 1];
+} sign_message_context_t;
+
 // To save memory, we store all the context types in a single global union,
 // taking advantage of the fact that only one command is executed at a time.
-typedef union {
-    get_address_context_t get_address_context;
-    sign_tx_context_t sign_tx_context;
+// Commands share the layout of their first fields (eg, the sign state), so the
+// context is reset whenever a different command is received.
+// The crypto scratch arena is kept outside of it, as commands borrow it while
+// their own context is in use.
+typedef struct {
+    // command that owns the union. Another command starts from a clean context
+    uint8_t ins;
+    union {
+        get_address_context_t get_address_context;
+        get_xpub_context_t get_xpub_context;
+        sign_tx_context_t sign_tx_context;
+        sign_message_context_t sign_message_context;
+        find_keys_context_t find_keys_context;
+        own_filter_context_t own_filter_context;
+        address_book_context_t address_book_context;
+        payout_template_context_t payout_template_context;
+    };
+    crypto_scratch_t scratch;
 } commandContext;
-extern commandContext global;
+// APP_STATE is empty on the device. The host build (see host/) runs the app core
+// on several threads and makes the app state thread-local
+#ifndef APP_STATE
+#define APP_STATE
+#endif
+
+extern APP_STATE commandContext global;
+
+// State kept across commands, while the app is open. Unlike the command context,
+// it's not reset when a command completes or fails.
+typedef struct {
+    // derivation cache used by derive_keypair. Entries with path_len = 0 are not used
+    bip32_node_t bip32_cache[BIP32_CACHE_SIZE];
+    // incremented on every cache access, to find the least recently used entry
+    uint32_t bip32_cache_clock;
+    // multisig redeem script approved by the user (see sign_tx.c, p1 = 3). P2SH
+    // change outputs must pay to it
+    bool has_redeem_script;
+    uint8_t redeem_script_hash[20];
+} sessionContext;
+extern APP_STATE sessionContext session;
 
 // ux is a magic global variable implicitly referenced by the UX_ macros. Apps
 // should never need to reference it directly.
@@ -101,3 +293,15 @@ void ui_idle(void);
 // io_exchange with the IO_RETURN_AFTER_TX flag. tx is the current offset
 // within G_io_apdu_buffer (before the code is appended).
 void io_exchange_with_code(uint16_t code, uint16_t tx);
+
+// get_xpub_max_accounts returns the maximum number of accounts in a single get
+// xpub response.
+uint8_t get_xpub_max_accounts(void);
+
+// reset_command_context erases the state of the current command, including any
+// key material in it. The session state is kept.
+void reset_command_context(void);
+
+// reset_session_context erases the state kept across commands, like the
+// derivation cache.
+void reset_session_context(void);